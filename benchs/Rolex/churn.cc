@@ -0,0 +1,80 @@
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "local_memory.hh"
+
+
+DEFINE_uint64(keys, 1000000, "The number of keys loaded into the index.");
+DEFINE_uint64(leaf_num, 100000, "The number of preallocated leaves.");
+DEFINE_uint64(rounds, 20, "The number of churn rounds.");
+DEFINE_double(churn, 0.1, "The fraction of the keys removed and inserted in a round.");
+
+
+using namespace rolex;
+
+/**
+ * Each round removes a random batch of the live keys and inserts the same number of dead keys,
+ * so the number of live keys stays the same unless some insertions fail.
+ * With leaf reclamation, the number of leaves taken from the pool stays flat after a few rounds.
+ *
+ * Usage: ./rolex_churn --keys=1000000 --rounds=20 --churn=0.1
+ */
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  // half of the key space is loaded, the other half is dead
+  std::vector<K> space(FLAGS_keys * 2);
+  for(u64 i=0; i<space.size(); i++) space[i] = i * 16 + 1;
+  std::mt19937_64 rng(0xdeadbeaf);
+  std::shuffle(space.begin(), space.end(), rng);
+  std::vector<K> live(space.begin(), space.begin() + FLAGS_keys);
+  std::vector<K> dead(space.begin() + FLAGS_keys, space.end());
+
+  std::vector<K> loaded(live);
+  std::sort(loaded.begin(), loaded.end());
+  LocalMemory mem(FLAGS_leaf_num);
+  local_rolex_t index(&mem, loaded, loaded);
+  auto alloc = mem.leaf_allocator();
+  // no compute node reads the leaves
+  alloc->set_remote_grace(0);
+  LOG(4) << "Loaded " << FLAGS_keys << " keys into " << alloc->used_num() << " leaves";
+
+  for(u64 r=0; r<FLAGS_rounds; r++) {
+    std::shuffle(live.begin(), live.end(), rng);
+    std::shuffle(dead.begin(), dead.end(), rng);
+    const u64 batch = std::min<u64>(live.size() * FLAGS_churn, dead.size());
+    std::vector<K> next_live(live.begin() + batch, live.end());
+    std::vector<K> next_dead(dead.begin() + batch, dead.end());
+    u64 removed = 0, inserted = 0;
+    for(u64 i=0; i<batch; i++) {
+      removed += index.remove(live[i]);
+      next_dead.push_back(live[i]);
+    }
+    // an insertion fails if the synonym table of the submodel is full, i.e., it needs retraining
+    for(u64 i=0; i<batch; i++) {
+      if(index.insert(dead[i], dead[i])) {
+        inserted += 1;
+        next_live.push_back(dead[i]);
+      } else {
+        next_dead.push_back(dead[i]);
+      }
+    }
+    live.swap(next_live);
+    dead.swap(next_dead);
+    LOG(4) << "Round " << r << ": removed " << removed << ", inserted " << inserted
+           << ", live keys " << live.size()
+           << ", leaves taken from the pool " << alloc->used_num()
+           << ", waiting for reuse " << alloc->cached_free_num();
+  }
+#ifdef ROLEX_RTM
+  RTMStats::local().flush();
+  auto &rtm = RTMStats::global();
+  LOG(4) << "RTM: " << rtm.commits << " writes committed, " << rtm.fallbacks << " locked"
+         << ", abort ratio " << rtm.abort_ratio()
+         << " (conflict " << rtm.conflict << ", capacity " << rtm.capacity << ")";
+#endif
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "r2/src/timer.hh"
+
+#include "local_memory.hh"
+
+
+DEFINE_uint64(keys, 1000000, "The number of keys loaded into the index.");
+DEFINE_uint64(inserts, 500000, "The number of keys inserted after loading.");
+DEFINE_uint64(leaf_num, 200000, "The number of preallocated leaves.");
+DEFINE_string(fills, "1.0,0.9,0.8,0.7,0.6,0.5", "The fill factors to sweep.");
+
+
+using namespace rolex;
+
+/**
+ * The average number of leaves a compute node reads to find a key, over a sample of the keys
+ */
+auto read_amplification(local_rolex_t &index, const std::vector<K> &keys) -> double {
+  const u64 step = std::max<u64>(1, keys.size() / 10000);
+  u64 leaves = 0, n = 0;
+  for(u64 i=0; i<keys.size(); i+=step, n++) leaves += index.read_leaves(keys[i]);
+  return static_cast<double>(leaves) / n;
+}
+
+/**
+ * Load the keys with each fill factor, then insert the new keys in a random order.
+ * A lower fill factor takes more leaves, but the inserts land in place instead of
+ * creating synonym leaves, which a compute node also reads.
+ *
+ * Usage: ./rolex_fill --keys=1000000 --inserts=500000 --fills=1.0,0.8,0.6
+ */
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  // the loaded and the inserted keys interleave in the key space
+  std::vector<K> space(FLAGS_keys + FLAGS_inserts);
+  for(u64 i=0; i<space.size(); i++) space[i] = i * 16 + 1;
+  std::mt19937_64 rng(0xdeadbeaf);
+  std::shuffle(space.begin(), space.end(), rng);
+  std::vector<K> loaded(space.begin(), space.begin() + FLAGS_keys);
+  std::vector<K> inserted(space.begin() + FLAGS_keys, space.end());
+  std::sort(loaded.begin(), loaded.end());
+
+  std::stringstream ss(FLAGS_fills);
+  std::string item;
+  while(std::getline(ss, item, ',')) {
+    const double fill = std::stod(item);
+    LocalMemory mem(FLAGS_leaf_num);
+    local_rolex_t index(&mem, fill);
+    VectorStream<K, V> stream(loaded, loaded);
+    index.bulk_load(stream);
+    const u64 loaded_leaves = mem.leaf_allocator()->used_num();
+    const double load_amp = read_amplification(index, loaded);
+
+    u64 ok = 0;
+    r2::Timer t;
+    for(auto k : inserted) ok += index.insert(k, k);
+    // passed_msec() returns microseconds
+    const double thpt = inserted.size() / (t.passed_msec() / 1000000.0);
+
+    LOG(4) << "fill " << fill << " (" << index.leaf_slots() << " KVs per leaf)"
+           << ": loaded leaves " << loaded_leaves
+           << ", read amplification " << load_amp
+           << " | inserts " << thpt << " ops/s, failed " << inserted.size() - ok
+           << ", leaves " << mem.leaf_allocator()->used_num()
+           << ", read amplification " << read_amplification(index, loaded);
+  }
+  return 0;
+}
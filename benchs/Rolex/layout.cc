@@ -0,0 +1,127 @@
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "r2/src/timer.hh"
+
+#include "local_memory.hh"
+
+
+DEFINE_uint64(keys, 1000000, "The number of keys loaded into the index.");
+DEFINE_uint64(inserts, 200000, "The number of keys inserted after loading.");
+DEFINE_uint64(lookups, 1000000, "The number of lookups of the loaded keys.");
+DEFINE_string(leaf_slots, "32,64,128,256", "The KVs per leaf to sweep, from 16, 32, 64, 128 and 256.");
+DEFINE_string(epsilons, "16,32,64", "The error bounds of the submodels to sweep, from 8, 16, 32 and 64.");
+
+
+using namespace rolex;
+
+/**
+ * @brief One (leaf size, error bound) instantiation of the index over the local regions
+ */
+template<usize N, usize Epsilon>
+struct Layout {
+  static constexpr usize kSlots = N;
+  static constexpr usize kEpsilon = Epsilon;
+  using leaf_t = Leaf<N, K, V>;
+  using leaf_alloc_t = LeafAllocator<leaf_t, sizeof(leaf_t)>;
+  using memory_t = BasicLocalMemory<leaf_t, leaf_alloc_t>;
+  using rolex_t = Rolex<K, V, leaf_t, leaf_alloc_t, memory_t, Epsilon>;
+};
+
+template<usize N, usize... Es, typename F>
+auto with_epsilon(const usize &eps, F &&f) -> bool {
+  return ((eps == Es && (f(Layout<N, Es>()), true)) || ...);
+}
+
+/**
+ * @brief Call f with the layout picked at runtime
+ *
+ * @return false if the layout is not instantiated
+ */
+template<usize... Ns, typename F>
+auto with_layout(const usize &slots, const usize &eps, F &&f) -> bool {
+  return ((slots == Ns && with_epsilon<Ns, 8, 16, 32, 64>(eps, f)) || ...);
+}
+
+auto parse_list(const std::string &s) -> std::vector<usize> {
+  std::vector<usize> res;
+  std::stringstream ss(s);
+  std::string item;
+  while(std::getline(ss, item, ',')) res.push_back(std::stoul(item));
+  return res;
+}
+
+template<typename L>
+void run(const std::vector<K> &loaded, const std::vector<K> &inserted, const std::vector<K> &lookups) {
+  // the inserts may split every leaf they land in
+  typename L::memory_t mem(4 * (loaded.size() + inserted.size()) / L::kSlots + 1024);
+  typename L::rolex_t index(&mem);
+  VectorStream<K, V> stream(loaded, loaded);
+  index.bulk_load(stream);
+
+  V v = 0;
+  u64 found = 0;
+  r2::Timer t;
+  for(auto k : lookups) found += index.search(k, v);
+  // passed_msec() returns microseconds
+  const double lookup_ns = t.passed_msec() * 1000.0 / lookups.size();
+  ASSERT(found == lookups.size()) << "lost " << lookups.size() - found << " keys";
+
+  u64 ok = 0;
+  t.reset();
+  for(auto k : inserted) ok += index.insert(k, k);
+  const double insert_thpt = inserted.size() / (t.passed_msec() / 1000000.0);
+
+  // a compute node reads the predicted leaves and their synonym leaves
+  const u64 step = std::max<u64>(1, loaded.size() / 10000);
+  u64 leaves = 0, n = 0;
+  for(u64 i=0; i<loaded.size(); i+=step, n++) leaves += index.read_leaves(loaded[i]);
+  const double read_bytes = static_cast<double>(leaves) / n * sizeof(typename L::leaf_t);
+
+  const double leaf_mb = mem.leaf_allocator()->used_num() * sizeof(typename L::leaf_t) / 1048576.0;
+  const double model_kb = mem.model_allocator()->used_sz() / 1024.0;
+  LOG(4) << "leaf " << L::kSlots << " KVs (" << sizeof(typename L::leaf_t) << "B), epsilon " << L::kEpsilon
+         << ": lookup " << lookup_ns << " ns, read " << read_bytes << " B/op"
+         << " | leaves " << leaf_mb << " MB, models " << model_kb << " KB (" << index.model_num() << ")"
+         << " | inserts " << insert_thpt << " ops/s, failed " << inserted.size() - ok;
+}
+
+/**
+ * Load the same keys into each (leaf size, error bound) layout, and report
+ *  - the lookup latency on the memory node,
+ *  - the bytes a compute node reads per lookup (the leaves in the predicted window),
+ *  - the memory footprint of the leaves and the models,
+ *  - the insert throughput.
+ * A larger leaf or error bound shrinks the models, which the compute nodes cache,
+ * but each lookup reads more bytes.
+ * Pass one leaf size and one error bound to run a single layout.
+ *
+ * Usage: ./rolex_layout --keys=1000000 --leaf_slots=64,128 --epsilons=16,32
+ */
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::vector<K> space(FLAGS_keys + FLAGS_inserts);
+  for(u64 i=0; i<space.size(); i++) space[i] = i * 16 + 1;
+  std::mt19937_64 rng(0xdeadbeaf);
+  std::shuffle(space.begin(), space.end(), rng);
+  std::vector<K> loaded(space.begin(), space.begin() + FLAGS_keys);
+  std::vector<K> inserted(space.begin() + FLAGS_keys, space.end());
+  std::vector<K> lookups;
+  for(u64 i=0; i<FLAGS_lookups; i++) lookups.push_back(loaded[rng() % loaded.size()]);
+  std::sort(loaded.begin(), loaded.end());
+
+  for(auto slots : parse_list(FLAGS_leaf_slots)) {
+    for(auto eps : parse_list(FLAGS_epsilons)) {
+      auto ok = with_layout<16, 32, 64, 128, 256>(slots, eps, [&](auto layout) {
+        run<decltype(layout)>(loaded, inserted, lookups);
+      });
+      ASSERT(ok) << "the layout of " << slots << " KVs per leaf and epsilon " << eps << " is not instantiated";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "rolex/trait.hpp"
+
+
+namespace rolex {
+
+/**
+ * @brief The leaf/model regions in the local DRAM, so the benchmarks and tests need no NIC
+ */
+template<typename leaf_t, typename leaf_alloc_t>
+class BasicLocalMemory {
+  std::vector<char> leaf_region;
+  std::vector<char> model_region;
+  leaf_alloc_t* leafAlloc;
+  model_alloc_t* modelAlloc;
+
+public:
+  explicit BasicLocalMemory(const u64 &leaf_num, const u64 &model_sz = 1024 * 1024 * 1024)
+      : leaf_region(2*sizeof(u64) + (leaf_num+1)*sizeof(leaf_t)), model_region(model_sz) {
+    leafAlloc = new leaf_alloc_t(leaf_region.data(), leaf_region.size(), leaf_num);
+    modelAlloc = new model_alloc_t(model_region.data(), model_region.size());
+    leafAlloc->set_acked([this]() -> u64 { return modelAlloc->acked_layout(); });
+  }
+
+  ~BasicLocalMemory() {
+    delete leafAlloc;
+    delete modelAlloc;
+  }
+
+  auto leaf_allocator() -> leaf_alloc_t* { return this->leafAlloc; }
+
+  auto model_allocator() -> model_alloc_t* { return this->modelAlloc; }
+};
+
+using LocalMemory = BasicLocalMemory<leaf_t, leaf_alloc_t>;
+using local_rolex_t = Rolex<K, V, leaf_t, leaf_alloc_t, LocalMemory, ROLEX_EPSILON>;
+
+} // namespace rolex
@@ -0,0 +1,131 @@
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "r2/src/timer.hh"
+
+#include "local_memory.hh"
+
+
+DEFINE_uint64(keys, 1000000, "The number of keys loaded into the index.");
+DEFINE_uint64(ops, 1000000, "The number of operations after loading.");
+DEFINE_double(read_ratio, 0.5, "The fraction of the lookups in the operations, the rest are inserts.");
+DEFINE_uint64(leaf_num, 200000, "The number of preallocated leaves.");
+DEFINE_double(fill, 1.0, "The fill factor of the leaves at bulk loading.");
+DEFINE_string(delta_sizes, "0,64,256", "The KVs per delta buffer to sweep, 0 inserts into the leaves directly.");
+DEFINE_bool(append, false, "Insert increasing keys beyond the loaded ones, into the tail segment of the append mode.");
+DEFINE_double(filter_bits, 0, "The bits per key of the Bloom filter of each submodel, 0 disables it.");
+DEFINE_uint64(defrag_runs, 0, "Run the defragmenter on the submodels in at least this many leaf runs, 0 disables it.");
+
+
+using namespace rolex;
+
+/**
+ * Load the keys, then run lookups of the loaded or inserted keys mixed with inserts of new keys,
+ * with each delta buffer size and the compaction thread merging the buffers in the background.
+ * Report the throughput, and the leaves a compute node reads per lookup after compacting the buffers.
+ *
+ * With --append, the inserted keys are increasing and beyond the loaded ones, e.g., timestamps,
+ * and the read amplification is the one of the appended keys.
+ *
+ * With --defrag_runs, the defragmenter relocates the leaves of the submodels in the background and once more
+ * at the end; the leaf runs are the RDMA reads a compute node needs for the whole index.
+ *
+ * The lookups of absent keys at the end report their latency and the leaves a compute node reads for them,
+ * which the filters of --filter_bits skip for most keys.
+ *
+ * Usage: ./rolex_mixed --keys=1000000 --ops=1000000 --read_ratio=0.5 --delta_sizes=0,256
+ */
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  const u64 max_inserts = FLAGS_ops;
+  std::vector<K> space(FLAGS_keys + max_inserts);
+  for(u64 i=0; i<space.size(); i++) space[i] = i * 16 + 1;
+  std::mt19937_64 rng(0xdeadbeaf);
+  // the appended keys arrive in order, after the loaded ones
+  if(!FLAGS_append) std::shuffle(space.begin(), space.end(), rng);
+  std::vector<K> loaded(space.begin(), space.begin() + FLAGS_keys);
+  std::vector<K> inserted(space.begin() + FLAGS_keys, space.end());
+  std::sort(loaded.begin(), loaded.end());
+  // the same operations for each buffer size
+  std::vector<bool> is_read;
+  for(u64 i=0; i<FLAGS_ops; i++) is_read.push_back(std::uniform_real_distribution<double>(0, 1)(rng) < FLAGS_read_ratio);
+
+  std::stringstream ss(FLAGS_delta_sizes);
+  std::string item;
+  while(std::getline(ss, item, ',')) {
+    const usize delta = std::stoul(item);
+    LocalMemory mem(FLAGS_leaf_num);
+    local_rolex_t index(&mem, FLAGS_fill);
+    if(FLAGS_filter_bits > 0) index.enable_filters(FLAGS_filter_bits);
+    VectorStream<K, V> stream(loaded, loaded);
+    index.bulk_load(stream);
+    if(FLAGS_append) index.enable_append();
+    if(delta > 0) {
+      index.enable_delta_buffers(delta);
+      index.start_compaction();
+    }
+    if(FLAGS_defrag_runs > 0) index.start_defrag(FLAGS_defrag_runs);
+
+    std::mt19937_64 op_rng(17);
+    u64 n_insert = 0, ok = 0, found = 0, reads = 0;
+    r2::Timer t;
+    for(u64 i=0; i<FLAGS_ops; i++) {
+      V v = 0;
+      if(is_read[i]) {
+        // the inserted keys are read as well
+        const u64 r = op_rng() % (loaded.size() + n_insert);
+        found += index.search(r < loaded.size() ? loaded[r] : inserted[r - loaded.size()], v);
+        reads++;
+      } else {
+        ok += index.insert(inserted[n_insert], inserted[n_insert]);
+        n_insert++;
+      }
+    }
+    // passed_msec() returns microseconds
+    const double thpt = FLAGS_ops / (t.passed_msec() / 1000000.0);
+    index.stop_compaction();
+    index.stop_defrag();
+    const usize buffered = index.delta_size();
+    index.compact();
+    index.seal_tail();
+    const usize runs = index.leaf_runs();
+    if(FLAGS_defrag_runs > 0) index.defrag(FLAGS_defrag_runs);
+
+    // the appended keys are read as well
+    const std::vector<K> &sampled = FLAGS_append ? inserted : loaded;
+    const u64 step = std::max<u64>(1, sampled.size() / 10000);
+    u64 leaves = 0, n = 0;
+    for(u64 i=0; i<std::min<u64>(sampled.size(), FLAGS_append ? n_insert : sampled.size()); i+=step, n++) {
+      leaves += index.read_leaves(sampled[i]);
+    }
+
+    // the keys between the loaded and inserted ones are absent
+    const u64 n_absent = std::min<u64>(space.size(), 100000);
+    u64 absent_found = 0, absent_leaves = 0;
+    t.reset();
+    for(u64 i=0; i<n_absent; i++) {
+      V v = 0;
+      absent_found += index.search(space[i] + 8, v);
+    }
+    const double absent_ns = t.passed_msec() * 1000.0 / n_absent;
+    for(u64 i=0; i<n_absent; i++) {
+      if(index.may_contain(space[i] + 8)) absent_leaves += index.read_leaves(space[i] + 8);
+    }
+    ASSERT(absent_found == 0) << absent_found << " absent keys are found";
+
+    LOG(4) << "delta buffer " << delta << ": " << thpt << " ops/s"
+           << " | inserts " << n_insert << ", failed " << n_insert - ok << ", buffered at the end " << buffered
+           << " | lookups " << reads << ", missed " << reads - found
+           << " | models " << index.model_num() << ", leaves " << mem.leaf_allocator()->used_num() << " (retired " << mem.leaf_allocator()->shared_free_num() << ")"
+           << ", read amplification " << static_cast<double>(leaves) / n
+           << " | leaf runs " << runs << " -> " << index.leaf_runs()
+           << " | absent lookups " << absent_ns << " ns, leaves read " << static_cast<double>(absent_leaves) / n_absent
+           << ", filters " << index.filter_bytes() / 1024.0 << " KB";
+  }
+  return 0;
+}
@@ -16,6 +16,15 @@
 
 DEFINE_int64(port, 8888, "Server listener (UDP) port.");
 DEFINE_uint64(leaf_num, 10000000, "The number of registed leaves.");
+DEFINE_string(numa, "none", "The NUMA placement of the regions: none, interleave, partition or local.");
+DEFINE_bool(huge_1g, false, "Use 1G huge pages for the regions.");
+DEFINE_double(fill, 1.0, "The fill factor of the leaves at bulk loading, the rest is left for inserts.");
+DEFINE_string(load_file, "", "Stream the index from a binary file of sorted unique keys instead of generating the workload.");
+DEFINE_bool(append, false, "Append the keys beyond the trained ones into a tail segment, sealed into new submodels.");
+DEFINE_uint64(delta_buffer, 0, "The KVs buffered per submodel before they are merged into the leaves, 0 disables the buffers.");
+DEFINE_double(filter_bits, 0, "The bits per key of the Bloom filter of each submodel, which answers the lookups of absent keys, 0 disables it.");
+DEFINE_uint64(filter_sync_ms, 1000, "Write the submodels with new filter keys or unlinked leaves into the model region every this many ms, 0 disables it.");
+DEFINE_uint64(defrag_runs, 0, "Relocate the leaves of a submodel in at least this many runs into one run in the background, 0 disables it.");
 // DEFINE_uint64(reg_leaf_region, 101, "The name to register an MR at rctrl for data nodes.");
 
 
@@ -28,6 +37,12 @@ volatile bool running = false;
 std::atomic<size_t> ready_threads(0);
 RCtrl* ctrl;
 rolex_t *rolex_index;
+int nic_node = 0;
+// the keys streamed from --load_file, which are not materialized in exist_keys
+std::shared_ptr<MappedStream<K, V>> loaded_keys;
+
+inline auto exist_num() -> size_t { return loaded_keys ? loaded_keys->size() : exist_keys.size(); }
+inline auto exist_key(const size_t &i) -> K { return loaded_keys ? loaded_keys->key_at(i) : exist_keys[i]; }
 
 void prepare();
 void run_benchmark(size_t sec);
@@ -52,17 +67,44 @@ void prepare() {
   const usize MB = 1024 * 1024;
   ctrl = new RCtrl(FLAGS_port);
   RM_config conf(ctrl, 1024 * MB, FLAGS_leaf_num*sizeof(leaf_t), FLAGS_reg_leaf_region, FLAGS_leaf_num);
+  std::map<std::string, numa::Placement> placements = {
+    { "none", numa::Default },
+    { "interleave", numa::Interleave },
+    { "partition", numa::Partition },
+    { "local", numa::Local }
+  };
+  ASSERT(placements.find(FLAGS_numa) != placements.end()) << "unsupported NUMA placement: " << FLAGS_numa;
+  conf.placement = placements[FLAGS_numa];
+  conf.page_sz = FLAGS_huge_1g ? (1 << 30) : (2 << 20);
   remote_memory_t* RM = new remote_memory_t(conf);
-
-  load_data();
-  LOG(2) << "[processing data]";
-  std::sort(exist_keys.begin(), exist_keys.end());
-  exist_keys.erase(std::unique(exist_keys.begin(), exist_keys.end()), exist_keys.end());
-  std::sort(exist_keys.begin(), exist_keys.end());
-  for(size_t i=1; i<exist_keys.size(); i++){
-      assert(exist_keys[i]>=exist_keys[i-1]);
+  nic_node = RM->nic_node();
+
+  if(!FLAGS_load_file.empty()) {
+    ASSERT(BenConfig.insert_ratio == 0 && BenConfig.update_ratio == 0)
+        << "--load_file only supports the search and remove workloads";
+    auto stream = MappedStream<K, V>::create(FLAGS_load_file);
+    ASSERT(stream) << "fail to map " << FLAGS_load_file;
+    // the queries read the keys from the same mapping
+    loaded_keys = stream.value();
+    rolex_index = new rolex_t(RM, FLAGS_fill);
+    if(FLAGS_filter_bits > 0) rolex_index->enable_filters(FLAGS_filter_bits);
+    rolex_index->bulk_load(*loaded_keys);
+  } else {
+    load_data();
+    LOG(2) << "[processing data]";
+    std::sort(exist_keys.begin(), exist_keys.end());
+    exist_keys.erase(std::unique(exist_keys.begin(), exist_keys.end()), exist_keys.end());
+    rolex_index = new rolex_t(RM, FLAGS_fill);
+    if(FLAGS_filter_bits > 0) rolex_index->enable_filters(FLAGS_filter_bits);
+    rolex_index->train(exist_keys, exist_keys);
+  }
+  if(FLAGS_append) rolex_index->enable_append();
+  if(FLAGS_delta_buffer > 0) {
+    rolex_index->enable_delta_buffers(FLAGS_delta_buffer);
+    rolex_index->start_compaction();
   }
-  rolex_index = new rolex_t(RM, exist_keys, exist_keys);
+  if(FLAGS_filter_sync_ms > 0) rolex_index->start_filter_sync(FLAGS_filter_sync_ms);
+  if(FLAGS_defrag_runs > 0) rolex_index->start_defrag(FLAGS_defrag_runs);
   // rolex_index->print_data();
 
   RDMA_LOG(2) << "Data distribution bench server started!";
@@ -118,11 +160,17 @@ void run_benchmark(size_t sec) {
         throughput += p.throughput;
     }
     LOG(2)<<"[micro] Throughput(op/s): " << throughput / sec;
+#ifdef ROLEX_NUMA_STATS
+    auto &numa_stats = numa::AccessStats::global();
+    LOG(2)<<"[micro] Sampled leaf accesses: " << numa_stats.sampled
+          << ", remote-node ratio: " << numa_stats.remote_ratio();
+#endif
 }
 
 void *run_fg(void *param) {
     thread_param_t &thread_param = *(thread_param_t *)param;
     uint32_t thread_id = thread_param.thread_id;
+    numa::pin_to_node(nic_node, thread_id);
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -145,10 +193,10 @@ void *run_fg(void *param) {
 	while (running) {
         double d = ratio_dis(gen);
         if (d <= BenConfig.read_ratio) {                   // search
-            K dummy_key = exist_keys[query_i % exist_keys.size()];
+            K dummy_key = exist_key(query_i % exist_num());
             rolex_index->search(dummy_key, dummy_value);
             query_i++;
-            if (unlikely(query_i == exist_keys.size())) {
+            if (unlikely(query_i == exist_num())) {
                 query_i = 0;
             }
         } else if (d <= BenConfig.read_ratio+BenConfig.insert_ratio){  // insert
@@ -166,10 +214,10 @@ void *run_fg(void *param) {
                 update_i = 0;
             }
         }  else {                // remove
-            K dummy_key = exist_keys[delete_i % exist_keys.size()];
+            K dummy_key = exist_key(delete_i % exist_num());
             rolex_index->remove(dummy_key);
             delete_i++;
-            if (unlikely(delete_i == exist_keys.size())) {
+            if (unlikely(delete_i == exist_num())) {
                 delete_i = 0;
             }
         }
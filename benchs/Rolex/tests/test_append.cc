@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "benchs/Rolex/local_memory.hh"
+
+using namespace rolex;
+
+namespace test {
+
+/**
+ * @brief Timestamps with gaps, and every 16-th one swapped with its predecessor
+ */
+auto timestamps(const K &start, const size_t &n) -> std::vector<K> {
+  std::mt19937_64 rng(11);
+  std::vector<K> keys;
+  K k = start;
+  for (size_t i = 0; i < n; ++i) {
+    k += 1 + rng() % 64;
+    keys.push_back(k);
+  }
+  for (size_t i = 16; i < n; i += 16) std::swap(keys[i - 1], keys[i]);
+  return keys;
+}
+
+TEST(Append, tail) {
+  const size_t kNum = 20000;
+  std::vector<K> loaded;
+  for (K k = 1; k <= kNum; ++k) loaded.push_back(k * 32);
+  auto appended = timestamps(loaded.back(), kNum * 4);
+
+  LocalMemory mem(kNum * 4, 64 * 1024 * 1024);
+  // the tail leaves keep the free slots for the swapped keys
+  local_rolex_t index(&mem, loaded, loaded, 0.9);
+  const auto trained = index.model_num();
+  index.enable_append();
+  for (auto k : appended) ASSERT_TRUE(index.insert(k, k + 1)) << k;
+  ASSERT_FALSE(index.insert(appended[7], 0));
+  ASSERT_GT(index.tail_size(), 0);
+  // the segments closed by the appended keys are sealed
+  ASSERT_GT(index.model_num(), trained);
+
+  for (auto k : appended) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k + 1);
+  }
+  ASSERT_TRUE(index.update(appended.back(), 3));
+  ASSERT_TRUE(index.remove(appended[appended.size() - 2]));
+  ASSERT_FALSE(index.remove(appended[appended.size() - 2]));
+
+  // a scan crosses from the submodels into the tail
+  std::vector<V> vals;
+  index.range(appended.back() - 1, 2, vals);
+  ASSERT_EQ(vals, std::vector<V>({3}));
+  vals.clear();
+  index.range(loaded.back(), 2, vals);
+  ASSERT_EQ(vals.size(), 2);
+  ASSERT_EQ(vals[0], loaded.back());
+
+  index.seal_tail();
+  ASSERT_EQ(index.tail_size(), 0);
+  V v = 0;
+  ASSERT_TRUE(index.search(appended.back(), v));
+  ASSERT_EQ(v, 3);
+  // the appended keys are found in about as many leaves as the trained ones, without synonym chains
+  u64 leaves = 0, trained_leaves = 0;
+  for (auto k : appended) leaves += index.read_leaves(k);
+  for (auto k : loaded) trained_leaves += index.read_leaves(k);
+  ASSERT_LT(static_cast<double>(leaves) / appended.size(),
+            static_cast<double>(trained_leaves) / loaded.size() + 1);
+}
+
+TEST(Append, background) {
+  // the compaction and the defragmentation iterate the submodels while the tail seals new ones
+  const size_t kNum = 20000;
+  std::vector<K> loaded;
+  for (K k = 1; k <= kNum; ++k) loaded.push_back(k * 32);
+  auto appended = timestamps(loaded.back(), kNum * 4);
+
+  LocalMemory mem(kNum * 4, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded, 0.9);
+  index.enable_delta_buffers(64);
+  index.enable_append();
+  index.start_compaction(1);
+  index.start_defrag(2, 1);
+
+  std::atomic<bool> running{true};
+  std::thread reader([&]() {
+    std::mt19937_64 rng(5);
+    while (running.load()) {
+      V v = 0;
+      auto k = loaded[rng() % loaded.size()];
+      ASSERT_TRUE(index.search(k, v)) << k;
+      index.search(appended[rng() % appended.size()], v);
+    }
+  });
+  for (auto k : appended) ASSERT_TRUE(index.insert(k, k + 1)) << k;
+  for (K k = 16; k < kNum * 32; k += 32 * 64) ASSERT_TRUE(index.insert(k, k + 1)) << k;
+  running = false;
+  reader.join();
+  index.stop_compaction();
+  index.stop_defrag();
+
+  for (auto k : appended) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k + 1);
+  }
+}
+
+TEST(Append, without_tail) {
+  // the same appends grow the synonym chain of the last submodel, until its synonym table is full
+  const size_t kNum = 20000;
+  std::vector<K> loaded;
+  for (K k = 1; k <= kNum; ++k) loaded.push_back(k * 32);
+  auto appended = timestamps(loaded.back(), kNum * 4);
+  LocalMemory mem(kNum * 4, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded);
+  u64 ok = 0;
+  for (auto k : appended) ok += index.insert(k, k);
+  ASSERT_LT(ok, appended.size());
+}
+
+} // namespace test
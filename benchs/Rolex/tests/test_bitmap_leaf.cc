@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "rolex/trait.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+using bleaf_t = BitmapLeaf<64, K, V>;
+using bleaf_alloc_t = LeafAllocator<bleaf_t, sizeof(bleaf_t)>;
+using bleaf_table_t = LeafTable<K, V, bleaf_t, bleaf_alloc_t>;
+
+TEST(BitmapLeaf, ops) {
+  const usize N = bleaf_t::max_slot();
+  std::vector<K> keys;
+  for (u64 i = 0; i < N; ++i) keys.push_back(i * 3 + 7);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(73));
+
+  bleaf_t leaf;
+  ASSERT_TRUE(leaf.isEmpty());
+  ASSERT_FALSE(leaf.insertHere(1000));
+  for (usize i = 0; i < N; ++i) {
+    // no KV moves: the i-th insertion takes the i-th slot
+    ASSERT_EQ(leaf.insert_not_full(keys[i], keys[i] + 1), i);
+  }
+  ASSERT_TRUE(leaf.isfull());
+  ASSERT_EQ(leaf.insert_not_full(1, 1), N);
+  leaf.self_check();
+
+  V v = 0;
+  for (auto k : keys) {
+    ASSERT_TRUE(leaf.search(k, v));
+    ASSERT_EQ(v, k + 1);
+    ASSERT_FALSE(leaf.contain(k + 1));
+  }
+  ASSERT_TRUE(leaf.update(keys[0], 0));
+  ASSERT_TRUE(leaf.search(keys[0], v));
+  ASSERT_EQ(v, 0);
+
+  // removing the smallest key moves the lower bound
+  ASSERT_FALSE(leaf.insertHere(6));
+  ASSERT_TRUE(leaf.remove(7));
+  ASSERT_FALSE(leaf.remove(7));
+  ASSERT_FALSE(leaf.insertHere(7));
+  ASSERT_TRUE(leaf.insertHere(10));
+  leaf.self_check();
+
+  // the scans see the sorted order
+  std::vector<V> vals;
+  leaf.range(20, 5, vals);
+  ASSERT_EQ(vals.size(), 5);
+  for (usize i = 0; i < vals.size(); ++i) {
+    ASSERT_EQ(vals[i], 22 + i * 3 + 1);
+  }
+}
+
+TEST(BitmapLeaf, split) {
+  const usize N = bleaf_t::max_slot();
+  bleaf_t leaf, n_leaf;
+  for (u64 i = N; i > 0; --i) leaf.insert_not_full(i, i);
+  leaf.split_to(&n_leaf);
+  leaf.self_check();
+  n_leaf.self_check();
+  V v = 0;
+  for (u64 i = 1; i <= N; ++i) {
+    ASSERT_EQ(leaf.search(i, v), i <= N / 2);
+    ASSERT_EQ(n_leaf.search(i, v), i > N / 2);
+  }
+  ASSERT_TRUE(n_leaf.insertHere(N / 2 + 1));
+  ASSERT_FALSE(n_leaf.insertHere(N / 2));
+}
+
+TEST(BitmapLeaf, insert_extents) {
+  // a one-sided insertion writes the slot and the header, not the whole leaf
+  usize sz = 0;
+  for (auto &e : bleaf_t::insert_extents(bleaf_t::max_slot() - 1)) sz += e.second;
+  ASSERT_LE(sz, 128);
+
+  bleaf_t leaf, remote;
+  for (u64 i = 0; i < 10; ++i) {
+    auto pos = leaf.insert_not_full(100 - i, i);
+    for (auto &e : bleaf_t::insert_extents(pos)) {
+      memcpy(reinterpret_cast<char *>(&remote) + e.first, reinterpret_cast<char *>(&leaf) + e.first, e.second);
+    }
+  }
+  remote.self_check();
+  V v = 0;
+  ASSERT_TRUE(remote.search(91, v));
+  ASSERT_EQ(v, 9);
+}
+
+TEST(BitmapLeaf, leaf_table) {
+  const usize leaf_num = 1000;
+  const usize N = bleaf_t::max_slot();
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(bleaf_t));
+  bleaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  alloc.set_remote_grace(0);
+
+  bleaf_table_t ltable;
+  ltable.train_emplace_back(alloc.fetch_new_leaf().second);
+  std::vector<K> keys;
+  for (u64 k = 0; k < N * 4; ++k) keys.push_back(k);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(37));
+  for (auto k : keys) {
+    ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0));
+  }
+  for (u64 k = 0; k < N * 4; ++k) {
+    u64 v = 0;
+    ASSERT_TRUE(ltable.search(k, v, &alloc, 0, 0));
+    ASSERT_EQ(v, k);
+  }
+  std::vector<V> vals;
+  ltable.range(N, N, vals, &alloc, 0, 0);
+  ASSERT_EQ(vals.size(), N);
+  for (usize i = 0; i < N; ++i) ASSERT_EQ(vals[i], N + i);
+
+  for (u64 k = 0; k < N * 4; k += 2) {
+    ASSERT_TRUE(ltable.remove(k, &alloc, 0, 0));
+  }
+  for (u64 k = 0; k < N * 4; ++k) {
+    u64 v = 0;
+    ASSERT_EQ(ltable.search(k, v, &alloc, 0, 0), k % 2 == 1);
+  }
+}
+
+} // namespace test
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "benchs/Rolex/local_memory.hh"
+
+using namespace rolex;
+
+namespace test {
+
+auto sorted_keys(const size_t &n) -> std::vector<K> {
+  std::mt19937_64 rng(73);
+  std::vector<K> keys;
+  K k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    k += 1 + (rng() % 16 == 0 ? rng() % 1000000 : rng() % 32);
+    keys.push_back(k);
+  }
+  return keys;
+}
+
+template <typename T>
+auto write_file(const std::string &path, const std::vector<T> &data) {
+  auto f = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(f != nullptr);
+  fwrite(data.data(), sizeof(T), data.size(), f);
+  fclose(f);
+}
+
+TEST(BulkLoad, stream) {
+  const size_t kNum = 200000;
+  auto keys = sorted_keys(kNum);
+  std::vector<V> vals;
+  std::vector<u64> pairs;
+  for (auto k : keys) {
+    vals.push_back(k * 3);
+    pairs.push_back(k);
+    pairs.push_back(k * 3);
+  }
+  const std::string path = "/tmp/rolex_test_bulk_load.bin";
+  write_file(path, pairs);
+
+  LocalMemory vmem(kNum / 8, 64 * 1024 * 1024);
+  local_rolex_t trained(&vmem, keys, vals);
+
+  auto stream = MappedStream<K, V>::create(path, true);
+  ASSERT_TRUE(stream);
+  ASSERT_EQ(stream.value()->size(), kNum);
+  LocalMemory smem(kNum / 8, 64 * 1024 * 1024);
+  local_rolex_t loaded(&smem);
+  loaded.bulk_load(*(stream.value()));
+  remove(path.c_str());
+
+  // the stream fills the same leaves as the training from the vectors
+  ASSERT_EQ(vmem.leaf_allocator()->used_num(), smem.leaf_allocator()->used_num());
+  for (size_t i = 0; i < kNum; ++i) {
+    V v = 0;
+    ASSERT_TRUE(loaded.search(keys[i], v)) << i;
+    ASSERT_EQ(v, vals[i]);
+    if (i + 1 == kNum || keys[i] + 1 < keys[i + 1]) {
+      ASSERT_FALSE(loaded.search(keys[i] + 1, v));
+    }
+  }
+}
+
+TEST(BulkLoad, fill) {
+  const size_t kNum = 100000;
+  auto keys = sorted_keys(kNum);
+  LocalMemory full_mem(kNum / 8, 64 * 1024 * 1024);
+  local_rolex_t full(&full_mem, keys, keys);
+  LocalMemory half_mem(kNum / 8, 64 * 1024 * 1024);
+  local_rolex_t half(&half_mem, keys, keys, 0.5);
+  ASSERT_EQ(half.leaf_slots(), leaf_t::max_slot() / 2);
+  // the last leaf of a submodel is partially filled in both
+  ASSERT_GT(half_mem.leaf_allocator()->used_num(), full_mem.leaf_allocator()->used_num() * 1.8);
+
+  // the first inserts land in the leaves instead of the synonym leaves
+  const u64 used = half_mem.leaf_allocator()->used_num();
+  for (size_t i = 0; i + 1 < kNum; i += 8) {
+    if (keys[i] + 1 < keys[i + 1]) {
+      ASSERT_TRUE(half.insert(keys[i] + 1, keys[i] + 1));
+    }
+  }
+  ASSERT_EQ(half_mem.leaf_allocator()->used_num(), used);
+  for (size_t i = 0; i < kNum; ++i) {
+    V v = 0;
+    ASSERT_TRUE(half.search(keys[i], v)) << i;
+    ASSERT_EQ(v, keys[i]);
+    if (i % 8 == 0 && i + 1 < kNum && keys[i] + 1 < keys[i + 1]) {
+      ASSERT_TRUE(half.search(keys[i] + 1, v));
+    }
+  }
+}
+
+TEST(BulkLoad, keys_file) {
+  auto keys = sorted_keys(1000);
+  const std::string path = "/tmp/rolex_test_bulk_keys.bin";
+  write_file(path, keys);
+  auto stream = MappedStream<K, V>::create(path).value();
+  remove(path.c_str());
+
+  // the value of a key is the key itself
+  K k;
+  V v;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(stream->key_at(i), keys[i]);
+    ASSERT_TRUE(stream->next(k, v));
+    ASSERT_EQ(k, keys[i]);
+    ASSERT_EQ(v, keys[i]);
+  }
+  ASSERT_FALSE(stream->next(k, v));
+  auto missing = MappedStream<K, V>::create("/tmp/rolex_test_no_such_file");
+  ASSERT_FALSE(missing);
+}
+
+} // namespace test
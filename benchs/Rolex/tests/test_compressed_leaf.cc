@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "rolex/trait.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+using cleaf_t = CompressedLeaf<64, K, V>;
+using cleaf_alloc_t = LeafAllocator<cleaf_t, sizeof(cleaf_t)>;
+using cleaf_table_t = LeafTable<K, V, cleaf_t, cleaf_alloc_t>;
+
+TEST(CompressedLeaf, widths) {
+  const usize N = cleaf_t::max_slot();
+  ASSERT_LT(sizeof(cleaf_t), sizeof(Leaf<64, K, V>) * 4 / 5);
+
+  // the width grows with the span of the keys
+  for (u64 gap : {1UL, 3UL, 1000UL, 60000000UL}) {
+    const u64 base = 1UL << 40;
+    std::vector<K> keys;
+    for (u64 i = 0; i < N; ++i) keys.push_back(base + i * gap);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(gap));
+
+    cleaf_t leaf;
+    for (auto k : keys) {
+      ASSERT_TRUE(leaf.accepts(k));
+      ASSERT_LT(leaf.insert_not_full(k, k + 1), N);
+    }
+    leaf.self_check();
+    ASSERT_TRUE(leaf.isfull());
+    ASSERT_EQ(leaf.width, cleaf_t::width_of((N - 1) * gap));
+    for (auto k : keys) {
+      V v = 0;
+      ASSERT_TRUE(leaf.search(k, v));
+      ASSERT_EQ(v, k + 1);
+      ASSERT_EQ(leaf.search(k + 1, v), gap == 1 && k + 1 < base + N);
+    }
+    ASSERT_FALSE(leaf.contain(base - 1));
+    ASSERT_FALSE(leaf.contain(base + (1UL << 32)));
+  }
+}
+
+TEST(CompressedLeaf, ops) {
+  cleaf_t leaf;
+  ASSERT_TRUE(leaf.isEmpty());
+  ASSERT_FALSE(leaf.insertHere(1000));
+  for (u64 k = 100; k < 110; ++k) leaf.insert_not_full(k, k);
+  // a smaller key moves the base
+  ASSERT_EQ(leaf.insert_not_full(50, 50), 0);
+  ASSERT_TRUE(leaf.insertHere(50));
+  ASSERT_FALSE(leaf.insertHere(49));
+  // the span would exceed 32 bits
+  ASSERT_FALSE(leaf.accepts(50 + (1UL << 32)));
+  ASSERT_EQ(leaf.insert_not_full(50 + (1UL << 32), 0), cleaf_t::max_slot());
+  leaf.self_check();
+
+  ASSERT_TRUE(leaf.update(105, 7));
+  V v = 0;
+  ASSERT_TRUE(leaf.search(105, v));
+  ASSERT_EQ(v, 7);
+
+  ASSERT_TRUE(leaf.remove(50));
+  ASSERT_FALSE(leaf.remove(50));
+  ASSERT_FALSE(leaf.insertHere(99));
+  ASSERT_EQ(leaf.width, 1);
+  leaf.self_check();
+
+  std::vector<V> vals;
+  leaf.range(103, 3, vals);
+  ASSERT_EQ(vals, std::vector<V>({103, 104, 7}));
+
+  cleaf_t n_leaf;
+  leaf.split_to(&n_leaf);
+  leaf.self_check();
+  n_leaf.self_check();
+  ASSERT_TRUE(leaf.search(104, v));
+  ASSERT_TRUE(n_leaf.search(105, v));
+  ASSERT_FALSE(leaf.contain(105));
+}
+
+TEST(CompressedLeaf, leaf_table) {
+  const usize leaf_num = 1000;
+  const usize N = cleaf_t::max_slot();
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(cleaf_t));
+  cleaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  alloc.set_remote_grace(0);
+
+  cleaf_table_t ltable;
+  ltable.train_emplace_back(alloc.fetch_new_leaf().second);
+  std::vector<K> keys;
+  for (u64 k = 0; k < N * 4; ++k) keys.push_back(k * 1000);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(37));
+  for (auto k : keys) {
+    ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0));
+  }
+  // a key too far from the keys of its leaf is rejected, and nothing is lost
+  ASSERT_FALSE(ltable.insert(1UL << 40, 0, &alloc, 0, 0));
+  for (auto k : keys) {
+    u64 v = 0;
+    ASSERT_TRUE(ltable.search(k, v, &alloc, 0, 0));
+    ASSERT_EQ(v, k);
+  }
+  for (u64 k = 0; k < N * 4; k += 2) {
+    ASSERT_TRUE(ltable.remove(k * 1000, &alloc, 0, 0));
+  }
+  std::vector<V> vals;
+  ltable.range(0, N, vals, &alloc, 0, 0);
+  ASSERT_EQ(vals.size(), N);
+  for (usize i = 0; i < N; ++i) ASSERT_EQ(vals[i], (i * 2 + 1) * 1000);
+}
+
+TEST(CompressedLeaf, rejected_key) {
+  const usize leaf_num = 1000;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(cleaf_t));
+  cleaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+
+  cleaf_table_t ltable;
+  ltable.train_emplace_back(alloc.fetch_new_leaf().second);
+  for (u64 k = 0; k < 40; ++k) ASSERT_TRUE(ltable.insert(k * 500, k, &alloc, 0, 0));
+  // the keys beyond the span of the leaf take neither a leaf nor a synonym slot
+  const auto used = alloc.used_num();
+  for (u64 i = 0; i < 200; ++i) ASSERT_FALSE(ltable.insert((1UL << 40) + i, 0, &alloc, 0, 0));
+  ASSERT_EQ(alloc.used_num(), used);
+  ASSERT_EQ(ltable.window_leaves(0, 0), 1);
+  for (u64 k = 20500; k < 20500 + 10 * cleaf_t::max_slot(); k += 7) {
+    ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0)) << k;
+  }
+}
+
+} // namespace test
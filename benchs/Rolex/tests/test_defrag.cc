@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "benchs/Rolex/local_memory.hh"
+
+using namespace rolex;
+
+namespace test {
+
+TEST(Defrag, leaf_run) {
+  const usize leaf_num = 32;
+  std::vector<std::vector<char>> regions;
+  regions.emplace_back(2 * sizeof(u64) + leaf_num * sizeof(leaf_t));
+  leaf_alloc_t alloc(regions[0].data(), regions[0].size(), leaf_num);
+  regions.reserve(leaf_alloc_t::kMaxRegions);
+  alloc.set_grow([&](const u64 &region, const u64 &sz) -> char * {
+    regions.emplace_back(sz);
+    return regions.back().data();
+  });
+
+  auto run = alloc.fetch_leaf_run(20);
+  ASSERT_TRUE(run);
+  ASSERT_EQ(run->second, 0);
+  // a run never crosses a region, the leaves reserved for it are reused by any thread
+  ASSERT_FALSE(alloc.fetch_leaf_run(20));
+  ASSERT_EQ(alloc.shared_free_num(), 20);
+  run = alloc.fetch_leaf_run(20);
+  ASSERT_TRUE(run);
+  ASSERT_EQ(run->second, (1UL << leaf_alloc_t::kRegionShift) | 8);
+  ASSERT_FALSE(alloc.fetch_leaf_run(leaf_num + 1));
+}
+
+TEST(Defrag, acked_layout) {
+  const usize leaf_num = 32;
+  std::vector<char> region(2 * sizeof(u64) + leaf_num * sizeof(leaf_t));
+  leaf_alloc_t alloc(region.data(), region.size(), leaf_num);
+  alloc.set_remote_grace(0);
+  u64 acked = 2;
+  alloc.set_acked([&]() -> u64 { return acked; });
+
+  auto run = alloc.fetch_leaf_run(8);
+  ASSERT_TRUE(run);
+  std::vector<u64> old;
+  for (u64 i = 0; i < 8; ++i) old.push_back(run->second + 7 - i);
+  alloc.retire_runs(old, 4);
+  ASSERT_EQ(alloc.shared_free_num(), 8);
+  // the relocated leaves wait for every compute node to ack the layout version without them
+  run = alloc.fetch_leaf_run(8);
+  ASSERT_TRUE(run);
+  ASSERT_EQ(run->second, 8);
+  acked = 4;
+  run = alloc.fetch_leaf_run(8);
+  ASSERT_TRUE(run);
+  ASSERT_EQ(run->second, 0);
+  ASSERT_EQ(alloc.shared_free_num(), 0);
+}
+
+TEST(Defrag, submodels) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded, inserted;
+  for (u64 i = 0; i < kNum; ++i) {
+    if (i % 4 == 0) loaded.push_back(i * 8 + 1);
+    if (i % 8 == 2) inserted.push_back(i * 8 + 1);
+  }
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded);
+  // each leaf is one run after bulk loading
+  ASSERT_EQ(index.leaf_runs(), index.model_num());
+
+  std::shuffle(inserted.begin(), inserted.end(), std::mt19937_64(7));
+  for (auto k : inserted) ASSERT_TRUE(index.insert(k, k + 1)) << k;
+  ASSERT_GT(index.leaf_runs(), index.model_num());
+
+  auto alloc = mem.leaf_allocator();
+  alloc->set_remote_grace(0);
+  // a compute node has read the submodels
+  auto models = mem.model_allocator();
+  const auto layout = models->layout();
+  *models->get_ack_ptr(5) = layout;
+  ASSERT_GT(index.defrag(), 0);
+  ASSERT_EQ(index.leaf_runs(), index.model_num());
+  ASSERT_EQ(index.defrag(), 0);
+  ASSERT_GT(models->layout(), layout);
+  ASSERT_EQ(models->layout() % 2, 0);
+  ASSERT_EQ(models->acked_layout(), layout);
+
+  for (auto k : loaded) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k);
+  }
+  for (auto k : inserted) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k + 1);
+  }
+  std::sort(inserted.begin(), inserted.end());
+  std::vector<V> vals;
+  index.range(loaded[0], 3, vals);
+  ASSERT_EQ(vals, std::vector<V>({loaded[0], inserted[0] + 1, loaded[1]}));
+
+  // the writes go to the relocated leaves, and the old leaves are reused by the splits
+  // once the compute node reads the new leaf addresses
+  *models->get_ack_ptr(5) = models->layout();
+  const auto retired = alloc->shared_free_num();
+  const auto used = alloc->used_num();
+  ASSERT_GT(retired, 0);
+  ASSERT_TRUE(index.remove(inserted[0]));
+  ASSERT_TRUE(index.update(inserted[1], 5));
+  V v = 0;
+  ASSERT_FALSE(index.search(inserted[0], v));
+  ASSERT_TRUE(index.search(inserted[1], v));
+  ASSERT_EQ(v, 5);
+  for (u64 k = 2; k < 32 * leaf_t::max_slot(); k += 2) ASSERT_TRUE(index.insert(k, k)) << k;
+  ASSERT_LT(alloc->shared_free_num(), retired);
+  ASSERT_EQ(alloc->used_num(), used);
+
+  // a compute node reads the relocated leaves from the model region
+  local_rolex_t replica(&mem);
+  replica.deserialize();
+  ASSERT_EQ(replica.leaf_runs(), index.model_num());
+}
+
+TEST(Defrag, unlinked_synonym) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded;
+  for (u64 i = 0; i < kNum; ++i) loaded.push_back(i * 32 + 1);
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded);
+  const K end = 32 * leaf_t::max_slot();
+  for (K k = 2; k < end; k += 2) ASSERT_TRUE(index.insert(k, k)) << k;
+
+  auto alloc = mem.leaf_allocator();
+  alloc->set_remote_grace(0);
+  // a compute node has read the synonym leaves
+  auto models = mem.model_allocator();
+  ASSERT_EQ(index.sync_filters(), 0);
+  *models->get_ack_ptr(5) = models->layout();
+  for (K k = 1; k < end; ++k) index.remove(k);
+  // the empty synonym leaves are unlinked, but kept until a copy of the submodel without them is written
+  ASSERT_EQ(alloc->cached_free_num(), 0);
+  ASSERT_EQ(alloc->shared_free_num(), 0);
+  const auto layout = models->layout();
+  ASSERT_GT(index.sync_filters(), 0);
+  ASSERT_EQ(index.sync_filters(), 0);
+  ASSERT_GT(models->layout(), layout);
+  const auto unlinked = alloc->shared_free_num();
+  ASSERT_GT(unlinked, 0);
+  ASSERT_TRUE(alloc->fetch_leaf_run(1));
+  ASSERT_EQ(alloc->shared_free_num(), unlinked);
+  // reused once the compute node acks the version
+  *models->get_ack_ptr(5) = models->layout();
+  ASSERT_TRUE(alloc->fetch_leaf_run(1));
+  ASSERT_EQ(alloc->shared_free_num(), unlinked - 1);
+
+  V v = 0;
+  ASSERT_FALSE(index.search(2, v));
+  ASSERT_TRUE(index.search(end + 1, v));
+  ASSERT_EQ(v, end + 1);
+}
+
+TEST(Defrag, background) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded, inserted;
+  for (u64 i = 0; i < kNum; ++i) (i % 2 ? inserted : loaded).push_back(i * 8 + 1);
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded, 0.5);
+  index.start_defrag(2, 1);
+
+  std::shuffle(inserted.begin(), inserted.end(), std::mt19937_64(3));
+  for (auto k : inserted) ASSERT_TRUE(index.insert(k, k)) << k;
+  index.stop_defrag();
+  index.defrag();
+  ASSERT_EQ(index.leaf_runs(), index.model_num());
+  for (auto k : inserted) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k);
+  }
+}
+
+} // namespace test
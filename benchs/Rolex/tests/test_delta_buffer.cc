@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "benchs/Rolex/local_memory.hh"
+#include "rolex/delta_buffer.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+TEST(DeltaBuffer, ops) {
+  DeltaBuffer<u64, u64> buf(8);
+  for (u64 k : {50, 10, 30, 70, 20, 60, 40, 80}) {
+    ASSERT_TRUE(buf.insert(k, k + 1));
+  }
+  ASSERT_TRUE(buf.isfull());
+  ASSERT_FALSE(buf.insert(90, 0));
+  for (usize i = 1; i < buf.size(); ++i) ASSERT_LT(buf.keys[i - 1], buf.keys[i]);
+
+  u64 v = 0;
+  ASSERT_TRUE(buf.search(30, v));
+  ASSERT_EQ(v, 31);
+  ASSERT_FALSE(buf.search(35, v));
+  ASSERT_TRUE(buf.update(30, 7));
+  ASSERT_TRUE(buf.remove(10));
+  ASSERT_FALSE(buf.remove(10));
+  ASSERT_FALSE(buf.insert(30, 0));
+
+  // the kept KVs stay sorted
+  auto moved = buf.drain([](const u64 &k, const u64 &v) { return k % 20 == 0; });
+  ASSERT_EQ(moved, 4);
+  ASSERT_EQ(std::vector<u64>(buf.keys, buf.keys + buf.size()), std::vector<u64>({30, 50, 70}));
+  ASSERT_TRUE(buf.search(30, v));
+  ASSERT_EQ(v, 7);
+}
+
+TEST(DeltaBuffer, rolex) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded, inserted;
+  for (u64 i = 0; i < kNum; ++i) (i % 2 ? inserted : loaded).push_back(i * 8 + 1);
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded, 0.5);
+  index.enable_delta_buffers(64);
+
+  std::shuffle(inserted.begin(), inserted.end(), std::mt19937_64(5));
+  for (auto k : inserted) ASSERT_TRUE(index.insert(k, k)) << k;
+  for (auto k : loaded) ASSERT_FALSE(index.insert(k, 0));
+  // some inserts overflow the buffers into the leaves
+  ASSERT_GT(index.delta_size(), 0);
+  ASSERT_FALSE(index.insert(inserted[0], 0));
+  ASSERT_TRUE(index.update(inserted[0], 3));
+  ASSERT_TRUE(index.remove(inserted[1]));
+  V v = 0;
+  ASSERT_FALSE(index.search(inserted[1], v));
+
+  auto buffered = index.delta_size();
+  ASSERT_EQ(index.compact(), buffered);
+  ASSERT_EQ(index.delta_size(), 0);
+  ASSERT_TRUE(index.search(inserted[0], v));
+  ASSERT_EQ(v, 3);
+  for (usize i = 2; i < inserted.size(); ++i) {
+    ASSERT_TRUE(index.search(inserted[i], v));
+    ASSERT_EQ(v, inserted[i]);
+  }
+
+  // a scan merges the buffer first
+  ASSERT_TRUE(index.insert(2, 2));
+  std::vector<V> vals;
+  index.range(0, 2, vals);
+  ASSERT_EQ(vals, std::vector<V>({1, 2}));
+}
+
+TEST(DeltaBuffer, compaction) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded, inserted;
+  for (u64 i = 0; i < kNum; ++i) (i % 2 ? inserted : loaded).push_back(i * 8 + 1);
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem, loaded, loaded, 0.5);
+  index.enable_delta_buffers(32);
+  index.start_compaction(10);
+
+  std::shuffle(inserted.begin(), inserted.end(), std::mt19937_64(9));
+  for (auto k : inserted) ASSERT_TRUE(index.insert(k, k)) << k;
+  index.stop_compaction();
+  auto buffered = index.delta_size();
+  ASSERT_EQ(index.compact(), buffered);
+  for (auto k : inserted) {
+    V v = 0;
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k);
+  }
+}
+
+TEST(DeltaBuffer, lock_free_search) {
+  DeltaBuffer<u64, u64> buf(64);
+  // the even keys stay in the buffer, the odd ones come and go
+  for (u64 k = 0; k < 64; k += 2) buf.insert(k, k + 1);
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+    std::mt19937_64 rng(3);
+    while (!done.load()) {
+      u64 k = rng() % 64 | 1;
+      buf.lock.lock();
+      if (!buf.remove(k)) buf.insert(k, k + 1);
+      buf.lock.unlock();
+    }
+  });
+  for (u64 i = 0; i < 1000000; ++i) {
+    u64 k = i % 64, v = 0;
+    bool found = buf.search(k, v);
+    if (k % 2 == 0) ASSERT_TRUE(found) << k;
+    if (found) ASSERT_EQ(v, k + 1);
+  }
+  done = true;
+  writer.join();
+}
+
+} // namespace test
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "benchs/Rolex/local_memory.hh"
+#include "rolex/bloom_filter.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+auto false_positives(BloomFilter<u64> &f, const u64 &n) -> double {
+  u64 fp = 0;
+  // the keys added are even
+  for (u64 k = 1; k < 2 * n; k += 2) fp += f.may_contain(k);
+  return static_cast<double>(fp) / n;
+}
+
+TEST(BloomFilter, fpr) {
+  const u64 kNum = 100000;
+  double last = 1;
+  for (double bits : {4.0, 8.0, 16.0}) {
+    BloomFilter<u64> f(kNum, bits);
+    for (u64 k = 0; k < 2 * kNum; k += 2) f.add(k);
+    for (u64 k = 0; k < 2 * kNum; k += 2) ASSERT_TRUE(f.may_contain(k)) << k;
+    // the rate falls with the memory
+    auto fpr = false_positives(f, kNum);
+    ASSERT_LT(fpr, last) << bits;
+    last = fpr;
+  }
+  ASSERT_LT(last, 0.01);
+}
+
+TEST(BloomFilter, remove_and_serialize) {
+  const u64 kNum = 10000;
+  BloomFilter<u64> f(kNum, 10);
+  for (u64 k = 0; k < 2 * kNum; k += 2) f.add(k);
+  const auto fpr = false_positives(f, kNum);
+  // a removal clears the bits of the key, unless they are shared with the other keys
+  for (u64 k = 0; k < kNum; k += 2) f.remove(k);
+  u64 kept = 0;
+  for (u64 k = 0; k < kNum; k += 2) kept += f.may_contain(k);
+  ASSERT_LT(kept, kNum / 2 * 0.05);
+  for (u64 k = kNum; k < 2 * kNum; k += 2) ASSERT_TRUE(f.may_contain(k)) << k;
+
+  // the compute nodes get the same answers
+  BloomFilter<u64> g(f.serialize());
+  ASSERT_EQ(g.hashes(), f.hashes());
+  for (u64 k = 0; k < 2 * kNum; ++k) ASSERT_EQ(g.may_contain(k), f.may_contain(k)) << k;
+  ASSERT_LT(false_positives(g, kNum), fpr);
+}
+
+TEST(BloomFilter, rolex) {
+  const u64 kNum = 20000;
+  std::vector<K> loaded, absent;
+  for (u64 i = 0; i < kNum; ++i) (i % 2 ? absent : loaded).push_back(i * 8 + 1);
+  LocalMemory mem(kNum, 64 * 1024 * 1024);
+  local_rolex_t index(&mem);
+  index.enable_filters(12);
+  index.train(loaded, loaded);
+  ASSERT_GT(index.filter_bytes(), 0);
+
+  V v = 0;
+  for (auto k : loaded) {
+    ASSERT_TRUE(index.search(k, v)) << k;
+    ASSERT_EQ(v, k);
+  }
+  for (auto k : absent) ASSERT_FALSE(index.search(k, v)) << k;
+
+  // the inserts and removals keep the filters
+  ASSERT_TRUE(index.insert(absent[0], 3));
+  ASSERT_FALSE(index.insert(loaded[0], 3));
+  ASSERT_TRUE(index.search(loaded[0], v));
+  ASSERT_EQ(v, loaded[0]);
+  ASSERT_TRUE(index.search(absent[0], v));
+  ASSERT_EQ(v, 3);
+  ASSERT_TRUE(index.update(absent[0], 4));
+  ASSERT_TRUE(index.remove(loaded[1]));
+  ASSERT_FALSE(index.search(loaded[1], v));
+  ASSERT_TRUE(index.insert(loaded[1], 5));
+  ASSERT_TRUE(index.search(loaded[1], v));
+  ASSERT_EQ(v, 5);
+
+  // a compute node reads the filters with the submodels, once they are synced with the inserts
+  ASSERT_GT(index.sync_filters(), 0);
+  local_rolex_t replica(&mem);
+  replica.deserialize();
+  u64 skipped = 0;
+  for (auto k : absent) skipped += !replica.may_contain(k);
+  ASSERT_GT(skipped, absent.size() * 0.95);
+
+  // a key inserted after the copies were read is never reported absent by them
+  auto k = std::find_if(absent.begin() + 2, absent.end(), [&](const K &k) { return !replica.may_contain(k); });
+  ASSERT_NE(k, absent.end());
+  ASSERT_TRUE(index.insert(*k, 7));
+  ASSERT_TRUE(replica.may_contain(*k));
+
+  index.insert(absent[1], 6);
+  // only the filters with new keys are written again
+  ASSERT_GT(index.sync_filters(), 0);
+  ASSERT_EQ(index.sync_filters(), 0);
+  local_rolex_t refreshed(&mem);
+  refreshed.deserialize();
+  ASSERT_TRUE(refreshed.may_contain(absent[0]));
+  ASSERT_TRUE(refreshed.may_contain(absent[1]));
+  ASSERT_TRUE(refreshed.may_contain(*k));
+  ASSERT_TRUE(refreshed.search(absent[1], v));
+  ASSERT_EQ(v, 6);
+  skipped = 0;
+  for (auto a : absent) skipped += !refreshed.may_contain(a);
+  ASSERT_GT(skipped, absent.size() * 0.9);
+}
+
+} // namespace test
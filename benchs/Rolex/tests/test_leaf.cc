@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "rolex/leaf.hpp"
+#include "rolex/leaf_table.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+template <usize N>
+void check_hinted_search(const usize &num) {
+  Leaf<N, u64, u64> leaf;
+  for (u64 i = 0; i < num; ++i) {
+    leaf.insert_not_full(i * 4 + 8, i);
+  }
+  // any hint finds the same keys, including the ones out of the leaf
+  for (usize hint = 0; hint <= N; ++hint) {
+    for (u64 k = 0; k < num * 4 + 16; ++k) {
+      u64 v = 0, w = 0;
+      auto found = leaf.search(k, v);
+      ASSERT_EQ(leaf.search(k, w, hint), found) << "key " << k << ", hint " << hint;
+      if (found) ASSERT_EQ(v, w);
+    }
+  }
+}
+
+TEST(Leaf, hinted_search) {
+  check_hinted_search<64>(64);
+  check_hinted_search<64>(37);
+  check_hinted_search<256>(256);
+  check_hinted_search<256>(1);
+  check_hinted_search<256>(0);
+}
+
+TEST(Leaf, slot_hint) {
+  SlotHint hint{3, 17};
+  ASSERT_EQ(hint.at(3), 17);
+  ASSERT_EQ(hint.at(4), 0);
+  // the key is at the tail of a leaf before the predicted one
+  Leaf<64, u64, u64> leaf;
+  for (u64 i = 0; i < 10; ++i) leaf.insert_not_full(i, i);
+  u64 v = 0;
+  ASSERT_TRUE(leaf.search(9, v, hint.at(2)));
+  ASSERT_EQ(v, 9);
+}
+
+} // namespace test
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "rolex/trait.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+TEST(LeafAllocator, concurrent_fetch) {
+  const usize leaf_num = 1000;
+  const usize num_threads = 4;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+
+  // each thread fetches leaves until the pool is almost drained
+  std::vector<std::vector<u64>> fetched(num_threads);
+  std::vector<std::thread> threads;
+  for (usize i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (usize j = 0; j < leaf_num / num_threads - 16; ++j) {
+        auto leaf = alloc.fetch_new_leaf();
+        ASSERT_EQ(leaf.first, alloc.get_leaf(leaf.second));
+        fetched[i].push_back(leaf.second);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  std::vector<bool> seen(leaf_num, false);
+  for (auto &nums : fetched) {
+    for (auto num : nums) {
+      ASSERT_LT(num, leaf_num);
+      ASSERT_FALSE(seen[num]);
+      seen[num] = true;
+    }
+  }
+  ASSERT_LE(alloc.used_num(), leaf_num);
+}
+
+TEST(LeafAllocator, drain) {
+  const usize leaf_num = 1000;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  {
+    leaf_alloc_t old_alloc(pool.data(), pool.size(), leaf_num);
+    old_alloc.fetch_new_leaf();
+  }
+  // a new allocator does not reuse the batch cached for the old one
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+
+  // near the end of the pool, every leaf can still be handed out
+  for (usize i = 0; i < leaf_num; ++i) {
+    ASSERT_EQ(alloc.fetch_new_leaf().second, i);
+  }
+  ASSERT_EQ(alloc.used_num(), leaf_num);
+}
+
+TEST(LeafAllocator, lazy_format) {
+  const usize leaf_num = 1000;
+  std::vector<char> pool(2 * sizeof(u64) + leaf_num * sizeof(leaf_t), 0x11);
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  // the leaves are not formatted until handed out
+  ASSERT_EQ(pool.back(), 0x11);
+  for (usize i = 0; i < leaf_num; ++i) {
+    auto leaf = alloc.fetch_new_leaf();
+    ASSERT_TRUE(reinterpret_cast<leaf_t *>(leaf.first)->isEmpty());
+  }
+}
+
+TEST(LeafAllocator, grow) {
+  const usize leaf_num = 100;
+  std::vector<std::vector<char>> regions;
+  regions.emplace_back(2 * sizeof(u64) + leaf_num * sizeof(leaf_t));
+  leaf_alloc_t alloc(regions[0].data(), regions[0].size(), leaf_num);
+  regions.reserve(leaf_alloc_t::kMaxRegions);
+  alloc.set_grow([&](const u64 &region, const u64 &sz) -> char * {
+    EXPECT_EQ(region, regions.size());
+    regions.emplace_back(sz);
+    return regions.back().data();
+  });
+
+  // fill 3 regions and a half, the ltable records the regions of the leaves
+  leaf_table_t ltable;
+  for (usize i = 0; i < leaf_num * 7 / 2; ++i) {
+    auto leaf = alloc.fetch_new_leaf();
+    ASSERT_EQ(leaf.first, alloc.get_leaf(leaf.second));
+    reinterpret_cast<leaf_t *>(leaf.first)->insert_not_full(i, i);
+    ltable.train_emplace_back(leaf.second);
+  }
+  ASSERT_EQ(alloc.region_num(), 4);
+  ASSERT_EQ(regions.size(), 4);
+  ASSERT_EQ(alloc.allocated_num(), 4 * leaf_num);
+  for (usize i = 0; i < ltable.table_size(); ++i) {
+    ASSERT_EQ(ltable.table[i].leaf_region, i / leaf_num);
+    ASSERT_EQ(ltable.table[i].leaf_num, i % leaf_num);
+    auto leaf = reinterpret_cast<leaf_t *>(alloc.get_leaf(leaf_id(ltable.table[i])));
+    u64 v = 0;
+    ASSERT_TRUE(leaf->search(i, v));
+  }
+}
+
+TEST(LeafAllocator, reclaim) {
+  const usize leaf_num = 1000;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  alloc.set_remote_grace(0);
+
+  auto retired = alloc.fetch_new_leaf();
+  reinterpret_cast<leaf_t *>(retired.first)->insert_not_full(73, 73);
+  {
+    // a reader pinned before the retirement blocks the reuse
+    auto guard = alloc.pin();
+    alloc.retire(retired.second);
+    ASSERT_NE(alloc.fetch_new_leaf().second, retired.second);
+  }
+  auto reused = alloc.fetch_new_leaf();
+  ASSERT_EQ(reused.second, retired.second);
+  ASSERT_TRUE(reinterpret_cast<leaf_t *>(reused.first)->isEmpty());
+  ASSERT_EQ(alloc.cached_free_num(), 0);
+}
+
+TEST(LeafAllocator, thread_exit) {
+  const usize leaf_num = 1000;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  alloc.set_remote_grace(0);
+
+  std::thread([&]() {
+    alloc.fetch_new_leaf();
+    alloc.retire(alloc.fetch_new_leaf().second);
+  }).join();
+  // the rest of the batch and the retired leaf are handed to the other threads
+  const auto used = alloc.used_num();
+  ASSERT_EQ(alloc.shared_free_num(), used - 1);
+  for (u64 i = 0; i + 1 < used; ++i) alloc.fetch_new_leaf();
+  ASSERT_EQ(alloc.shared_free_num(), 0);
+  ASSERT_EQ(alloc.used_num(), used);
+
+  // a thread may exit after its allocator is destroyed
+  std::thread([&]() {
+    std::vector<char> other_pool(pool.size());
+    leaf_alloc_t other(other_pool.data(), other_pool.size(), leaf_num);
+    other.fetch_new_leaf();
+  }).join();
+}
+
+TEST(LeafAllocator, reuse_synonym) {
+  const usize leaf_num = 1000;
+  const usize N = leaf_t::max_slot();
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+  alloc.set_remote_grace(0);
+
+  leaf_table_t ltable;
+  ltable.train_emplace_back(alloc.fetch_new_leaf().second);
+  // the last insertion splits the leaf
+  for (u64 k = 0; k <= N; ++k) {
+    ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0));
+  }
+  ASSERT_EQ(ltable.SynonymTable[0].leaf_num, 2);
+  auto synonym_leaf = ltable.SynonymTable[1].leaf_num;
+
+  // empty the synonym leaf
+  for (u64 k = N / 2; k <= N; ++k) {
+    ASSERT_TRUE(ltable.remove(k, &alloc, 0, 0));
+  }
+  ASSERT_EQ(ltable.table[0].synonym_leaf, 0);
+  // the leaf is kept for the copies of the table in the model region
+  ASSERT_EQ(alloc.cached_free_num(), 0);
+  std::vector<u64> unlinked;
+  ltable.take_unlinked(unlinked);
+  ASSERT_EQ(unlinked.size(), 1);
+  ASSERT_FALSE(ltable.has_unlinked());
+  // no compute node has read the table, so the leaf only waits for the local readers
+  alloc.retire(unlinked[0]);
+  ASSERT_EQ(alloc.cached_free_num(), 1);
+
+  // the next split reuses both the leaf and the synonym slot
+  for (u64 k = N / 2; k <= N; ++k) {
+    ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0));
+  }
+  ASSERT_EQ(ltable.SynonymTable[0].leaf_num, 2);
+  ASSERT_EQ(ltable.SynonymTable[1].leaf_num, synonym_leaf);
+  for (u64 k = 0; k <= N; ++k) {
+    u64 v = 0;
+    ASSERT_TRUE(ltable.search(k, v, &alloc, 0, 0));
+    ASSERT_EQ(v, k);
+  }
+}
+
+} // namespace test
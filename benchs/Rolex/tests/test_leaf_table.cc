@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 #include "rolex/leaf_table.hpp"
 #include "rolex/trait.hpp"
 #include "rolex/remote_memory.hh"
@@ -27,6 +30,49 @@ TEST(LeafTable, leaf_table) {
 
   ltable.unlock_leaf(1);
   ASSERT_EQ(ltable.table[1].lock, 0);
+  // the lock holder keeps the links it changed
+  ASSERT_EQ(ltable.table[1].synonym_leaf, 1);
+  ltable.table[0].lock = 1;
+  ASSERT_EQ(ltable.table[0].val & kTELockBit, kTELockBit);
+}
+
+TEST(LeafTable, concurrent_writes) {
+  const usize leaf_num = 1000;
+  const usize num_threads = 4;
+  const u64 per_thread = 500;
+  std::vector<char> pool(2 * sizeof(u64) + (leaf_num + 1) * sizeof(leaf_t));
+  leaf_alloc_t alloc(pool.data(), pool.size(), leaf_num);
+
+  leaf_table_t ltable;
+  ltable.train_emplace_back(alloc.fetch_new_leaf().second);
+  // the threads interleave their keys, so they split the same leaves
+  std::vector<std::thread> threads;
+  for (usize t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (u64 i = 0; i < per_thread; ++i) {
+        auto k = i * num_threads + t;
+        ASSERT_TRUE(ltable.insert(k, k, &alloc, 0, 0));
+      }
+      for (u64 i = 0; i < per_thread; i += 2) {
+        auto k = i * num_threads + t;
+        ASSERT_TRUE(ltable.update(k, k + 1, &alloc, 0, 0));
+      }
+      for (u64 i = 1; i < per_thread; i += 4) {
+        ASSERT_TRUE(ltable.remove(i * num_threads + t, &alloc, 0, 0));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (u64 k = 0; k < per_thread * num_threads; ++k) {
+    u64 v = 0;
+    auto i = k / num_threads;
+    ASSERT_EQ(ltable.search(k, v, &alloc, 0, 0), i % 4 != 1) << k;
+    if (i % 4 != 1) ASSERT_EQ(v, i % 2 == 0 ? k + 1 : k) << k;
+  }
+  ASSERT_EQ(ltable.table[0].lock, 0);
 }
 
 
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <set>
+
+#include "rolex/local_allocator.hh"
+
+using namespace rolex;
+
+namespace test {
+
+TEST(LocalAllocator, req_bufs) {
+  const usize kNum = 8, kLeafSz = 3 * 1000, kValSz = 1000;
+  auto mem = Arc<RMem>(new RMem(1024 * 1024));
+  RegAttr mr = {.buf = (uintptr_t)(mem->raw_ptr), .sz = mem->sz};
+  LocalAllocator alloc(mem, mr);
+  // the buffers for the model reads are allocated first
+  auto model_buf = static_cast<char *>(alloc.alloc(13));
+  alloc.init_req_bufs(kNum, kLeafSz, kValSz);
+  ASSERT_EQ(alloc.req_buf_num(), kNum);
+
+  std::vector<ReqBuf *> bufs;
+  std::set<u32> idxs;
+  for (usize i = 0; i < kNum; ++i) {
+    auto b = alloc.acquire_req_buf();
+    ASSERT_NE(b, nullptr);
+    ASSERT_EQ((uintptr_t)b->leaves % LocalAllocator::kBufAlign, 0);
+    ASSERT_EQ((uintptr_t)b->lock % LocalAllocator::kBufAlign, 0);
+    ASSERT_GE(b->leaves, model_buf + 13);
+    ASSERT_GE(b->lock, b->leaves + kLeafSz);
+    ASSERT_GE(b->val, b->lock + sizeof(u64));
+    idxs.insert(b->idx);
+    // the buffers of different requests do not overlap
+    for (auto o : bufs) {
+      ASSERT_TRUE(b->val + kValSz <= o->leaves || o->val + kValSz <= b->leaves);
+    }
+    bufs.push_back(b);
+  }
+  ASSERT_EQ(idxs.size(), kNum);
+  ASSERT_EQ(alloc.acquire_req_buf(), nullptr);
+
+  // the released buffers are reused
+  alloc.release_req_buf(bufs[3]);
+  ASSERT_EQ(alloc.acquire_req_buf(), bufs[3]);
+  ASSERT_EQ(alloc.acquire_req_buf(), nullptr);
+}
+
+} // namespace test
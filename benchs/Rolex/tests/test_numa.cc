@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+
+#include "rolex/numa.hh"
+
+using namespace rolex;
+
+namespace test {
+
+TEST(Numa, parse_list) {
+  auto l = numa::parse_list("0-3,8,10-11");
+  std::vector<int> expected = {0, 1, 2, 3, 8, 10, 11};
+  ASSERT_EQ(l, expected);
+  ASSERT_GE(numa::num_nodes(), 1);
+  ASSERT_FALSE(numa::cpus_of_node(0).empty());
+}
+
+TEST(Numa, place) {
+  const u64 sz = 64 * 4096;
+  auto ptr = (char *)mmap(nullptr, sz, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(ptr, MAP_FAILED);
+  ASSERT_TRUE(numa::place(ptr, sz, numa::Partition));
+  // the pages are placed on fault
+  for (u64 off = 0; off < sz; off += 4096) {
+    ptr[off] = 1;
+  }
+  const int n = numa::num_nodes();
+  ASSERT_EQ(numa::node_of_addr(ptr), 0);
+  ASSERT_EQ(numa::node_of_addr(ptr + sz - 1), n - 1);
+  munmap(ptr, sz);
+}
+
+} // namespace test
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "rolex/trait.hpp"
+
+using namespace rolex;
+
+namespace test {
+
+using plr_t = PLR<K, size_t>;
+using segment_t = plr_t::CanonicalSegment;
+
+template <typename plr_type>
+auto segment(plr_type &opt, const std::vector<K> &keys) -> std::vector<typename plr_type::CanonicalSegment> {
+  std::vector<typename plr_type::CanonicalSegment> res;
+  size_t pos = 0;
+  opt.add_point(keys[0], pos);
+  for (size_t i = 1; i < keys.size(); ++i) {
+    if (!opt.add_point(keys[i], ++pos)) {
+      res.push_back(opt.get_segment());
+      pos = 0;
+      opt.add_point(keys[i], pos);
+    }
+  }
+  res.push_back(opt.get_segment());
+  return res;
+}
+
+/**
+ * Clustered gaps, so there are many segments.
+ * With a large max_gap, the spans of the segments overflow 64-bit products.
+ */
+auto random_keys(const size_t &n, const u64 &seed, const u64 &max_gap = 100000) -> std::vector<K> {
+  std::mt19937_64 rng(seed);
+  std::vector<K> keys;
+  K k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    k += 1 + (rng() % 8 == 0 ? rng() % max_gap : rng() % 64);
+    keys.push_back(k);
+  }
+  return keys;
+}
+
+TEST(PLR, reuse) {
+  const size_t kEps = 15;
+  auto keys = random_keys(200000, 73);
+
+  plr_t::Arena arena;
+  plr_t reused(kEps, &arena);
+  auto segs = segment(reused, keys);
+  ASSERT_GT(segs.size(), 100);
+  // the arena is sized to the hulls, not reserved for the worst case
+  ASSERT_LT(arena.capacity(), 2 * (1u << 16));
+
+  // the same segments are produced by a PLR reusing the warm arena
+  plr_t again(kEps, &arena);
+  auto segs2 = segment(again, keys);
+  ASSERT_EQ(segs.size(), segs2.size());
+
+  // every key is within epsilon of the position predicted by its segment
+  size_t begin = 0;
+  for (size_t s = 0; s < segs.size(); ++s) {
+    ASSERT_EQ(segs[s].get_first_x(), segs2[s].get_first_x());
+    ASSERT_EQ(segs[s].get_slope_intercept(), segs2[s].get_slope_intercept());
+    ASSERT_EQ(segs[s].get_first_x(), keys[begin]);
+    auto end = s + 1 < segs.size() ? std::lower_bound(keys.begin(), keys.end(), segs[s + 1].get_first_x()) - keys.begin()
+                                    : keys.size();
+    auto [slope, intercept] = segs[s].get_slope_intercept();
+    for (size_t i = begin; i < end; ++i) {
+      long double pred = slope * keys[i] + intercept;
+      ASSERT_LE(std::fabs(pred - (long double)(i - begin)), kEps + 1) << i;
+    }
+    begin = end;
+  }
+}
+
+TEST(PLR, narrow) {
+  const size_t kEps = 15;
+  // {max gap, keys}, the keys should not overflow
+  const std::pair<u64, size_t> kCases[] = {{100000, 100000}, {1ul << 40, 100000}, {1ul << 56, 1000}};
+  for (auto [max_gap, n] : kCases) {
+    auto keys = random_keys(n, max_gap, max_gap);
+    // the 64-bit fast path produces the same segments as the 128-bit arithmetic
+    PLR<K, size_t> fast(kEps);
+    PLR<K, size_t, false> wide(kEps);
+    auto f = segment(fast, keys);
+    auto w = segment(wide, keys);
+    ASSERT_EQ(f.size(), w.size()) << max_gap;
+    for (size_t s = 0; s < f.size(); ++s) {
+      ASSERT_EQ(f[s].get_first_x(), w[s].get_first_x());
+      ASSERT_EQ(f[s].get_slope_intercept(), w[s].get_slope_intercept());
+    }
+  }
+}
+
+} // namespace test
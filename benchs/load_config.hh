@@ -19,6 +19,7 @@ DEFINE_string(workloads, "normal", "The workloads for evaluation");
 DEFINE_uint64(mem_threads, 3, "Server threads.");
 DEFINE_uint64(threads, 24, "Server threads.");
 DEFINE_int32(coros, 10, "num client coroutine used per threads");
+DEFINE_int32(pipeline, 1, "num outstanding requests per client coroutine");
 DEFINE_double(read_ratio, 1, "The ratio for reading");
 DEFINE_double(insert_ratio, 0, "The ratio for writing");
 DEFINE_double(update_ratio, 0, "The ratio for updating");
@@ -36,6 +37,7 @@ struct BenchmarkConfig {
   u64 mem_threads;
   u64 threads;
   i32 coros;
+  i32 pipeline;
   double read_ratio;
   double insert_ratio;
   double update_ratio;
@@ -65,6 +67,7 @@ void load_benchmark_config() {
   BenConfig.mem_threads   = FLAGS_mem_threads;
   BenConfig.threads       = FLAGS_threads;
   BenConfig.coros         = FLAGS_coros;
+  BenConfig.pipeline      = FLAGS_pipeline;
   BenConfig.read_ratio    = FLAGS_read_ratio;
   BenConfig.insert_ratio  = FLAGS_insert_ratio;
   BenConfig.update_ratio  = FLAGS_update_ratio;
@@ -36,6 +36,50 @@ struct __attribute__((packed)) ReplyValue {
   ValType val;         /// The returned value
 };
 
+/**
+ * @brief The arguments of RPCs, read in place from the receive buffer
+ * 
+ */
+struct __attribute__((packed)) KVArgs {
+  KeyType key;
+  ValType val;
+};
+
+struct __attribute__((packed)) ScanArgs {
+  KeyType key;
+  u64 n;
+};
+
+/**
+ * @brief A scan reply is [ReplyValue{status, n} | n values] in one UD packet,
+ *        so at most kMaxScanVals values are returned
+ * 
+ */
+constexpr usize kScanReplySz = 4000;
+constexpr usize kMaxScanVals = 480;
+static_assert(sizeof(ReplyValue) + kMaxScanVals * sizeof(ValType) + 64 <= kScanReplySz,
+              "the scan reply should fit in a UD packet");
+
+/**
+ * @brief The RC ring transport, used instead of UD if ROLEX_RING_RPC is defined.
+ *        A ring should hold all the in-flight replies of a client thread,
+ *        i.e., coros * pipeline <= kRingSlots.
+ * 
+ */
+constexpr usize kRingEntry = 256;                // recv entries per QP
+constexpr usize kRingMaxMsg = 4096;
+constexpr usize kRingSlots = 128;
+constexpr usize kRingSz = kRingMaxMsg * kRingSlots;
+
+/**
+ * @brief The shared-memory transport, used if ROLEX_SHM_RPC is defined,
+ *        for clients co-located with the server.
+ *        A ring has kShmSlots cache lines, a scan reply takes about 61 of them.
+ * 
+ */
+constexpr usize kShmSlots = 4096;
+constexpr usize kShmRings = 64;                  // max clients per server thread
+
 #define CACHELINE_SIZE (1 << 6)
 struct alignas(CACHELINE_SIZE) ThreadParam {
     uint64_t throughput;
@@ -178,6 +178,21 @@ public:
 
   // following are sender methods
   Result<std::string> send_unsignaled(const MemBlock &msg) {
+    return send_unsignaled(msg, qp->local_mr.value());
+  }
+
+  /*!
+    Send a message whose buffer is registered with the given lkey,
+    instead of the default local MR of the QP
+   */
+  Result<std::string> send_unsignaled(const MemBlock &msg, const u32 &lkey) {
+    auto mr = qp->local_mr.value();
+    mr.lkey = lkey;
+    return send_unsignaled(msg, mr);
+  }
+
+  Result<std::string> send_unsignaled(const MemBlock &msg,
+                                      const RegAttr &local_mr) {
 
     // 1. calculate proper flag for sending
     int write_flag = msg.sz <= ::rdmaio::qp::kMaxInlinSz ? IBV_SEND_INLINE : 0;
@@ -197,7 +212,8 @@ public:
          .wr_id = 0},
         {.local_addr = reinterpret_cast<RMem::raw_ptr_t>(msg.mem_ptr),
          .remote_addr = remote_addr,
-         .imm_data = imm_data});
+         .imm_data = imm_data},
+        local_mr, qp->remote_mr.value());
 
     if (pending_sends >= send_depth) {
       auto res_p = qp->wait_one_comp();
@@ -223,7 +239,7 @@ private:
     static_assert(sizeof(RingBootstrap) <= kMaxInlinSz, "");
 
     auto res_s = send_blocking(
-        {.mem_ptr = (void *)(msg.data()), .sz = sizeof(RingBootstrap)});
+        MemBlock((void *)(msg.data()), sizeof(RingBootstrap)));
     return ::rdmaio::transfer(res_s, DummyDesc());
   }
 };
@@ -70,6 +70,18 @@ public:
 
   inline bool has_msgs() const { return idx < total_msgs; }
 
+  inline int cur_idx() const { return idx; }
+
+  /*!
+    Finish the current batch without posting the recvs,
+    the caller is responsible for re-posting the returned number of entries.
+   */
+  int drain() {
+    auto ret = total_msgs > 0 ? total_msgs : 0;
+    this->total_msgs = -1;
+    return ret;
+  }
+
   void clear() {
     if (total_msgs > 0 && qp != nullptr && entries != nullptr) {
       auto res = qp->post_recvs(*entries, total_msgs);
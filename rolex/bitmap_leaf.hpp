@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "r2/src/common.hh"
+
+
+using namespace r2;
+
+
+namespace rolex {
+
+
+/**
+ * @brief A leaf whose KVs are unsorted: an occupancy bitmap marks the taken slots,
+ *        and a 1-byte fingerprint per slot filters the key comparisons of a probe.
+ *        An insertion takes a free slot and a removal clears a bit, so no KV is shifted;
+ *        the sorted order is restored lazily, by the scans and the splits.
+ *
+ *        Layout: | bitmap | lower | fingerprints | slots |
+ *        An insertion touches one slot and the header up to its fingerprint,
+ *        which is all a one-sided writer writes back (insert_extents).
+ */
+template<usize N = 64, typename K = u64, typename V = u64>
+struct __attribute__((packed)) BitmapLeaf
+{
+  static constexpr usize kWords = (N + 63) / 64;
+
+  struct __attribute__((packed)) Slot {
+    K key;
+    V val;
+  };
+
+  u64 bitmap[kWords];
+  K lower;            ///< the smallest key, invalidKey() if empty
+  u8 fps[N];
+  Slot slots[N];
+
+  // the slots are left unformatted, the bitmap tells which ones are valid
+  BitmapLeaf() : lower(invalidKey()) {
+    for (usize w = 0; w < kWords; ++w) bitmap[w] = 0;
+  }
+
+  inline static K invalidKey() { return std::numeric_limits<K>::max(); }
+
+  inline static usize max_slot() { return N; }
+
+  inline static auto fingerprint(const K &key) -> u8 {
+    return static_cast<u8>((static_cast<u64>(key) * 0x9E3779B97F4A7C15ULL) >> 56);
+  }
+
+  bool isfull() { return size() == N; }
+
+  auto accepts(const K &key) -> bool { return !isfull(); }
+
+  auto accepts_split(const K &key) -> bool { return true; }
+
+  bool isEmpty() {
+    for (usize w = 0; w < kWords; ++w) if (bitmap[w] != 0) return false;
+    return true;
+  }
+
+  auto size() -> usize {
+    usize n = 0;
+    for (usize w = 0; w < kWords; ++w) n += __builtin_popcountll(bitmap[w]);
+    return n;
+  }
+
+  /**
+   * @brief The largest key if the leaf is full, as Leaf::last_key
+   */
+  K last_key() {
+    if (!isfull()) return invalidKey();
+    K k = lower;
+    for (usize i = 0; i < N; ++i) k = std::max(k, slots[i].key);
+    return k;
+  }
+
+  static auto slot_offset(const usize &pos) -> usize { return offsetof(BitmapLeaf, slots) + pos * sizeof(Slot); }
+
+  /**
+   * @brief The byte ranges <offset, size> changed by an insertion at pos, in the order to write them back:
+   *        the slot first, then the header that publishes it
+   */
+  static auto insert_extents(const usize &pos) -> std::array<std::pair<usize, usize>, 2> {
+    return {std::make_pair(slot_offset(pos), sizeof(Slot)),
+            std::make_pair(usize(0), offsetof(BitmapLeaf, fps) + pos + 1)};
+  }
+
+
+  // ================== API functions: search, update, insert, remove ==================
+  auto search(const K &key, V &val) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    val = slots[i].val;
+    return true;
+  }
+
+  /**
+   * @brief The fingerprints already bound the probe, so the predicted slot is not used
+   */
+  auto search(const K &key, V &val, const usize &hint) -> bool { return search(key, val); }
+
+  auto contain(const K &key) -> bool { return find(key) >= 0; }
+
+  auto update(const K &key, const V &val) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    slots[i].val = val;
+    return true;
+  }
+
+  auto insertHere(const K &key) -> bool { return key >= lower; }
+
+  /**
+   * @brief Put the KV in the first free slot
+   *
+   * @return usize the slot of the KV, 0 if the key exists (as Leaf), N if full
+   */
+  auto insert_not_full(const K &key, const V &val) -> usize {
+    if (contain(key)) return 0;
+    auto pos = free_slot();
+    if (pos >= N) return N;
+    slots[pos].key = key;
+    slots[pos].val = val;
+    fps[pos] = fingerprint(key);
+    if (key < lower) lower = key;
+    // the slot is written before it is marked
+    ::r2::compile_fence();
+    bitmap[pos / 64] |= 1ULL << (pos % 64);
+    return pos;
+  }
+
+  auto remove(const K &key) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    bitmap[i / 64] &= ~(1ULL << (i % 64));
+    if (key == lower) {
+      K k = invalidKey();
+      for_each_slot([&](const usize &j) { k = std::min(k, slots[j].key); });
+      lower = k;
+    }
+    return true;
+  }
+
+  void range(const K& key, const int n, std::vector<V> &r_vals) {
+    u8 order[N];
+    auto cnt = sorted_slots(order);
+    for (usize i = 0; i < cnt && r_vals.size() < n; ++i) {
+      if (slots[order[i]].key >= key) r_vals.push_back(slots[order[i]].val);
+    }
+  }
+
+  /**
+   * @brief Move the larger half of the KVs to an empty leaf
+   */
+  void split_to(BitmapLeaf* n_leaf) {
+    u8 order[N];
+    auto cnt = sorted_slots(order);
+    for (usize i = cnt / 2; i < cnt; ++i) {
+      n_leaf->insert_not_full(slots[order[i]].key, slots[order[i]].val);
+    }
+    for (usize i = cnt / 2; i < cnt; ++i) {
+      bitmap[order[i] / 64] &= ~(1ULL << (order[i] % 64));
+    }
+  }
+
+
+  // ============== functions for degugging ================
+  void print() {
+    u8 order[N];
+    auto cnt = sorted_slots(order);
+    for (usize i = 0; i < cnt; ++i) {
+      std::cout<<slots[order[i]].key<<" ";
+    }
+    std::cout<<std::endl;
+  }
+
+  void self_check() {
+    u8 order[N];
+    auto cnt = sorted_slots(order);
+    ASSERT(lower == (cnt == 0 ? invalidKey() : slots[order[0]].key)) << "Bad lower key!";
+    for (usize i = 0; i < cnt; ++i) {
+      ASSERT(fps[order[i]] == fingerprint(slots[order[i]].key)) << "Bad fingerprint!";
+      if (i > 0) ASSERT(slots[order[i]].key > slots[order[i-1]].key) << "Bad Leaf!";
+    }
+  }
+
+
+  //  ============ functions for remote machines =================
+  /**
+   * @brief Insert the data from the compute nodes
+   *
+   * @return std::pair<u8, u8> <the state of the insertion, the position>
+   *    state: 0--> key exists,   1 --> insert here,   2--> full, split before inserting here,   3 --> insert to next leaf
+   *    Unlike Leaf, a full leaf is left unchanged.
+   */
+  auto insert_to_remote(const K &key, const V &val) -> std::pair<u8, u8> {
+    auto i = find(key);
+    if (i >= 0) return std::make_pair(0, i);   // key exists
+    if (!isfull()) return std::make_pair(1, insert_not_full(key, val));
+    bool larger = true;
+    for_each_slot([&](const usize &j) { larger = larger && slots[j].key < key; });
+    return std::make_pair(larger ? 3 : 2, 0);
+  }
+
+private:
+  /**
+   * @brief The taken slots whose fingerprints match fp, in the w-th bitmap word
+   */
+  inline auto match(const u8 &fp, const usize &w) -> u64 {
+    u64 m = 0;
+#ifdef __SSE2__
+    if constexpr (N % 16 == 0) {
+      const __m128i needle = _mm_set1_epi8(static_cast<char>(fp));
+      for (usize c = 0; c < 64 && w * 64 + c < N; c += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fps + w * 64 + c));
+        m |= static_cast<u64>(static_cast<u16>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)))) << c;
+      }
+      return m & bitmap[w];
+    }
+#endif
+    for (usize c = 0; c < 64 && w * 64 + c < N; ++c) {
+      if (fps[w * 64 + c] == fp) m |= 1ULL << c;
+    }
+    return m & bitmap[w];
+  }
+
+  inline auto find(const K &key) -> int {
+    if (lower > key) return -1;
+    const u8 fp = fingerprint(key);
+    for (usize w = 0; w < kWords; ++w) {
+      for (u64 m = match(fp, w); m != 0; m &= m - 1) {
+        auto i = w * 64 + __builtin_ctzll(m);
+        if (slots[i].key == key) return i;
+      }
+    }
+    return -1;
+  }
+
+  inline auto free_slot() -> usize {
+    for (usize w = 0; w < kWords; ++w) {
+      if (~bitmap[w] != 0) return w * 64 + __builtin_ctzll(~bitmap[w]);
+    }
+    return N;
+  }
+
+  template<typename F>
+  inline void for_each_slot(F &&f) {
+    for (usize w = 0; w < kWords; ++w) {
+      for (u64 m = bitmap[w]; m != 0; m &= m - 1) f(w * 64 + __builtin_ctzll(m));
+    }
+  }
+
+  /**
+   * @brief Sort the taken slots by their keys
+   *
+   * @return usize the number of taken slots
+   */
+  auto sorted_slots(u8 *order) -> usize {
+    static_assert(N <= 256, "the slots are indexed by u8");
+    usize cnt = 0;
+    for_each_slot([&](const usize &j) { order[cnt++] = j; });
+    std::sort(order, order + cnt, [this](const u8 &a, const u8 &b) { return slots[a].key < slots[b].key; });
+    return cnt;
+  }
+};
+
+
+} // namespace rolex
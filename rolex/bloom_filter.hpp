@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "r2/src/common.hh"
+#include "xutils/marshal.hh"
+
+
+namespace rolex {
+
+using namespace r2;
+
+
+/**
+ * @brief A blocked Bloom filter over the keys of a submodel, which answers most lookups of the absent keys
+ *          without reading a leaf.
+ *          A key sets k bits of one 64-bit block, so a lookup touches one word.
+ *          The memory node counts each bit with a u8 counter, so a removal clears the bits of the key;
+ *          a saturated counter is never decremented, which only keeps a false positive.
+ *          The compute nodes get the bits, i.e., the non-zero counters, by serialize().
+ *
+ *        With b bits per key and k = b/2, which suits the small blocks better than b*ln2,
+ *          the false-positive rate is about 3% for 8 bits, 1% for 12 bits and 0.5% for 16 bits,
+ *          and grows as the inserts add keys to the filter sized at training.
+ */
+template<typename K>
+class BloomFilter {
+public:
+  static constexpr usize kBlockBits = 64;
+  static constexpr u32 kMaxHashes = 10;   /// the bit positions taken from one 64-bit hash
+
+private:
+  u32 k = 1;                    /// the bits set per key
+  u64 nblocks = 1;
+  std::vector<u64> words;       /// the bits, only on the compute nodes
+  std::unique_ptr<u8[]> counts; /// the counter of each bit, only on the memory node
+
+public:
+  /**
+   * @param n the keys expected
+   * @param bits_per_key the memory per key, which sets the false-positive rate
+   */
+  explicit BloomFilter(const usize &n, const double &bits_per_key)
+      : k(std::clamp<u32>(static_cast<u32>(std::lround(bits_per_key * 0.5)), 1, kMaxHashes)),
+        nblocks(std::max<u64>(1, static_cast<u64>(std::ceil(n * bits_per_key / kBlockBits)))),
+        counts(new u8[nblocks * kBlockBits]()) {
+    ASSERT(bits_per_key > 0) << "invalid bits per key: " << bits_per_key;
+    ASSERT(nblocks < (1UL << 32)) << "too many blocks: " << nblocks;
+  }
+
+  /**
+   * @brief The bits read from the memory node
+   */
+  explicit BloomFilter(const std::string_view &seria) {
+    ASSERT(seria.size() >= sizeof(u32) + sizeof(u64)) << "filter seria.size(): " << seria.size();
+    char* cur_ptr = (char *)seria.data();
+    k = ::xstore::util::Marshal<u32>::deserialize(cur_ptr, seria.size());
+    cur_ptr += sizeof(u32);
+    nblocks = ::xstore::util::Marshal<u64>::deserialize(cur_ptr, seria.size());
+    cur_ptr += sizeof(u64);
+    ASSERT(seria.size() == sizeof(u32) + sizeof(u64) + nblocks * sizeof(u64)) << "filter seria.size(): " << seria.size();
+    words.resize(nblocks);
+    memcpy(words.data(), cur_ptr, nblocks * sizeof(u64));
+  }
+
+  /**
+   * @brief The sequence of serialization: k, nblocks, the bits of each block
+   */
+  auto serialize() -> std::string {
+    std::string res;
+    res += ::xstore::util::Marshal<u32>::serialize_to(k);
+    res += ::xstore::util::Marshal<u64>::serialize_to(nblocks);
+    for(u64 b=0; b<nblocks; b++) res += ::xstore::util::Marshal<u64>::serialize_to(block_bits(b));
+    return res;
+  }
+
+  static inline auto hash(const K &key) -> u64 {
+    // the finalizer of MurmurHash3
+    u64 h = static_cast<u64>(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // ============== the functions below are called on the memory node ================
+  void add(const K &key) { add_hash(hash(key)); }
+
+  /**
+   * @brief Add a key by its hash, e.g., collected before the filter is sized
+   */
+  void add_hash(const u64 &h) {
+    auto c = counts.get() + block_of(h) * kBlockBits;
+    for(u32 i=0; i<k; i++) {
+      u8 *cnt = c + bit_of(h, i);
+      u8 cur = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+      while(cur != UINT8_MAX && !__atomic_compare_exchange_n(cnt, &cur, cur + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    }
+  }
+
+  /**
+   * @brief Remove a key added before
+   */
+  void remove(const K &key) {
+    const u64 h = hash(key);
+    auto c = counts.get() + block_of(h) * kBlockBits;
+    for(u32 i=0; i<k; i++) {
+      u8 *cnt = c + bit_of(h, i);
+      u8 cur = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+      while(cur != 0 && cur != UINT8_MAX && !__atomic_compare_exchange_n(cnt, &cur, cur - 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    }
+  }
+
+  // ============== the lookup on both sides ================
+  /**
+   * @return false if the key is absent, true if it may be present
+   */
+  auto may_contain(const K &key) const -> bool {
+    const u64 h = hash(key);
+    const u64 b = block_of(h);
+    if(!counts) {
+      const u64 mask = key_mask(h);
+      return (words[b] & mask) == mask;
+    }
+    auto c = counts.get() + b * kBlockBits;
+    for(u32 i=0; i<k; i++) {
+      if(__atomic_load_n(c + bit_of(h, i), __ATOMIC_ACQUIRE) == 0) return false;
+    }
+    return true;
+  }
+
+  auto hashes() const -> u32 { return k; }
+
+  /**
+   * @brief Whether the filter counts the keys, i.e., it is the one of the memory node rather than a copy of its bits
+   */
+  auto counting() const -> bool { return static_cast<bool>(counts); }
+
+  /**
+   * @brief The bytes shipped to the compute nodes
+   */
+  auto size() const -> usize { return nblocks * sizeof(u64); }
+
+private:
+  inline auto block_of(const u64 &h) const -> u64 { return ((h >> 32) * nblocks) >> 32; }
+
+  // the block takes the high half of the hash, the bits are the 6-bit chunks of the hash mixed again
+  inline static auto bit_of(const u64 &h, const u32 &i) -> u32 {
+    const u64 g = (h ^ (h >> 31)) * 0x94d049bb133111ebULL;
+    return (g >> (6 * i)) & (kBlockBits - 1);
+  }
+
+  inline auto key_mask(const u64 &h) const -> u64 {
+    u64 mask = 0;
+    for(u32 i=0; i<k; i++) mask |= 1UL << bit_of(h, i);
+    return mask;
+  }
+
+  auto block_bits(const u64 &b) -> u64 {
+    if(!counts) return words[b];
+    u64 bits = 0;
+    auto c = counts.get() + b * kBlockBits;
+    for(u32 i=0; i<kBlockBits; i++) bits |= static_cast<u64>(__atomic_load_n(c + i, __ATOMIC_RELAXED) != 0) << i;
+    return bits;
+  }
+};
+
+
+} // namespace rolex
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rlib/core/common.hh"
+#include "r2/src/common.hh"
+
+using namespace r2;
+
+
+namespace rolex {
+
+/**
+ * @brief The sorted KV streams consumed by Rolex::bulk_load.
+ *          A stream implements next(k, v), which returns false at the end,
+ *          so the loader never needs all the KVs in memory.
+ */
+template<typename K, typename V>
+class VectorStream {
+  const std::vector<K> &keys;
+  const std::vector<V> &vals;
+  usize cur = 0;
+
+public:
+  VectorStream(const std::vector<K> &keys, const std::vector<V> &vals) : keys(keys), vals(vals) {
+    ASSERT(keys.size() == vals.size());
+  }
+
+  inline auto next(K &k, V &v) -> bool {
+    if(cur == keys.size()) return false;
+    k = keys[cur];
+    v = vals[cur];
+    cur += 1;
+    return true;
+  }
+};
+
+
+/**
+ * @brief A sorted stream mmap'd from a binary file, which is
+ *          - either an array of keys, the value of a key is the key itself (as in the benchmarks),
+ *          - or an array of interleaved key-value pairs.
+ *        The pages are read ahead sequentially and dropped by the kernel under memory pressure.
+ */
+template<typename K, typename V>
+class MappedStream {
+  const char* data = nullptr;
+  usize sz = 0;
+  bool pairs = false;
+  usize cur = 0;
+
+public:
+  static auto create(const std::string &path, const bool &pairs = false)
+      -> ::rdmaio::Option<std::shared_ptr<MappedStream>> {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+      LOG(4) << "fail to open " << path << "; with error: " << strerror(errno);
+      return {};
+    }
+    struct stat st;
+    fstat(fd, &st);
+    usize sz = st.st_size;
+    void* ptr = sz == 0 ? nullptr : mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED) {
+      LOG(4) << "fail to mmap " << path << "; with error: " << strerror(errno);
+      return {};
+    }
+    if(ptr) madvise(ptr, sz, MADV_SEQUENTIAL);
+    return std::make_shared<MappedStream>(static_cast<const char*>(ptr), sz, pairs);
+  }
+
+  MappedStream(const char* data, const usize &sz, const bool &pairs)
+      : data(data), sz(sz), pairs(pairs) {
+    ASSERT(sz % entry_sz() == 0) << "the file is not an array of " << entry_sz() << "-byte entries";
+  }
+
+  MappedStream(const MappedStream&) = delete;
+
+  ~MappedStream() {
+    if(data) munmap(const_cast<char*>(data), sz);
+  }
+
+  inline auto entry_sz() const -> usize { return pairs ? sizeof(K) + sizeof(V) : sizeof(K); }
+
+  auto size() const -> usize { return sz / entry_sz(); }
+
+  /**
+   * @brief The i-th key, e.g., for the benchmarks to query the loaded keys
+   */
+  inline auto key_at(const usize &i) const -> K {
+    K k;
+    memcpy(&k, data + i*entry_sz(), sizeof(K));
+    return k;
+  }
+
+  inline auto next(K &k, V &v) -> bool {
+    if(cur == size()) return false;
+    k = key_at(cur);
+    if(pairs) memcpy(&v, data + cur*entry_sz() + sizeof(K), sizeof(V));
+    else v = static_cast<V>(k);
+    cur += 1;
+    return true;
+  }
+};
+
+
+} // namespace rolex
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "r2/src/common.hh"
+
+
+using namespace r2;
+
+
+namespace rolex {
+
+
+/**
+ * @brief A sorted leaf whose keys are stored as the deltas to the smallest key (frame of reference).
+ *        The width of the deltas is picked per leaf, 1, 2 or 4 bytes, and grows with the span of the keys,
+ *        so a leaf of N u64 KVs takes 4N bytes less than Leaf, e.g., 778 bytes instead of 1KB for N=64,
+ *        and a lookup reads fewer bytes per leaf.
+ *        A leaf rejects a key that makes the span exceed 32 bits (accepts).
+ *
+ *        Layout: | base | width | num | deltas (N*4 bytes) | vals |
+ */
+template<usize N = 64, typename K = u64, typename V = u64>
+struct __attribute__((packed)) CompressedLeaf
+{
+  static_assert(std::is_unsigned<K>::value, "the keys are delta-encoded");
+  static_assert(N < 256, "the positions are u8");
+
+  static constexpr usize kMaxWidth = 4;
+
+  K base;             ///< the smallest key, invalidKey() if empty
+  u8 width;           ///< bytes per delta
+  u8 num;             ///< the number of KVs
+  u8 deltas[N * kMaxWidth];
+  V vals[N];
+
+  CompressedLeaf() : base(invalidKey()), width(1), num(0) {}
+
+  inline static K invalidKey() { return std::numeric_limits<K>::max(); }
+
+  inline static usize max_slot() { return N; }
+
+  /**
+   * @brief The bytes per delta for a span of keys, 0 if it is too wide
+   */
+  inline static auto width_of(const K &span) -> u8 {
+    if (span <= 0xff) return 1;
+    if (span <= 0xffff) return 2;
+    if (static_cast<u64>(span) <= 0xffffffffULL) return 4;
+    return 0;
+  }
+
+  bool isfull() { return num == N; }
+
+  bool isEmpty() { return num == 0; }
+
+  K last_key() { return isfull() ? key_at(N-1) : invalidKey(); }
+
+  inline auto key_at(const usize &i) -> K {
+    switch (width) {
+      case 1: return base + deltas[i];
+      case 2: return base + load<u16>(i);
+      default: return base + load<u32>(i);
+    }
+  }
+
+  /**
+   * @brief Whether insert_not_full can take the key, i.e., the leaf is not full and the span fits
+   */
+  auto accepts(const K &key) -> bool {
+    if (num == 0) return true;
+    if (isfull()) return false;
+    return width_of(std::max(key, key_at(num-1)) - std::min(key, base)) != 0;
+  }
+
+  /**
+   * @brief Whether the half taking the key accepts it after split_to, so a key too far from both halves
+   *          costs no new leaf
+   */
+  auto accepts_split(const K &key) -> bool {
+    if (num < 2) return accepts(key);
+    const usize mid = num / 2;
+    const K lo = key >= key_at(mid) ? key_at(mid) : std::min(key, base);
+    const K hi = key >= key_at(mid) ? std::max(key, key_at(num-1)) : std::max(key, key_at(mid-1));
+    return width_of(hi - lo) != 0;
+  }
+
+  static auto value_start_offset() -> usize { return offsetof(CompressedLeaf, vals); }
+
+  /**
+   * @brief The byte ranges <offset, size> changed by an insertion at pos, in the order to write them back:
+   *        the insertion may re-encode all the deltas
+   */
+  static auto insert_extents(const usize &pos) -> std::array<std::pair<usize, usize>, 2> {
+    return {std::make_pair(offsetof(CompressedLeaf, vals) + pos * sizeof(V), (N - pos) * sizeof(V)),
+            std::make_pair(usize(0), offsetof(CompressedLeaf, vals))};
+  }
+
+
+  // ================== API functions: search, update, insert, remove ==================
+  auto search(const K &key, V &val) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    val = vals[i];
+    return true;
+  }
+
+  /**
+   * @brief The SIMD compare scans the deltas as fast as a bounded search, so the predicted slot is not used
+   */
+  auto search(const K &key, V &val, const usize &hint) -> bool { return search(key, val); }
+
+  auto contain(const K &key) -> bool { return find(key) >= 0; }
+
+  auto update(const K &key, const V &val) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    vals[i] = val;
+    return true;
+  }
+
+  auto insertHere(const K &key) -> bool { return key >= base; }
+
+  /**
+   * @brief Insert data while keeping all data sorted
+   *
+   * @return usize the inserted position, 0 if the key exists (as Leaf), N if not accepted
+   */
+  auto insert_not_full(const K &key, const V &val) -> usize {
+    if (contain(key)) return 0;
+    if (!accepts(key)) return N;
+    usize i = 0;
+    while (i < num && key_at(i) < key) i++;
+    K keys[N];
+    decode(keys);
+    std::copy_backward(keys+i, keys+num, keys+num+1);
+    memmove(val_bytes(i+1), val_bytes(i), (num-i) * sizeof(V));
+    keys[i] = key;
+    vals[i] = val;
+    encode(keys, num+1);
+    return i;
+  }
+
+  auto remove(const K &key) -> bool {
+    auto i = find(key);
+    if (i < 0) return false;
+    K keys[N];
+    decode(keys);
+    std::copy(keys+i+1, keys+num, keys+i);
+    memmove(val_bytes(i), val_bytes(i+1), (num-i-1) * sizeof(V));
+    encode(keys, num-1);
+    return true;
+  }
+
+  void range(const K& key, const int n, std::vector<V> &r_vals) {
+    for (usize i = 0; i < num && r_vals.size() < n; ++i) {
+      if (key_at(i) >= key) r_vals.push_back(vals[i]);
+    }
+  }
+
+  /**
+   * @brief Move the larger half of the KVs to an empty leaf
+   */
+  void split_to(CompressedLeaf* n_leaf) {
+    K keys[N];
+    decode(keys);
+    const usize mid = num / 2;
+    memcpy(n_leaf->val_bytes(0), val_bytes(mid), (num-mid) * sizeof(V));
+    n_leaf->encode(keys+mid, num-mid);
+    encode(keys, mid);
+  }
+
+
+  // ============== functions for degugging ================
+  void print() {
+    for (usize i = 0; i < num; ++i) {
+      std::cout<<key_at(i)<<" ";
+    }
+    std::cout<<std::endl;
+  }
+
+  void self_check() {
+    ASSERT(num <= N) << "Bad Leaf!";
+    ASSERT(num == 0 || key_at(0) == base) << "Bad base key!";
+    for (usize i = 1; i < num; ++i) ASSERT(key_at(i) > key_at(i-1)) << "Bad Leaf!";
+  }
+
+
+  //  ============ functions for remote machines =================
+  /**
+   * @brief Insert the data from the compute nodes
+   *
+   * @return std::pair<u8, u8> <the state of the insertion, the position>
+   *    state: 0--> key exists,   1 --> insert here,   2--> full, split before inserting here,   3 --> insert to next leaf
+   *    Unlike Leaf, a leaf not accepting the key is left unchanged.
+   */
+  auto insert_to_remote(const K &key, const V &val) -> std::pair<u8, u8> {
+    auto i = find(key);
+    if (i >= 0) return std::make_pair(0, i);   // key exists
+    if (accepts(key)) return std::make_pair(1, insert_not_full(key, val));
+    return std::make_pair(num > 0 && key > key_at(num-1) ? 3 : 2, 0);
+  }
+
+private:
+  template<typename D>
+  inline auto load(const usize &i) -> D {
+    D d;
+    memcpy(&d, deltas + i * sizeof(D), sizeof(D));
+    return d;
+  }
+
+  // the values are unaligned in the packed leaf, so they are moved as bytes
+  inline auto val_bytes(const usize &i) -> char * {
+    return reinterpret_cast<char *>(this) + offsetof(CompressedLeaf, vals) + i * sizeof(V);
+  }
+
+  void decode(K* keys) {
+    for (usize i = 0; i < num; ++i) keys[i] = key_at(i);
+  }
+
+  /**
+   * @brief Re-encode n sorted keys with the narrowest width
+   */
+  void encode(const K* keys, const usize &n) {
+    num = n;
+    if (n == 0) {
+      base = invalidKey();
+      width = 1;
+      return;
+    }
+    base = keys[0];
+    width = width_of(keys[n-1] - base);
+    ASSERT(width != 0) << "the keys of a leaf span more than 32 bits";
+    for (usize i = 0; i < n; ++i) {
+      const u32 d = static_cast<u32>(keys[i] - base);
+      memcpy(deltas + i * width, &d, width);
+    }
+  }
+
+  /**
+   * @brief The position of the key, via the SIMD compare of the deltas
+   */
+  inline auto find(const K &key) -> int {
+    if (num == 0 || key < base) return -1;
+    const K d = key - base;
+    switch (width) {
+      case 1: return d <= 0xff ? find_delta<u8>(d) : -1;
+      case 2: return d <= 0xffff ? find_delta<u16>(d) : -1;
+      default: return static_cast<u64>(d) <= 0xffffffffULL ? find_delta<u32>(d) : -1;
+    }
+  }
+
+  template<typename D>
+  inline auto find_delta(const D &d) -> int {
+#ifdef __SSE2__
+    constexpr usize kLanes = 16 / sizeof(D);
+    if constexpr (sizeof(deltas) % 16 == 0) {
+      __m128i needle;
+      if constexpr (sizeof(D) == 1) needle = _mm_set1_epi8(static_cast<char>(d));
+      else if constexpr (sizeof(D) == 2) needle = _mm_set1_epi16(static_cast<short>(d));
+      else needle = _mm_set1_epi32(static_cast<int>(d));
+      for (usize c = 0; c < num; c += kLanes) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + c * sizeof(D)));
+        __m128i eq;
+        if constexpr (sizeof(D) == 1) eq = _mm_cmpeq_epi8(v, needle);
+        else if constexpr (sizeof(D) == 2) eq = _mm_cmpeq_epi16(v, needle);
+        else eq = _mm_cmpeq_epi32(v, needle);
+        u32 m = _mm_movemask_epi8(eq);
+        if (m != 0) {
+          // the deltas are unique, and the lanes past num follow the valid ones
+          usize i = c + __builtin_ctz(m) / sizeof(D);
+          return i < num ? static_cast<int>(i) : -1;
+        }
+      }
+      return -1;
+    }
+#endif
+    for (usize i = 0; i < num; ++i) {
+      if (load<D>(i) == d) return i;
+    }
+    return -1;
+  }
+};
+
+
+} // namespace rolex
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "r2/src/common.hh"
+#include "xutils/spin_lock.hh"
+
+
+namespace rolex {
+
+using namespace r2;
+
+
+/**
+ * @brief A small sorted array of the KVs inserted into a submodel, merged into its leaves by the compaction.
+ *        The writers hold the lock; the readers take no lock and retry
+ *        if the sequence number changed, i.e., a writer shifted the KVs under them.
+ *        The capacity is fixed, so a reader never follows a freed array.
+ */
+template<typename K, typename V>
+struct DeltaBuffer {
+  ::xstore::util::SpinLock lock;
+  std::atomic<u64> seq{0};    ///< odd while a writer changes the KVs
+  const usize cap;
+  volatile usize num = 0;
+  usize stuck = 0;            ///< the KVs the last drain failed to move, e.g., their synonym table is full
+  K* keys;
+  V* vals;
+
+  explicit DeltaBuffer(const usize &cap) : cap(cap), keys(new K[cap]), vals(new V[cap]) {}
+
+  ~DeltaBuffer() {
+    delete[] keys;
+    delete[] vals;
+  }
+
+  DeltaBuffer(const DeltaBuffer&) = delete;
+  DeltaBuffer& operator=(const DeltaBuffer&) = delete;
+
+  auto size() const -> usize { return num; }
+
+  auto isfull() const -> bool { return num == cap; }
+
+  auto isEmpty() const -> bool { return num == 0; }
+
+  /**
+   * @brief The KVs added since the last drain, an estimate without the lock
+   */
+  auto pending() const -> usize { return num > stuck ? num - stuck : 0; }
+
+  /**
+   * @brief The lock-free lookup
+   */
+  auto search(const K &key, V &val) -> bool {
+    while(true) {
+      auto s = seq.load(std::memory_order_acquire);
+      if(s & 1) {
+        ::xstore::util::cpu_relax();
+        continue;
+      }
+      const usize n = std::min(static_cast<usize>(num), cap);
+      auto i = std::lower_bound(keys, keys + n, key) - keys;
+      bool found = i < n && keys[i] == key;
+      V v = found ? vals[i] : V();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(seq.load(std::memory_order_relaxed) != s) continue;
+      if(found) val = v;
+      return found;
+    }
+  }
+
+  // ============== the functions below are called with the lock held ================
+  auto contain(const K &key) -> bool { return find(key) < num; }
+
+  auto update(const K &key, const V &val) -> bool {
+    auto i = find(key);
+    if(i == num) return false;
+    // a value wider than a word may be read torn
+    begin_write();
+    vals[i] = val;
+    end_write();
+    return true;
+  }
+
+  /**
+   * @return false if the key exists or the buffer is full
+   */
+  auto insert(const K &key, const V &val) -> bool {
+    if(isfull()) return false;
+    auto i = std::lower_bound(keys, keys + num, key) - keys;
+    if(i < num && keys[i] == key) return false;
+    begin_write();
+    std::copy_backward(keys + i, keys + num, keys + num + 1);
+    std::copy_backward(vals + i, vals + num, vals + num + 1);
+    keys[i] = key;
+    vals[i] = val;
+    num = num + 1;
+    end_write();
+    return true;
+  }
+
+  auto remove(const K &key) -> bool {
+    auto i = find(key);
+    if(i == num) return false;
+    begin_write();
+    std::copy(keys + i + 1, keys + num, keys + i);
+    std::copy(vals + i + 1, vals + num, vals + i);
+    num = num - 1;
+    end_write();
+    return true;
+  }
+
+  /**
+   * @brief Keep the KVs for which moved(key, val) returns false, in order
+   *
+   * @return usize the number of the moved KVs
+   */
+  template<typename F>
+  auto drain(F &&moved) -> usize {
+    std::vector<bool> gone(num);
+    usize cnt = 0;
+    // the KVs are moved before they leave the buffer, so a reader always finds them in one of the two
+    for(usize i=0; i<num; i++) {
+      gone[i] = moved(keys[i], vals[i]);
+      cnt += gone[i];
+    }
+    stuck = num - cnt;
+    if(cnt == 0) return 0;
+    begin_write();
+    usize n = 0;
+    for(usize i=0; i<num; i++) {
+      if(gone[i]) continue;
+      keys[n] = keys[i];
+      vals[n] = vals[i];
+      n++;
+    }
+    num = n;
+    end_write();
+    return cnt;
+  }
+
+private:
+  inline auto find(const K &key) -> usize {
+    auto i = std::lower_bound(keys, keys + num, key) - keys;
+    return i < num && keys[i] == key ? i : num;
+  }
+
+  inline void begin_write() {
+    seq.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  inline void end_write() {
+    seq.fetch_add(1, std::memory_order_release);
+  }
+};
+
+
+} // namespace rolex
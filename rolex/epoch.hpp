@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+#include "r2/src/common.hh"
+
+using namespace r2;
+
+
+namespace rolex {
+
+/**
+ * @brief Epoch-based protection of the leaves read by the local threads.
+ *        A reader pins the current epoch before accessing the leaves and unpins it afterwards;
+ *        a leaf retired at epoch t can be reused once no thread is pinned at an epoch <= t.
+ *
+ * @tparam kMaxThreads the maximal number of threads that pin the epochs
+ */
+template <usize kMaxThreads = 128>
+class EpochManager {
+  static constexpr u64 kQuiescent = std::numeric_limits<u64>::max();
+
+  struct alignas(64) Slot {
+    std::atomic<u64> epoch{kQuiescent};
+    usize depth = 0;                  /// the nested pins, only touched by the owner thread
+  };
+
+  // distinguish the slots of different managers
+  static auto next_id() -> u64 {
+    static std::atomic<u64> id(0);
+    return ++id;
+  }
+
+  static inline thread_local std::vector<std::pair<u64, usize>> local_slots;
+
+  const u64 id = next_id();
+  std::atomic<u64> global{1};
+  std::atomic<usize> num_slots{0};
+  Slot slots[kMaxThreads];
+
+public:
+  /**
+   * @brief Unpin the epoch on destruction
+   */
+  class Guard {
+    EpochManager* m;
+  public:
+    explicit Guard(EpochManager* m) : m(m) { m->enter(); }
+    Guard(const Guard&) = delete;
+    ~Guard() { m->exit(); }
+  };
+
+  auto pin() -> Guard { return Guard(this); }
+
+  void enter() {
+    auto &s = slots[my_slot()];
+    if(s.depth++ == 0) {
+      s.epoch.store(global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      // the pinned epoch must be visible before reading any leaf
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  }
+
+  void exit() {
+    auto &s = slots[my_slot()];
+    if(--s.depth == 0)
+      s.epoch.store(kQuiescent, std::memory_order_release);
+  }
+
+  /**
+   * @brief Called after an object is unlinked, and advance the global epoch
+   *
+   * @return u64 the epoch to tag the unlinked object
+   */
+  auto retire_epoch() -> u64 {
+    return global.fetch_add(1, std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Whether the objects tagged with epoch t are unreachable from all pinned threads
+   */
+  auto reclaimable(const u64 &t) -> bool {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto n = num_slots.load(std::memory_order_acquire);
+    for(usize i=0; i<n; i++) {
+      if(slots[i].epoch.load(std::memory_order_acquire) <= t) return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief The clock in microseconds, used to bound the in-flight one-sided reads of the compute nodes
+   */
+  static auto now_us() -> u64 {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+private:
+  auto my_slot() -> usize {
+    for(auto &s : local_slots) {
+      if(s.first == id) return s.second;
+    }
+    auto slot = num_slots.fetch_add(1);
+    ASSERT(slot < kMaxThreads) << "Too many threads pin the epochs: " << slot;
+    local_slots.emplace_back(id, slot);
+    return slot;
+  }
+};
+
+
+} // namespace rolex
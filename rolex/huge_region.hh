@@ -3,6 +3,7 @@
 #include <sys/mman.h>
 
 #include "memory_region.hh"
+#include "numa.hh"
 
 namespace rolex {
 
@@ -10,6 +11,10 @@ using namespace rdmaio;
 
 /*!
   Malloc huge pages in 2M huge pages, align_sz = 2M
+  If populate is false, the pages are faulted in on first touch (or on the MR registration),
+  instead of at the mmap
+  align_sz = 1G uses 1G huge pages, which should be reserved by the kernel
+  The NUMA placement is applied before the pages are faulted in
  */
 class HugeRegion : public MemoryRegion {
   static u64 align_to_sz(const u64 &x, const usize &align_sz) {
@@ -18,19 +23,34 @@ class HugeRegion : public MemoryRegion {
 
 public:
   static ::rdmaio::Option<rdmaio::Arc<HugeRegion>>
-  create(const u64 &sz, const usize &align_sz = (2 << 20)) {
-    auto region = std::make_shared<HugeRegion>(sz, align_sz);
+  create(const u64 &sz, const usize &align_sz = (2 << 20), const bool &populate = true,
+         const numa::Placement &placement = numa::Default, const int &local_node = 0) {
+    auto region = std::make_shared<HugeRegion>(sz, align_sz, populate, placement, local_node);
     if (region->valid())
       return region;
     return {};
   }
 
-  explicit HugeRegion(const u64 &sz, const usize &align_sz = (2 << 20)) {
+  explicit HugeRegion(const u64 &sz, const usize &align_sz = (2 << 20), const bool &populate = true,
+                      const numa::Placement &placement = numa::Default, const int &local_node = 0) {
 
     this->sz = align_to_sz(sz, align_sz);
-    char *ptr = (char *)mmap(
-        nullptr, this->sz, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+    const bool placed = placement != numa::Default;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    if (populate && !placed)
+      flags |= MAP_POPULATE;
+    if (align_sz == (1 << 30))
+      flags |= (30 << MAP_HUGE_SHIFT);
+    char *ptr = (char *)mmap(nullptr, this->sz, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    if (ptr != MAP_FAILED && placed) {
+      if (!numa::place(ptr, this->sz, placement, local_node, align_sz))
+        RDMA_LOG(4) << "fail to place huge pages with policy " << (int)placement
+                    << "; with error: " << strerror(errno);
+      // fault in the pages after the policy is set
+      for (u64 off = 0; populate && off < this->sz; off += align_sz)
+        ptr[off] = 0;
+    }
 
     if (ptr == MAP_FAILED) {
       this->addr = nullptr;
@@ -38,7 +58,7 @@ public:
                   << " aligned with: " << align_sz
                   << "; with error: " << strerror(errno);
     } else {
-      RDMA_LOG(4) << "alloc huge page size: " << this->sz << ", "<<this->sz/align_sz<<" * 2M";
+      RDMA_LOG(4) << "alloc huge page size: " << this->sz << ", "<<this->sz/align_sz<<" * "<<(align_sz >> 20)<<"M";
       this->addr = ptr;
     }
   }
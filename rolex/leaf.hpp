@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <limits>
 #include <iostream>
 #include <optional>
 #include <utility> 
+#include <vector>
 
 #include "r2/src/common.hh"
 
@@ -37,11 +40,30 @@ struct __attribute__((packed)) Leaf
 
   K last_key() { return keys[N-1]; }
 
+  /**
+   * @brief Whether insert_not_full can take the key
+   */
+  auto accepts(const K &key) -> bool { return !isfull(); }
+
+  /**
+   * @brief Whether the half of a full leaf taking the key accepts it after split_to
+   */
+  auto accepts_split(const K &key) -> bool { return true; }
+
   /**
    * @brief The start size of vals
    */
   static auto value_start_offset() -> usize { return offsetof(Leaf, vals); }
 
+  /**
+   * @brief The byte ranges <offset, size> changed by an insertion at pos, in the order to write them back:
+   *        the insertion shifts all the KVs after pos
+   */
+  static auto insert_extents(const usize &pos) -> std::array<std::pair<usize, usize>, 2> {
+    return {std::make_pair(offsetof(Leaf, vals) + pos * sizeof(V), (N - pos) * sizeof(V)),
+            std::make_pair(offsetof(Leaf, keys) + pos * sizeof(K), (N - pos) * sizeof(K))};
+  }
+
 
   // ================== API functions: search, update, insert, remove ==================
   auto search(const K &key, V &val) -> bool {
@@ -55,6 +77,29 @@ struct __attribute__((packed)) Leaf
     return false;
   }
 
+  /**
+   * @brief Search from the predicted slot: gallop outwards to bracket the key, then bisect,
+   *          as the keys (followed by the invalid ones) are sorted
+   */
+  auto search(const K &key, V &val, const usize &hint) -> bool {
+    if(keys[0]>key) return false;
+    usize lo = std::min<usize>(hint, N-1), hi = lo + 1;
+    if(keys[lo] < key) {
+      usize step = 1;
+      for(lo = hi; lo + step <= N && keys[lo+step-1] < key; step <<= 1) lo += step;
+      hi = std::min<usize>(N, lo + step);
+    } else {
+      usize step = 1;
+      for(hi = lo; hi >= step && keys[hi-step] > key; step <<= 1) hi -= step;
+      lo = hi >= step ? hi - step : 0;
+      hi = std::min<usize>(N, hi + 1);
+    }
+    auto i = std::lower_bound(keys+lo, keys+hi, key) - keys;
+    if(i == hi || keys[i] != key) return false;
+    val = vals[i];
+    return true;
+  }
+
   auto contain(const K &key) ->bool {
     if(keys[0]>key) return false;
     for (uint i = 0; i < N; ++i) {
@@ -99,15 +144,15 @@ struct __attribute__((packed)) Leaf
    * @brief Insert data while keeping all data sorted
    *     Note: this function assume that the leaf is not full, used for init
    * 
-   * @return u8 the inseted position
+   * @return usize the inseted position
    */
-  auto insert_not_full(const K &key, const V &val) -> u8 {
-    u8 i=0;
+  auto insert_not_full(const K &key, const V &val) -> usize {
+    usize i=0;
     for(; i<N; i++){
       if(this->keys[i] == key) return 0;
       if(this->keys[i] > key) break;
     }
-    u8 j=i;
+    usize j=i;
     while(j<N && this->keys[j]!=invalidKey()) j++;
     if(j>=N) return N;
     std::copy_backward(keys+i, keys+j, keys+j+1);
@@ -123,7 +168,7 @@ struct __attribute__((packed)) Leaf
    * @return std::optional<u8> the idx of the removed key in the leaf if success
    */
   auto remove(const K &key) -> bool {
-    for (u8 i = 0; i < N; ++i) {
+    for (usize i = 0; i < N; ++i) {
       if (this->keys[i] == key) {
         std::copy(keys+i+1, keys+N, keys+i);
         std::copy(vals+i+1, vals+N, vals+i);
@@ -134,6 +179,18 @@ struct __attribute__((packed)) Leaf
     return false;
   }
 
+  /**
+   * @brief Move the larger half of the KVs of a full leaf to an empty leaf
+   */
+  void split_to(Leaf* n_leaf) {
+    const usize mid = N / 2;
+    for(usize i=mid; i<N; i++) {
+      n_leaf->keys[i-mid] = keys[i];
+      n_leaf->vals[i-mid] = vals[i];
+      keys[i] = invalidKey();
+    }
+  }
+
   void range(const K& key, const int n, std::vector<V> &r_vals) {
     int i=0;
     while(i<N && r_vals.size()<n) {
@@ -168,7 +225,7 @@ struct __attribute__((packed)) Leaf
    *    state: 0--> key exists,   1 --> insert here, 2--> insert here and create a new leaf,  3 --> insert to next leaf
    */
   auto insert_to_remote(const K &key, const V &val) -> std::pair<u8, u8> {
-    u8 i=0;
+    usize i=0;
     for (; i < N; ++i) {
       if (this->keys[i] == key) return std::make_pair(0, i);   // key exists
       if (this->keys[i] > key) break;
@@ -176,7 +233,7 @@ struct __attribute__((packed)) Leaf
     if(i>=N) return std::make_pair(3, 0); // insert to next leaf
     // insert into here
     u8 state = 1;
-    u8 j=i;
+    usize j=i;
     if(isfull()) {
       j=N-1;
       state = 2;
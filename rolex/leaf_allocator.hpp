@@ -1,12 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <vector>
 
 
 #include "xutils/marshal.hh"
+#include "xutils/atomic.hh"
 #include "xutils/spin_lock.hh"
 #include "r2/src/common.hh"
+#include "epoch.hpp"
+#include "numa.hh"
 
 using namespace r2;
 
@@ -18,28 +28,136 @@ namespace rolex {
  * @brief Currently, it incurs high overhead when the compute nodes allcate memory on memory nodes
  *        So, we preallocate the data leave
  * 
+ *        New leaves are handed out with an atomic fetch_add on the shared [used] word,
+ *        which stays compatible with a remote FAA on the same word, and each thread caches a batch of leaf numbers
+ *        so that splits on different threads do not contend on the word.
+ *
+ *        The leaves are formatted lazily: a thread formats a batch when it reserves the batch,
+ *        so the startup time does not grow with the pool size.
+ *        The leaves beyond the [used] mark are not formatted, and a leaf reserved with a remote FAA
+ *        should be written as a whole by the compute node.
+ *
+ *        The pool grows by regions of the same number of leaves. A leaf is identified by
+ *        [region | leaf number in the region], the same as encode(num, 0, region) of the leaf table,
+ *        and the [used, total] header of region 0 counts the leaves of all regions.
+ *        Each region preserves the header space, so a leaf is at the same offset in any region.
+ *
+ *        Unlinked leaves are retired into the per-thread limbo list, and are moved to the per-thread
+ *        free list once no local reader pins an older epoch and the remote grace period has passed,
+ *        so neither a local reader nor an in-flight one-sided RDMA read sees a leaf reused under it.
+ *        The leaves relocated by the defragmenter or unlinked from the synonym tables
+ *          stay in the submodels that the compute nodes have read,
+ *          so they are reused only once every compute node has acked the layout version of the model region
+ *          written without them, see set_acked.
+ *
  * @tparam Leaf the type that we allocate
  * @tparam S the size of a data leaf
+ * @tparam kBatch the number of leaves that a thread fetches at once
  */
-template <typename Leaf, usize S>
+template <typename Leaf, usize S, usize kBatch = 16>
 class LeafAllocator {
-  ::xstore::util::SpinLock lock;
+public:
+  static constexpr u32 kRegionShift = 56;     /// the same as kAddrBit of the leaf table
+  static constexpr u64 kMaxRegions = 1 << 7;  /// the leaf_region bits of a table entry
+
+  /**
+   * @brief Create a new region of sz bytes with the given id, return nullptr if failed
+   */
+  using grow_f = std::function<char *(const u64 &region, const u64 &sz)>;
+
+  /**
+   * @brief The layout version of the model region acked by every compute node
+   */
+  using acked_f = std::function<u64()>;
+
+private:
+  struct RetiredLeaf {
+    u64 num;
+    u64 epoch;           /// the epoch when the leaf is unlinked
+    u64 time_us;         /// the time when the leaf is unlinked
+  };
+
+  /**
+   * @brief The allocator of the caches, cleared once the allocator is destroyed
+   */
+  struct Home {
+    ::xstore::util::SpinLock lock;
+    LeafAllocator* alloc;
+
+    explicit Home(LeafAllocator* a) : alloc(a) {}
+  };
+
+  /**
+   * @brief The leaves owned by a thread: the reserved batch [next, end) which are not handed out yet,
+   *          the retired leaves waiting for the readers, and the free leaves to reuse.
+   *          They are handed to the other threads when the thread exits.
+   */
+  struct LeafCache {
+    u64 owner = 0;
+    u64 next = 0;
+    u64 end = 0;
+    std::deque<RetiredLeaf> limbo;
+    std::vector<u64> free;
+    std::shared_ptr<Home> home;
+
+    ~LeafCache() {
+      if (!home) return;
+      home->lock.lock();
+      if (home->alloc != nullptr) home->alloc->give_back(*this);
+      home->lock.unlock();
+    }
+  };
+  static inline thread_local std::vector<std::unique_ptr<LeafCache>> caches;
+  static inline thread_local LeafCache* last_cache = nullptr;
+
+  // distinguish the caches of different allocators
+  static auto next_id() -> u64 {
+    static std::atomic<u64> id(0);
+    return ++id;
+  }
+
+  const u64 id = next_id();
+  std::shared_ptr<Home> home = std::make_shared<Home>(this);
+  EpochManager<> epoch;
+  u64 remote_grace_us = 1000;    /// the upper bound of an in-flight one-sided read of the compute nodes
   char *mem_pool = nullptr;      /// the start memory of the allocated data leaves 
   const u64 total_sz = 0;        /// the total size of the register memory that we can allocate
-  u64 cur_alloc_sz = 0;          /// the size that has been allocated
+
+  u64 region_leaves = 0;         /// the number of leaves in each region
+  std::atomic<char *> regions[kMaxRegions];
+  std::atomic<u64> num_regions{1};
+  grow_f grow;
+  ::xstore::util::SpinLock grow_lock;
+  acked_f acked;
+
+  /**
+   * @brief The consecutive leaves [num, num + len) retired together
+   */
+  struct RetiredRun {
+    u64 num;
+    u64 len;
+    u64 epoch;
+    u64 time_us;
+    u64 layout;          /// the layout version every compute node acks before the run is reused, 0 if never published
+  };
+
+  // the leaves retired by the threads allocating none, e.g., the defragmenter,
+  // reused as runs by fetch_leaf_run, or adopted by the others leaf by leaf
+  std::deque<RetiredRun> shared_limbo;
+  std::atomic<u64> shared_num{0};
+  ::xstore::util::SpinLock shared_lock;
 
 public:
-  usize cur_alloc_num = 0;
 
   /**
    * @brief Construct LeafAllocator with region m;
-   *           preallcote leaves and preserve 2*sizeof(u64) for [used, total]
+   *           use the whole region for leaves and preserve 2*sizeof(u64) for [used, total]
    * 
    * @param m the start address of the pool
    * @param t the total size of the pool
    */
   explicit LeafAllocator(char *m, const u64 &t) : mem_pool(m), total_sz(t) {
-    prealloc_leaves((total_sz-sizeof(u64))/S);
+    prealloc_leaves((total_sz-2*sizeof(u64))/S);
   }
 
   /**
@@ -48,89 +166,354 @@ public:
    * @param leaf_num the predefined leaf_num
    */
   explicit LeafAllocator(char *m, const u64 &t, const u64 &leaf_num) : mem_pool(m), total_sz(t) {
-    LOG(3) << "leaf_num: "<<leaf_num<<" , (total_sz-sizeof(u64))/S): "<<(total_sz-sizeof(u64))/S;
-    ASSERT(leaf_num<(total_sz-sizeof(u64))/S) << "Small leaf region for allocating "<<(total_sz-sizeof(u64))/S;
+    LOG(3) << "leaf_num: "<<leaf_num<<" , (total_sz-2*sizeof(u64))/S): "<<(total_sz-2*sizeof(u64))/S;
+    ASSERT(leaf_num<=(total_sz-2*sizeof(u64))/S) << "Small leaf region for allocating "<<(total_sz-2*sizeof(u64))/S;
     prealloc_leaves(leaf_num);
   }
 
+  ~LeafAllocator() {
+    home->lock.lock();
+    home->alloc = nullptr;
+    home->lock.unlock();
+  }
+
+  /**
+   * @brief The number of leaves reserved, including the ones cached by the threads
+   */
   inline auto used_num() -> u64 {
-    return ::xstore::util::Marshal<u64>::deserialize(mem_pool, sizeof(u64));
+    return __atomic_load_n(reinterpret_cast<u64 *>(mem_pool), __ATOMIC_ACQUIRE);
   }
 
   inline auto allocated_num() -> u64 {
-    return ::xstore::util::Marshal<u64>::deserialize(mem_pool+sizeof(u64), sizeof(u64));
+    return __atomic_load_n(reinterpret_cast<u64 *>(mem_pool+sizeof(u64)), __ATOMIC_ACQUIRE);
   }
 
+  inline auto region_num() -> u64 { return num_regions.load(std::memory_order_acquire); }
+
+  inline auto leaves_per_region() -> u64 { return region_leaves; }
+
+  /**
+   * @brief The size of a region, including the preserved header
+   */
+  inline auto region_size() -> u64 { return 2*sizeof(u64) + region_leaves*S; }
+
+  /**
+   * @brief Allow the pool to grow by calling f when the leaves are used up
+   */
+  void set_grow(const grow_f &f) { grow = f; }
+
+  /**
+   * @brief Reuse the runs retired with a layout version only after f returns at least that version
+   */
+  void set_acked(const acked_f &f) { acked = f; }
+
   // =========== access the leaf ============
+  /**
+   * @param num the leaf id [region | leaf number in the region]
+   */
   auto get_leaf(u64 num) -> char * {
-    ASSERT(num <= used_num()) << "Exceed the Preallocated leaves. [used_num:num] " << used_num() <<" " << num;
-    return mem_pool + 2*sizeof(u64) + num*S;
+    const u64 region = num >> kRegionShift;
+    const u64 off = num & ((1UL << kRegionShift) - 1);
+    ASSERT(region < region_num() && off < region_leaves)
+      << "Exceed the Preallocated leaves. [region:num] " << region << " " << off;
+    auto res = regions[region].load(std::memory_order_acquire) + 2*sizeof(u64) + off*S;
+#ifdef ROLEX_NUMA_STATS
+    numa::AccessStats::global().record(res);
+#endif
+    return res;
   }
 
   // ============ allocate leaves ===============
   auto fetch_new_leaf() -> std::pair<char *, u64> {
-    u64 num = fetch_and_add();
-    // if(num>=allocated_num()) 
-    //   LOG(2) <<"Preallocated " <<allocated_num()<< " leaves are insufficient for num: "<<num << ", key "<<key;
-    ASSERT(num < allocated_num()) << "Preallocated " <<allocated_num()<< " leaves are insufficient for num: "<<num;
-    return {mem_pool + 2*sizeof(u64) + num*S, num};
+    auto &c = my_cache();
+    if (!c.limbo.empty() && c.free.empty()) {
+      reclaim(c);
+    }
+    if (unlikely(c.free.empty() && c.next == c.end)) {
+      adopt(c);
+    }
+    if (!c.free.empty()) {
+      u64 num = c.free.back();
+      c.free.pop_back();
+      auto res = get_leaf(num);
+      new (reinterpret_cast<Leaf*>(res)) Leaf();
+      return {res, num};
+    }
+    if (unlikely(c.next == c.end)) {
+      refill(c);
+    }
+    u64 num = to_leaf_id(c.next++);
+    return {get_leaf(num), num};
+  }
+
+  /**
+   * @brief Reserve n formatted leaves with consecutive ids in one region, e.g., to relocate the leaves of a submodel.
+   *          A retired run which no reader can reach is reused first, otherwise the run is taken from the [used] word.
+   *
+   * @return the first leaf of the run and its id, or nullopt if the pool has no such run.
+   *           The leaves reserved for a run crossing a region are retired for the other threads.
+   */
+  auto fetch_leaf_run(const u64 &n) -> std::optional<std::pair<char *, u64>> {
+    if (n == 0 || n > region_leaves) return {};
+    auto num = reuse_run(n);
+    if (!num) {
+      u64 start = used_num();
+      do {
+        if (start + n > reserve_regions(start + n)) return {};
+      } while (!__atomic_compare_exchange_n(reinterpret_cast<u64 *>(mem_pool), &start, start + n, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+      if (start / region_leaves != (start + n - 1) / region_leaves) {
+        const u64 boundary = (start / region_leaves + 1) * region_leaves;
+        retire_run(to_leaf_id(start), boundary - start);
+        retire_run(to_leaf_id(boundary), start + n - boundary);
+        return {};
+      }
+      num = to_leaf_id(start);
+    }
+    for (u64 i = 0; i < n; i++) {
+      new (reinterpret_cast<Leaf*>(get_leaf(num.value() + i))) Leaf();
+    }
+    return std::make_pair(get_leaf(num.value()), num.value());
+  }
+
+  /**
+   * @brief Convert the sequence number counted by the [used] word to the leaf id
+   */
+  inline auto to_leaf_id(const u64 &seq) -> u64 {
+    return ((seq / region_leaves) << kRegionShift) | (seq % region_leaves);
+  }
+
+  // ============ reclaim leaves ===============
+  /**
+   * @brief Pin the current epoch during accessing the leaves, the leaves will not be reused until unpinned
+   */
+  auto pin() -> typename EpochManager<>::Guard { return epoch.pin(); }
+
+  /**
+   * @brief Retire a leaf which has been unlinked from the leaf table, and which no copy of it in the model region links.
+   *          The leaf is reused by the calling thread after the concurrent readers finish.
+   *          A leaf the compute nodes may reach is retired by retire_run with the layout version without it.
+   */
+  void retire(u64 num) {
+    my_cache().limbo.push_back({num, epoch.retire_epoch(), EpochManager<>::now_us()});
+  }
+
+  /**
+   * @brief Retire the consecutive leaves [num, num + len) of a region, reused by any thread,
+   *          for a thread which does not allocate leaves itself
+   *
+   * @param layout the layout version of the model region which no longer references the leaves,
+   *          0 if the compute nodes never read them
+   */
+  void retire_run(u64 num, u64 len, const u64 &layout = 0) {
+    if (len == 0) return;
+    shared_lock.lock();
+    shared_limbo.push_back({num, len, epoch.retire_epoch(), EpochManager<>::now_us(), layout});
+    shared_num.fetch_add(len, std::memory_order_release);
+    shared_lock.unlock();
+  }
+
+  /**
+   * @brief Retire the leaves, e.g., the ones relocated by the defragmenter, as the runs of consecutive ids
+   */
+  void retire_runs(std::vector<u64> &nums, const u64 &layout = 0) {
+    std::sort(nums.begin(), nums.end());
+    for (usize i = 0, j = 1; i < nums.size(); i = j++) {
+      while (j < nums.size() && nums[j] == nums[j - 1] + 1) j++;
+      retire_run(nums[i], j - i, layout);
+    }
+  }
+
+  /**
+   * @brief The leaves retired by retire_run, which are not reused yet
+   */
+  auto shared_free_num() -> u64 { return shared_num.load(std::memory_order_acquire); }
+
+  auto epochs() -> EpochManager<>& { return epoch; }
+
+  void set_remote_grace(const u64 &us) { remote_grace_us = us; }
+
+  /**
+   * @brief The number of leaves retired or freed by the calling thread, which are not reused yet
+   */
+  auto cached_free_num() -> usize {
+    auto &c = my_cache();
+    return c.limbo.size() + c.free.size();
   }
   
 
 private:
-  auto alloc() -> ::r2::Option<char *> {
-    lock.lock();
-    if (cur_alloc_sz + S <= total_sz) {
-      // has free space
-      auto res = mem_pool + cur_alloc_sz;
-      cur_alloc_sz += S;
-      cur_alloc_num += 1;
-      lock.unlock();
-      return res;
+  auto my_cache() -> LeafCache& {
+    if (likely(last_cache != nullptr && last_cache->owner == id)) return *last_cache;
+    for (auto &c : caches) {
+      if (c->owner == id) return *(last_cache = c.get());
+    }
+    caches.emplace_back(new LeafCache());
+    last_cache = caches.back().get();
+    last_cache->owner = id;
+    last_cache->home = home;
+    return *last_cache;
+  }
+
+  /**
+   * @brief Hand the leaves of the cache of an exiting thread to the shared limbo.
+   *          The batch and the free leaves are reusable at once, so they go to the front,
+   *          and the retired leaves keep waiting for the readers.
+   */
+  void give_back(LeafCache &c) {
+    const u64 n = c.end - c.next + c.free.size() + c.limbo.size();
+    if (n == 0) return;
+    shared_lock.lock();
+    for (u64 seq = c.next; seq < c.end;) {
+      // a run never crosses a region
+      const u64 len = std::min(c.end, (seq / region_leaves + 1) * region_leaves) - seq;
+      shared_limbo.push_front({to_leaf_id(seq), len, 0, 0, 0});
+      seq += len;
+    }
+    for (auto num : c.free) shared_limbo.push_front({num, 1, 0, 0, 0});
+    for (auto &r : c.limbo) shared_limbo.push_back({r.num, 1, r.epoch, r.time_us, 0});
+    shared_num.fetch_add(n, std::memory_order_release);
+    shared_lock.unlock();
+    c.next = c.end;
+    c.free.clear();
+    c.limbo.clear();
+  }
+
+  /**
+   * @brief Move the retired leaves which no reader can reach to the free list.
+   *          The limbo is ordered by the retire epochs.
+   */
+  void reclaim(LeafCache &c) {
+    auto now = EpochManager<>::now_us();
+    while (!c.limbo.empty()) {
+      auto &r = c.limbo.front();
+      if (r.time_us + remote_grace_us > now || !epoch.reclaimable(r.epoch)) break;
+      c.free.push_back(r.num);
+      c.limbo.pop_front();
     }
-    lock.unlock();
-    LOG(4) << cur_alloc_sz << " " << total_sz;
-    return {};
   }
 
-  auto dealloc(char *data) { ASSERT(false) << "not implemented"; }  
+  /**
+   * @brief Whether no reader can reach the retired leaves, the shared limbo is ordered by the retire epochs
+   *
+   * @param layout the layout version acked by every compute node
+   */
+  inline auto reclaimable(const RetiredRun &r, const u64 &now, const u64 &layout) -> bool {
+    return r.time_us + remote_grace_us <= now && epoch.reclaimable(r.epoch) && r.layout <= layout;
+  }
+
+  inline auto acked_layout() -> u64 { return acked ? acked() : std::numeric_limits<u64>::max(); }
 
+  /**
+   * @brief Move a batch of the shared retired leaves which no reader can reach to the free list of the thread,
+   *          before it reserves a new batch
+   */
+  void adopt(LeafCache &c) {
+    if (shared_num.load(std::memory_order_acquire) == 0) return;
+    auto now = EpochManager<>::now_us();
+    const u64 layout = acked_layout();
+    shared_lock.lock();
+    while (!shared_limbo.empty() && c.free.size() < kBatch && reclaimable(shared_limbo.front(), now, layout)) {
+      auto &r = shared_limbo.front();
+      c.free.push_back(r.num + --r.len);
+      shared_num.fetch_sub(1, std::memory_order_release);
+      if (r.len == 0) shared_limbo.pop_front();
+    }
+    shared_lock.unlock();
+  }
+
+  /**
+   * @brief Take the first n leaves of the first reclaimable retired run of at least n leaves
+   *
+   * @return the id of the first leaf
+   */
+  auto reuse_run(const u64 &n) -> std::optional<u64> {
+    if (shared_num.load(std::memory_order_acquire) < n) return {};
+    auto now = EpochManager<>::now_us();
+    const u64 layout = acked_layout();
+    std::optional<u64> res;
+    shared_lock.lock();
+    for (auto it = shared_limbo.begin(); it != shared_limbo.end() && reclaimable(*it, now, layout); it++) {
+      if (it->len < n) continue;
+      res = it->num;
+      it->num += n;
+      it->len -= n;
+      shared_num.fetch_sub(n, std::memory_order_release);
+      if (it->len == 0) shared_limbo.erase(it);
+      break;
+    }
+    shared_lock.unlock();
+    return res;
+  }
 
   //  ======= Preallocate leaves to store data ============
+  /**
+   * @brief Only init the metadata (current number of the leaf, total number of allocated leaves),
+   *          the leaves are formatted in refill()
+   */
   void prealloc_leaves(u64 leaf_num) {
-    // 1.init the metadata (current number of the leaf, total number of allocated leaves)
+    ASSERT(2*sizeof(u64) + leaf_num*S <= total_sz) << "Small leaf region for allocating " << leaf_num;
+    ASSERT(leaf_num > 0 && leaf_num < (1UL << kRegionShift));
+    region_leaves = leaf_num;
+    regions[0].store(mem_pool);
+    for (u64 i = 1; i < kMaxRegions; i++) regions[i].store(nullptr);
     u64 cur_num = 0;
-    ASSERT(cur_alloc_sz==0) << "LeafAllocator has been used since cur_alloc_sz != 0.";
     memcpy(mem_pool, &cur_num, sizeof(u64));
-    cur_alloc_sz += sizeof(u64);
-    memcpy(mem_pool+cur_alloc_sz, &leaf_num, sizeof(u64));
-    cur_alloc_sz += sizeof(u64);
-    // 2.preallocate the data leaves
-    for(int i=0; i<leaf_num; i++) {
-      Leaf* cur_leaf = new (reinterpret_cast<Leaf*>(alloc().value())) Leaf();
-    }
+    memcpy(mem_pool+sizeof(u64), &leaf_num, sizeof(u64));
     LOG(3) << "Preallocate leaf number--> [used, total]: [" 
            << ::xstore::util::Marshal<u64>::deserialize(mem_pool, sizeof(u64)) << ", "
            <<::xstore::util::Marshal<u64>::deserialize(mem_pool+sizeof(u64), sizeof(u64))<<"]";
   }
 
   /**
-   * @brief Obtain the number of current ideal leaves and add the number with 1
+   * @brief Obtain the number of current ideal leaves and add the number with n
    *          this function is used for memory node, rather than the compute node
    * 
    * @return u64 the number of current ideal leaves
    */
-  auto fetch_and_add() -> u64 {
-    lock.lock();
-    auto res = ::xstore::util::Marshal<u64>::deserialize(mem_pool, sizeof(u64));
-    auto res_add = res+1;
-    // LOG(2) << "now used "<<res_add;
-    // ASSERT(res_add != 0) << "fetch_and_add, before add 1: "<<res<< ", add 1: "<<res_add;
-    memcpy(mem_pool, &(res_add), sizeof(u64));
-    auto read_res = ::xstore::util::Marshal<u64>::deserialize(mem_pool, sizeof(u64));
-    ASSERT(res_add == read_res) << "fetch_and_add, affer add 1: "<<res_add<< ", read_res: "<<read_res;
-    lock.unlock();
-    return res;
+  auto fetch_and_add(const u64 &n) -> u64 {
+    return ::xstore::util::atomic_fetch_and_add64(reinterpret_cast<u64 *>(mem_pool), n);
+  }
+
+  /**
+   * @brief Reserve a new batch of leaves for this thread, and grow the pool if needed.
+   *        Near the end of a pool that cannot grow, leaves are reserved one by one,
+   *        so that the free leaves are not stranded in the batches of other threads.
+   */
+  void refill(LeafCache &c) {
+    const bool growable = static_cast<bool>(grow);
+    const u64 n = growable || used_num() + kBatch * kBatch <= allocated_num() ? kBatch : 1;
+    const u64 start = fetch_and_add(n);
+    const u64 total = reserve_regions(start + n);
+    ASSERT(start < total) << "Preallocated " << total << " leaves are insufficient for num: " << start;
+    c.next = start;
+    c.end = std::min(start + n, total);
+    // format the leaves on first hand-out
+    for (u64 seq = c.next; seq < c.end; seq++) {
+      new (reinterpret_cast<Leaf*>(get_leaf(to_leaf_id(seq)))) Leaf();
+    }
+  }
+
+  /**
+   * @brief Add regions until the pool holds n leaves, or no more region can be added
+   *
+   * @return u64 the number of leaves in the pool
+   */
+  auto reserve_regions(const u64 &n) -> u64 {
+    if (likely(n <= allocated_num() || !grow)) return allocated_num();
+    grow_lock.lock();
+    while (allocated_num() < n) {
+      const u64 r = region_num();
+      if (r >= kMaxRegions) break;
+      auto m = grow(r, region_size());
+      if (m == nullptr) break;
+      regions[r].store(m, std::memory_order_release);
+      num_regions.store(r + 1, std::memory_order_release);
+      __atomic_store_n(reinterpret_cast<u64 *>(mem_pool+sizeof(u64)), (r + 1) * region_leaves, __ATOMIC_RELEASE);
+      LOG(3) << "Grow the leaf pool to " << r + 1 << " regions";
+    }
+    grow_lock.unlock();
+    return allocated_num();
   }
 
 };
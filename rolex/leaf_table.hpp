@@ -1,13 +1,19 @@
 #pragma once 
 
+#include <assert.h>
 #include <limits.h>     /* CHAR_BIT */
+#include <atomic>
 #include <bitset>
 #include <iostream>
+#include <limits>
 #include <vector>
 
 #include "r2/src/common.hh"
 #include "xutils/marshal.hh"
 #include "xutils/spin_lock.hh"
+#ifdef ROLEX_RTM
+#include "xutils/rtm.hh"
+#endif
 
 
 
@@ -41,7 +47,7 @@ const u32 kSynonymMax = 128;
  * @brief Help functions for encode and decode.
  *          bits set: [1, 7, 8, 48] = [lock, leaf region, synonym leaf, leaves]
  */
-auto encode(const u64& num, const u8& synonym_leaf = 0, const u8& leaf_region = 0) -> u64 {
+inline auto encode(const u64& num, const u8& synonym_leaf = 0, const u8& leaf_region = 0) -> u64 {
   assert(num < (1L << kAddrBit) && leaf_region < (1L<<7));
   auto temp = (u64)leaf_region<<kAddrBit;
   temp |= (u64)synonym_leaf<<kLeafBit;
@@ -69,6 +75,13 @@ union TableEntry {
   uint64_t val;
 };
 using TE = TableEntry;
+// the lock is the lowest bit of TableEntry.val
+constexpr u64 kTELockBit = 1;
+
+/**
+ * @brief The leaf id used by the leaf allocator: [leaf region | leaf number in the region]
+ */
+inline auto leaf_id(const TE& te) -> u64 { return encode(te.leaf_num, 0, te.leaf_region); }
 
 struct leaf_addr {
   int off;   // offset of TE in leaf table
@@ -76,6 +89,84 @@ struct leaf_addr {
 };
 using leaf_addr_t = leaf_addr;
 
+/**
+ * @brief The leaf of the predicted position and the predicted slot in it,
+ *          where the in-leaf search starts
+ */
+struct SlotHint {
+  usize leaf = 0;
+  usize slot = 0;
+
+  /**
+   * @brief The slot to start from in the i-th leaf: the key is at the tail of the leaves before the predicted one
+   */
+  inline auto at(const usize &i) const -> usize {
+    return i == leaf ? slot : (i < leaf ? std::numeric_limits<usize>::max() : 0);
+  }
+};
+
+/**
+ * @brief The outcome of the transactional leaf writes (compiled with ROLEX_RTM).
+ *          Each thread counts locally and adds to the global counters every kFlush writes and at its exit.
+ */
+struct RTMStats {
+  static constexpr u64 kFlush = 1024;
+
+  std::atomic<u64> commits{0};      ///< the writes committed in a transaction
+  std::atomic<u64> fallbacks{0};    ///< the writes done under the leaf lock
+  std::atomic<u64> aborts{0};
+  std::atomic<u64> conflict{0};
+  std::atomic<u64> capacity{0};
+
+  struct Local {
+    u64 commits = 0, fallbacks = 0, aborts = 0, conflict = 0, capacity = 0;
+
+    void flush() {
+      auto &g = RTMStats::global();
+      g.commits.fetch_add(commits, std::memory_order_relaxed);
+      g.fallbacks.fetch_add(fallbacks, std::memory_order_relaxed);
+      g.aborts.fetch_add(aborts, std::memory_order_relaxed);
+      g.conflict.fetch_add(conflict, std::memory_order_relaxed);
+      g.capacity.fetch_add(capacity, std::memory_order_relaxed);
+      commits = fallbacks = aborts = conflict = capacity = 0;
+    }
+    ~Local() { flush(); }
+  };
+
+  static auto global() -> RTMStats & {
+    static RTMStats stats;
+    return stats;
+  }
+
+  /**
+   * @brief The counters of this thread, not yet in the global ones
+   */
+  static auto local() -> Local & {
+    static thread_local Local l;
+    return l;
+  }
+
+  /**
+   * @brief Record one write, called out of the transaction
+   */
+  static void record(const bool committed, const u64 aborts, const u64 conflict, const u64 capacity) {
+    auto &local = RTMStats::local();
+    (committed ? local.commits : local.fallbacks)++;
+    local.aborts += aborts;
+    local.conflict += conflict;
+    local.capacity += capacity;
+    if((local.commits + local.fallbacks) % kFlush == 0) local.flush();
+  }
+
+  /**
+   * @brief The aborted transactions per started one
+   */
+  auto abort_ratio() const -> double {
+    auto started = commits.load() + aborts.load();
+    return started == 0 ? 0 : static_cast<double>(aborts.load()) / started;
+  }
+};
+
 /**
  * @brief Used in memory nodes, contains the Leaf table and Synonym table
  * 
@@ -85,7 +176,16 @@ struct LeafTable {
 
   std::vector<TE> table;
   TE SynonymTable[kSynonymMax];
-  std::vector<::xstore::util::SpinLock*> csLocks;
+
+  // the unlinked synonym slots, reused after the readers finish: [slot, retire epoch]
+  ::xstore::util::SpinLock* synLock = new ::xstore::util::SpinLock();
+  std::vector<std::pair<usize, u64>> retiredSynonyms;
+  std::vector<usize> freeSynonyms;
+  // the sizes of the lists, written under synLock and read without it
+  usize retiredNum = 0;
+  usize freeNum = 0;
+  // the leaves of the unlinked synonym slots, which a copy of the table in the model region may still reference
+  std::vector<u64> unlinkedLeaves;
 
   LeafTable() { 
     SynonymTable[0].leaf_num = 1;           // SynonymTable[0] indicate the next available slot 
@@ -102,28 +202,39 @@ struct LeafTable {
   /**
    * @brief Add a number of the data nodes into address table
    *          Note: used for training phase
+   *          leaf_num is the leaf id from the allocator, whose high bits carry the leaf region
    * @return usize the total size of existing table
    */
   auto train_emplace_back(const u64& leaf_num, const u8& synonym_leaf = 0, const u8& leaf_region = 0) -> usize {
+    auto [num, _s, region] = decode(leaf_num);
     TE te = { {.lock=0, 
-               .leaf_region=leaf_region,
+               .leaf_region=static_cast<u8>(leaf_region | region),
                .synonym_leaf=synonym_leaf, 
-               .leaf_num=leaf_num} };
+               .leaf_num=num} };
     table.emplace_back(te);
-    csLocks.emplace_back(new ::xstore::util::SpinLock());
     return table.size();
   }
 
   auto synonym_emplace_back(bool in_table, const u64 l_idx, const u64& leaf_num, const u8& synonym_leaf = 0, const u8& leaf_region = 0) -> usize {
+    auto [num, _s, region] = decode(leaf_num);
     TE te = { {.lock=0, 
-               .leaf_region=leaf_region,
+               .leaf_region=static_cast<u8>(leaf_region | region),
                .synonym_leaf=synonym_leaf, 
-               .leaf_num=leaf_num} };
-    if(SynonymTable[0].leaf_num == kSynonymMax-1) {
+               .leaf_num=num} };
+    synLock->lock();
+    usize idx = 0;
+    if(!freeSynonyms.empty()) {
+      idx = freeSynonyms.back();
+      freeSynonyms.pop_back();
+      __atomic_store_n(&freeNum, freeSynonyms.size(), __ATOMIC_RELEASE);
+    } else if(SynonymTable[0].leaf_num < kSynonymMax-1) {
+      idx = SynonymTable[0].leaf_num++;
+    }
+    synLock->unlock();
+    if(idx == 0) {
       // LOG(5) << "Synonym table is full, need retraining";
       return 0;
     }
-    auto idx = SynonymTable[0].leaf_num++;
     if(in_table){
       te.synonym_leaf = table[l_idx].synonym_leaf;
       table[l_idx].synonym_leaf = idx;
@@ -141,21 +252,78 @@ struct LeafTable {
     else SynonymTable[s_leaves[idx-1]].synonym_leaf = SynonymTable[s_leaves[idx]].synonym_leaf;
   }
 
-  auto search(const K &key, V &val, leaf_alloc_t* alloc, int lo, int hi) -> bool {
+  /**
+   * @brief Whether no synonym slot is available, the retired slots are not counted
+   */
+  auto synonym_full() -> bool {
+    TE next;
+    next.val = __atomic_load_n(&SynonymTable[0].val, __ATOMIC_ACQUIRE);
+    return next.leaf_num == kSynonymMax-1 && __atomic_load_n(&freeNum, __ATOMIC_ACQUIRE) == 0;
+  }
+
+  /**
+   * @brief Retire an unlinked synonym slot, it is reused once no reader can reach it.
+   *          Its leaf is kept until the caller of take_unlinked retires it.
+   */
+  void retire_synonym(const usize s_idx, const u64 epoch) {
+    synLock->lock();
+    retiredSynonyms.emplace_back(s_idx, epoch);
+    __atomic_store_n(&retiredNum, retiredSynonyms.size(), __ATOMIC_RELEASE);
+    unlinkedLeaves.push_back(leaf_id(SynonymTable[s_idx]));
+    synLock->unlock();
+  }
+
+  /**
+   * @brief Move the leaves unlinked since the last call into out.
+   *          A copy of the table serialized after the call references none of them,
+   *          so they are retired once the compute nodes have read such a copy.
+   */
+  void take_unlinked(std::vector<u64> &out) {
+    synLock->lock();
+    out.insert(out.end(), unlinkedLeaves.begin(), unlinkedLeaves.end());
+    unlinkedLeaves.clear();
+    synLock->unlock();
+  }
+
+  auto has_unlinked() -> bool {
+    synLock->lock();
+    const bool res = !unlinkedLeaves.empty();
+    synLock->unlock();
+    return res;
+  }
+
+  void reclaim_synonyms(leaf_alloc_t* alloc) {
+    if(__atomic_load_n(&retiredNum, __ATOMIC_ACQUIRE) == 0) return;
+    synLock->lock();
+    for(usize i=0; i<retiredSynonyms.size();) {
+      if(alloc->epochs().reclaimable(retiredSynonyms[i].second)) {
+        freeSynonyms.push_back(retiredSynonyms[i].first);
+        retiredSynonyms[i] = retiredSynonyms.back();
+        retiredSynonyms.pop_back();
+      } else {
+        i++;
+      }
+    }
+    __atomic_store_n(&retiredNum, retiredSynonyms.size(), __ATOMIC_RELEASE);
+    __atomic_store_n(&freeNum, freeSynonyms.size(), __ATOMIC_RELEASE);
+    synLock->unlock();
+  }
+
+  auto search(const K &key, V &val, leaf_alloc_t* alloc, int lo, int hi, const SlotHint &hint = SlotHint()) -> bool {
     ASSERT(hi<table.size()) << "[hi:table.size()] " << hi<<" : " << table.size();
     leaf_t* leaf;
     for(int i=hi; i>lo; i--){
-      // leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      // leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       // if(leaf->search(key, val)) return true;
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       if(leaf->insertHere(key)) {
         // insert leaf and synonym leaf
-        if(leaf->search(key, val)) return true;
+        if(leaf->search(key, val, hint.at(i))) return true;
         return search_synonym(key, val, i, alloc);
       }
     }
-    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[lo].leaf_num));
-    if(leaf->search(key, val)) return true;
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[lo])));
+    if(leaf->search(key, val, hint.at(lo))) return true;
     return search_synonym(key, val, lo, alloc);
   } 
 
@@ -169,7 +337,7 @@ struct LeafTable {
       s_idx = s_te.synonym_leaf;
     }
     for(int i=s_leaves.size()-1; i>=0; i--) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[i]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[i]])));
       if(tem_leaf->search(key, val)) return true;
     }
     return false;
@@ -180,7 +348,7 @@ struct LeafTable {
     leaf_t* leaf;
     int idx=-1;
     for(int i=hi; i>=lo; i--){
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       if(leaf->insertHere(key)) {
         range_synonym(key, n, vals, i, leaf, alloc);
         idx=i;
@@ -190,7 +358,7 @@ struct LeafTable {
     if(idx==-1) idx=lo;
     else idx++;
     while(idx<table.size() && vals.size()<n) {
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[idx].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[idx])));
       leaf->range(key, n, vals);
       if(vals.size()>=n) return;
       next_range(key, n, vals, idx, alloc);
@@ -210,7 +378,7 @@ struct LeafTable {
     // To guarantee all data sorted, we traverse leaves from back
     int idx=-1;
     for(int i=s_leaves.size()-1; i>=0; i--) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[i]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[i]])));
       if(tem_leaf->insertHere(key)) {
         cur = tem_leaf;
         idx=i;
@@ -220,7 +388,7 @@ struct LeafTable {
     cur->range(key, n, vals);
     idx++;
     while(vals.size()<n && idx<s_leaves.size()) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[idx]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[idx]])));
       tem_leaf->range(key, n, vals);
       idx++;
     }
@@ -236,7 +404,7 @@ struct LeafTable {
     }
     int idx=0;
     while(vals.size()<n && idx<s_leaves.size()) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[idx]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[idx]])));
       tem_leaf->range(key, n, vals);
       idx++;
     }
@@ -246,21 +414,25 @@ struct LeafTable {
     ASSERT(hi<table.size()) << "[hi:table.size()] " << hi<<" : " << table.size();
     leaf_t* leaf;
     for(int i=hi; i>lo; i--){
-      // leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      // leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       // if(leaf->update(key, val)) return true;
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       if(leaf->insertHere(key)) {
         // update leaf and synonym leaf
         return update_synonym(key, val, i, leaf, alloc);
       }
     }
-    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[lo].leaf_num));
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[lo])));
     return update_synonym(key, val, lo, leaf, alloc);
   } 
 
   auto update_synonym(const K &key, const V &val, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
-    // lock the leaf
-    lock_leaf(l_idx);
+    return write_leaf(l_idx, [&]() { return update_synonym_locked(key, val, l_idx, leaf, alloc); });
+  }
+
+  auto update_synonym_locked(const K &key, const V &val, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
+    // the leaf found before the lock may have been relocated by the defragmenter
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[l_idx])));
     // obtain synonym leaf index
     leaf_t *cur = leaf;
     usize s_idx = table[l_idx].synonym_leaf;
@@ -272,32 +444,77 @@ struct LeafTable {
     }
     // To guarantee all data sorted, we traverse leaves from back
     for(int i=s_leaves.size()-1; i>=0; i--) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[i]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[i]])));
       if(tem_leaf->insertHere(key)) {
         cur = tem_leaf;
         break;
       }
     }
-    bool res = cur->update(key, val);
-    unlock_leaf(l_idx);
-    return res;
+    return cur->update(key, val);
   }
 
   /**
-   * 1.find which leaf to insert
-   * 2.insert into a leaf or a synonym leaf
-   *      lock the leaf;
+   * @brief Lock the leaf and its synonym leaves for insert/update/remove, by a CAS on the lock bit of the TE.
+   *          The holder may change the other fields of the TE, e.g., to link a synonym leaf,
+   *          as the CAS of the others fails until the bit is cleared.
    */
-  // fixme: use a better lock?
-  //         should lock in the model region
   void lock_leaf(size_t idx) {
-    while(table[idx].lock != 0) 
+    auto word = &table[idx].val;
+    while(true) {
+      u64 cur = __atomic_load_n(word, __ATOMIC_RELAXED);
+      if((cur & kTELockBit) == 0 &&
+         __atomic_compare_exchange_n(word, &cur, cur | kTELockBit, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
       asm volatile("pause\n" : : : "memory");
-    table[idx].lock = 1;
+    }
   }
   void unlock_leaf(size_t idx) {
-    ::r2::compile_fence();
-    table[idx].lock = 0;
+    __atomic_fetch_and(&table[idx].val, ~kTELockBit, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * @brief The lock bit of a TE as the fallback lock of RTMScope
+   */
+  struct LeafLock {
+    LeafTable* ltable;
+    usize idx;
+
+    auto is_locked() -> bool { return (__atomic_load_n(&ltable->table[idx].val, __ATOMIC_RELAXED) & kTELockBit) != 0; }
+    void lock() { ltable->lock_leaf(idx); }
+    void unlock() { ltable->unlock_leaf(idx); }
+  };
+
+  /**
+   * @brief Run f, a write to the leaf l_idx and its synonym leaves, under the leaf lock.
+   *          With ROLEX_RTM and a CPU supporting RTM, f runs in a transaction instead,
+   *          which reads the lock bit and so aborts once a writer takes the lock;
+   *          the lock is taken after the retries of RTMScope, e.g., for a split that overflows the transaction.
+   */
+  template<typename F>
+  auto write_leaf(const usize l_idx, F &&f) -> bool {
+#ifdef ROLEX_RTM
+    static const bool rtm = ::xstore::util::rtm_supported();
+    if(rtm) {
+      LeafLock lock{this, l_idx};
+      bool res = false, committed = false;
+      u64 aborts = 0, conflict = 0, capacity = 0;
+      {
+        ::xstore::util::RTMScope<LeafLock> scope(&lock);
+        res = f();
+        committed = _xtest();
+        aborts = scope.retry;
+        conflict = scope.conflict;
+        capacity = scope.capacity;
+      }
+      RTMStats::record(committed, aborts, conflict, capacity);
+      return res;
+    }
+    RTMStats::record(false, 0, 0, 0);
+#endif
+    lock_leaf(l_idx);
+    bool res = f();
+    unlock_leaf(l_idx);
+    return res;
   }
 
   auto insert(const K &key, const V &val, leaf_alloc_t* alloc, int lo, int hi) -> bool {
@@ -305,13 +522,13 @@ struct LeafTable {
     // To guarantee all data sorted, we traverse leaves from back
     leaf_t* leaf;
     for(int i=hi; i>lo; i--){
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       if(leaf->insertHere(key)) {
         // insert leaf and synonym leaf
         return insert_synonym(key, val, i, leaf, alloc);
       }
     }
-    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[lo].leaf_num));
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[lo])));
     return insert_synonym(key, val, lo, leaf, alloc);
   } 
 
@@ -321,10 +538,14 @@ struct LeafTable {
    */
   auto insert_synonym(const K &key, const V &val, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
     // lock the leaf
-    if(SynonymTable[0].leaf_num == kSynonymMax-1) return false;
-    // lock_leaf(l_idx);
-    this->csLocks[l_idx]->lock();
-    // LOG(4) << "lock " << l_idx;
+    reclaim_synonyms(alloc);
+    if(synonym_full()) return false;
+    return write_leaf(l_idx, [&]() { return insert_synonym_locked(key, val, l_idx, leaf, alloc); });
+  }
+
+  auto insert_synonym_locked(const K &key, const V &val, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
+    // the leaf found before the lock may have been relocated by the defragmenter
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[l_idx])));
     // obtain synonym leaf index
     leaf_t *cur = leaf;
     usize s_idx = table[l_idx].synonym_leaf;
@@ -343,7 +564,7 @@ struct LeafTable {
       //   print(alloc);
       //   ASSERT(false);
       // }
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[i]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[i]])));
       if(tem_leaf->insertHere(key)) {
         cur = tem_leaf;
         idx = s_leaves[i];
@@ -351,38 +572,33 @@ struct LeafTable {
       }
     }
     if(cur->contain(key)) {
-      // unlock_leaf(l_idx);
-      this->csLocks[l_idx]->unlock();
       return false;
     }
     // insert into leaf: full?
-    if(cur->isfull()) {
-      if(SynonymTable[0].leaf_num == kSynonymMax-1) {
-        // unlock_leaf(l_idx);
-        this->csLocks[l_idx]->unlock();
+    if(!cur->accepts(key)) {
+      // e.g., the key is too far from the keys of a compressed leaf, which a split does not help
+      if(!cur->isfull() || !cur->accepts_split(key) || synonym_full()) {
         return false;
       }
       auto res = alloc->fetch_new_leaf();
       // insert into synonym table
+      usize s_res = 0;
       if(idx==-1)
-        synonym_emplace_back(true, l_idx, res.second);
+        s_res = synonym_emplace_back(true, l_idx, res.second);
       else 
-        synonym_emplace_back(false, idx, res.second);
+        s_res = synonym_emplace_back(false, idx, res.second);
+      if(s_res == 0) {
+        // the slots are taken by the splits of other leaves
+        alloc->retire(res.second);
+        return false;
+      }
       leaf_t *n_leaf = reinterpret_cast<leaf_t*>(res.first);    
       // move half data
-      int mid = leaf_t::max_slot() / 2;
-      for(int i=0; i<mid; i++) {
-        n_leaf->keys[i] = cur->keys[mid+i];
-        n_leaf->vals[i] = cur->vals[mid+i];
-        cur->keys[mid+i] = leaf_t::invalidKey();
-      }
+      cur->split_to(n_leaf);
       // insert into new leaf?
       if(n_leaf->insertHere(key)) cur = n_leaf;
     }
     cur->insert_not_full(key, val);
-    // LOG(3) << "unlock " << l_idx;
-    // unlock_leaf(l_idx);
-    this->csLocks[l_idx]->unlock();
     return true;
   }
 
@@ -390,18 +606,23 @@ struct LeafTable {
     ASSERT(hi<table.size()) << "[hi:table.size()] " << hi<<" : " << table.size();
     leaf_t* leaf;
     for(int i=hi; i>lo; i--){
-      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       if(leaf->insertHere(key)) {
         return remove_synonym(key, i, leaf, alloc);
       }
     }
-    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[lo].leaf_num));
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[lo])));
     return remove_synonym(key, lo, leaf, alloc);
   }
 
   auto remove_synonym(const K &key, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
-    // lock the leaf
-    lock_leaf(l_idx);
+    // lock the leaf, excluding the concurrent splits
+    return write_leaf(l_idx, [&]() { return remove_synonym_locked(key, l_idx, leaf, alloc); });
+  }
+
+  auto remove_synonym_locked(const K &key, const usize l_idx, leaf_t* leaf, leaf_alloc_t* alloc) -> bool {
+    // the leaf found before the lock may have been relocated by the defragmenter
+    leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[l_idx])));
     // obtain synonym leaf index
     leaf_t *cur = leaf;
     usize s_idx = table[l_idx].synonym_leaf;
@@ -414,7 +635,7 @@ struct LeafTable {
     }
     // To guarantee all data sorted, we traverse leaves from back
     for(int i=s_leaves.size()-1; i>=0; i--) {
-      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[s_leaves[i]].leaf_num));
+      leaf_t* tem_leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[s_leaves[i]])));
       if(tem_leaf->insertHere(key)) {
         cur = tem_leaf;
         idx = i;
@@ -423,19 +644,96 @@ struct LeafTable {
     }
     bool res = cur->remove(key);
     if(cur->isEmpty()) {
-      if(idx!=-1)
+      if(idx!=-1) {
+        // unlink the empty synonym leaf, its slot is reused after the concurrent readers finish,
+        // and the leaf after the compute nodes drop the copies of the table linking it, see take_unlinked
         synonym_table_remove(s_leaves, l_idx, idx);
+        retire_synonym(s_leaves[idx], alloc->epochs().retire_epoch());
+      }
     }
-    unlock_leaf(l_idx);
     return res;
   }
 
+  // =============== functions for the defragmentation ===========================
+  /**
+   * @brief The runs of consecutive leaf ids in key order, i.e., each leaf followed by its synonym leaves.
+   *          A compute node reads each run of a window with one RDMA read.
+   */
+  auto runs() -> usize {
+    usize n = 0;
+    u64 prev = kInvalidAddr;
+    auto visit = [&](const TE &te) {
+      const u64 id = leaf_id(te);
+      n += (prev == kInvalidAddr || id != prev + 1);
+      prev = id;
+    };
+    for(usize i=0; i<table.size(); i++) {
+      visit(table[i]);
+      for(usize s_idx = table[i].synonym_leaf; s_idx != 0; s_idx = SynonymTable[s_idx].synonym_leaf) visit(SynonymTable[s_idx]);
+    }
+    return n;
+  }
+
+  /**
+   * @brief Copy the leaf l_idx and its synonym leaves, in key order, to the leaves [next, end) of a run,
+   *          and point their TEs to the copies. The synonym slots are kept.
+   *          The leaf lock is held, so the copies equal the old leaves and a reader following either TE
+   *          finds the same KVs; the caller retires the old leaves for the readers to drain.
+   *
+   * @param next the id of the next leaf of the run, advanced by the copied leaves
+   * @param old the ids of the old leaves are appended
+   * @return false if the run has too few leaves left, e.g., a split linked a synonym leaf after the run was reserved
+   */
+  auto relocate(const usize l_idx, u64 &next, const u64 &end, leaf_alloc_t* alloc, std::vector<u64> &old) -> bool {
+    lock_leaf(l_idx);
+    std::vector<usize> s_leaves;
+    for(usize s_idx = table[l_idx].synonym_leaf; s_idx != 0; s_idx = SynonymTable[s_idx].synonym_leaf) s_leaves.push_back(s_idx);
+    if(next + 1 + s_leaves.size() > end) {
+      unlock_leaf(l_idx);
+      return false;
+    }
+    old.push_back(move_leaf(table[l_idx], next++, alloc));
+    for(auto s_idx : s_leaves) old.push_back(move_leaf(SynonymTable[s_idx], next++, alloc));
+    unlock_leaf(l_idx);
+    return true;
+  }
+
+  /**
+   * @brief Copy the leaf of te to the leaf id, and store the new address into te in one word
+   *
+   * @return u64 the id of the old leaf
+   */
+  auto move_leaf(TE &te, const u64 id, leaf_alloc_t* alloc) -> u64 {
+    const u64 old = leaf_id(te);
+    memcpy(alloc->get_leaf(id), alloc->get_leaf(old), sizeof(leaf_t));
+    auto [num, _s, region] = decode(id);
+    TE moved;
+    moved.val = __atomic_load_n(&te.val, __ATOMIC_RELAXED);
+    moved.leaf_num = num;
+    moved.leaf_region = region;
+    __atomic_store_n(&te.val, moved.val, __ATOMIC_RELEASE);
+    return old;
+  }
+
   // =============== functions for obtaining leaf numbers ===========================
   /**
    * @brief Get the leaf addresses of range [lo, hi]
    * 
    * @param leaves put the leaf addresses in vector 
    */
+  /**
+   * @brief The number of leaves in [lo, hi], including their synonym leaves
+   */
+  auto window_leaves(const usize lo, const usize hi) -> usize {
+    ASSERT(hi<table.size());
+    usize n = 0;
+    for(usize i=lo; i<=hi; i++) {
+      n += 1;
+      for(usize s_idx = table[i].synonym_leaf; s_idx != 0; s_idx = SynonymTable[s_idx].synonym_leaf) n += 1;
+    }
+    return n;
+  }
+
   void get_leaf_addr(const usize lo, const usize hi, std::vector<leaf_addr_t> &leaves) {
     ASSERT(hi<table.size());
     for(int i=lo; i<=hi; i++) {
@@ -473,8 +771,9 @@ struct LeafTable {
   auto serialize() -> std::string {
     std::string res;
     res += ::xstore::util::Marshal<i32>::serialize_to(table.size());
+    // a lock held on the memory node is not part of the snapshot
     for(int i=0; i<table.size(); i++)
-      res += ::xstore::util::Marshal<u64>::serialize_to(table[i].val);
+      res += ::xstore::util::Marshal<u64>::serialize_to(table[i].val & ~kTELockBit);
     for(int i=0; i<kSynonymMax; i++)
       res += ::xstore::util::Marshal<u64>::serialize_to(SynonymTable[i].val);
 
@@ -503,14 +802,14 @@ struct LeafTable {
     std::cout << "Leaves -> table.size: " << table.size() << " ; Synonym Table available: " << SynonymTable[0].leaf_num<<std::endl;
     for(int i=0; i<table.size(); i++) {
       std::cout<<"["<< table[i].leaf_num <<", "<<table[i].synonym_leaf<<", "<<table[i].leaf_region<<"] ";
-      leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(table[i].leaf_num));
+      leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(table[i])));
       leaf->print();
     }
     if(SynonymTable[0].leaf_num>1) {
       LOG(2)<<"Synonym leaves";
       for(int i=1; i<SynonymTable[0].leaf_num; i++) {
         std::cout<<"["<< SynonymTable[i].leaf_num <<", "<<SynonymTable[i].synonym_leaf<<", "<<SynonymTable[i].leaf_region<<"] ";
-        leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(SynonymTable[i].leaf_num));
+        leaf_t* leaf = reinterpret_cast<leaf_t*>(alloc->get_leaf(leaf_id(SynonymTable[i])));
         leaf->print();
       }
     }
@@ -27,17 +27,125 @@ class LearnedCache {
   using OptimalPLR = PLR<K, size_t>;
 
 private:
-  LocalConnection* LC;
+  LocalConnection* LC = nullptr;
   std::vector<K> model_keys;
   std::vector<u64> model_offs;
   std::vector<model_t> models;
+  // the leaves predicted for the in-flight requests, indexed by ReqBuf::idx
+  std::vector<std::vector<leaf_addr_t>> req_leaves;
+  usize window = 0;
+  u64 filtered = 0;      /// the lookups answered by the filters without a leaf read
+  // the buffers reading the model region, kept for refresh() as the local allocator never frees: [buf, size]
+  std::pair<char*, usize> index_bufs[4] = {};
+
+  // the layout version of the model region, see rolex_util.hh
+  u64 layout = 0;          /// the version of the submodels read
+  u64 slot = kMaxCaches;   /// the ack word of the cache, kMaxCaches if not registered
+  char* sync_buf = nullptr;
+  u64 gen = 0;             /// bumped by each refresh()
+  usize fresh = 0;         /// the in-flight requests predicted by the submodels of the last refresh()
+  usize stale = 0;         /// the in-flight requests predicted by the older submodels, whose leaves may be relocated
+  u64 reqs = 0;
+  usize model_reads = 0;   /// the async reads of the model region in flight, see LocalConnection::read_asyn
+
+  /**
+   * @brief Release the request buffers when the request finishes.
+   *          A request predicts its leaves right after it gets the buffers, so it reads the leaves of the submodels
+   *          of that time, which the memory node keeps until the cache acks the newer ones.
+   */
+  class ReqGuard {
+    LearnedCache* cache;
+    u64 gen;
+  public:
+    ReqBuf* buf;
+    ReqGuard(LearnedCache* cache, ReqBuf* buf) : cache(cache), gen(cache->gen), buf(buf) { cache->fresh++; }
+    ReqGuard(const ReqGuard&) = delete;
+    ~ReqGuard() {
+      cache->LC->release_req_buf(buf);
+      cache->finish(gen);
+    }
+  };
 
 public:
-  explicit LearnedCache(LocalConnection* LC) : LC(LC), model_keys(), model_offs(), models() {
+  static constexpr usize kMaxCoros = 64;
+  static constexpr u64 kSyncInterval = 1024;   /// the requests between two checks of the layout version
+
+  /**
+   * @param coros the maximal number of in-flight requests of the thread
+   */
+  explicit LearnedCache(LocalConnection* LC, const usize &coros = kMaxCoros) 
+      : LC(LC), model_keys(), model_offs(), models() {
+    sync_buf = LC->get_buf(sizeof(u64));
+    register_cache();
+    read_remote_index();
+    ack();
+    window = max_window(models);
+    LC->init_req_bufs(coros, max_window()*sizeof(leaf_t), sizeof(leaf_t));
+    req_leaves.resize(coros);
+    for(auto &l : req_leaves) l.reserve(max_window());
+  }
+
+  /**
+   * @brief The maximal number of leaves covered by a prediction, i.e., [pos-Epsilon, pos+Epsilon+2],
+   *          which is the largest for the submodel with the fewest KVs per leaf
+   */
+  static auto max_window(std::vector<model_t> &models) -> usize {
+    usize slots = leaf_t::max_slot();
+    for(auto &m : models) slots = std::min<usize>(slots, m.leaf_slots());
+    return (2*Epsilon + 2)/slots + 2;
+  }
+
+  auto max_window() const -> usize { return window; }
+
+  LearnedCache(const LearnedCache&) = delete;
+
+  /**
+   * @brief Free the ack word, so the memory node no longer waits for the cache
+   */
+  ~LearnedCache() {
+    if(slot == kMaxCaches) return;
+    memset(sync_buf, 0, sizeof(u64));
+    LC->write_syn(ack_off(slot), sync_buf, sizeof(u64));
+  }
+
+  /**
+   * @brief Read the submodels again if the layout version of the model region changed, e.g., the memory node
+   *          sealed new submodels, relocated their leaves or synced their filters.
+   *          Called every kSyncInterval requests, and by the thread, e.g., when it is idle.
+   *
+   * @return true if the submodels are read again
+   */
+  auto sync() -> bool {
+    if(model_reads > 0 || read_layout() == layout) return false;
+    refresh();
+    return true;
+  }
+
+  /**
+   * @brief Read the submodels from the model region again, and ack their layout version
+   *          once the requests predicted by the older submodels finish,
+   *          so the memory node reuses the leaves relocated from them.
+   *          Called by a coroutine outside a request, as the others never use the submodels across a yield.
+   */
+  void refresh() {
+    ASSERT(model_reads == 0) << "the model region is read by the other coroutines";
     read_remote_index();
-    LC->alloc_reset_for_leaf(16*sizeof(leaf_t));
+    ASSERT(max_window(models) <= window) << "the submodels predict more leaves than the request buffers hold";
+    stale += fresh;
+    fresh = 0;
+    gen++;
+    if(stale == 0) ack();
   }
 
+  auto layout_version() const -> u64 { return layout; }
+
+  /**
+   * @brief The lookups of the absent keys answered by the filters, each with an 8-byte read of the filter version
+   *          instead of the leaves. A filter answers only if no key is added to its submodel since it was written,
+   *          so it never reports an inserted key absent.
+   */
+  auto filtered_lookups() const -> u64 { return filtered; }
+
   // synchronize models from memory nodes
   explicit LearnedCache(const std::string_view& seria) : model_keys(), models() {
     ASSERT(seria.size() > sizeof(i32));
@@ -68,17 +176,26 @@ public:
    */
   template<typename rc_t>
   auto search(const K &key, V &val, rc_t& data_rc, char *local_data_buf) -> bool {
+    const auto model_idx = model_for_key(key);
+    auto &model = models[model_idx];
+    if(!model.filter_may_contain(key)) {
+      LC->read_syn(model_offs[model_idx] - sizeof(u64), local_data_buf, sizeof(u64));
+      if(filter_current(model, local_data_buf)) {
+        filtered++;
+        return false;
+      }
+    }
     std::vector<leaf_addr_t> leaves;
-    models[model_for_key(key)].get_leaf_addr(key, leaves);
+    auto hint = model.get_leaf_addr(key, leaves);
     Op<> leaf_op;
     for(int i=leaves.size()-1; i>=0; i--) {
-      leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num), data_rc->remote_mr.value())
+      leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num), leaf_mr(leaves[i].addr, data_rc))
              .set_read()
              .set_payload(local_data_buf, sizeof(leaf_t), data_rc->local_mr.value().lkey);
       RDMA_ASSERT(leaf_op.execute(data_rc, IBV_SEND_SIGNALED) == IOCode::Ok);
       RDMA_ASSERT(data_rc->wait_one_comp() == IOCode::Ok);
       leaf_t* leaf = reinterpret_cast<leaf_t*>(local_data_buf);
-      if(leaf->search(key, val)) return true;
+      if(leaf->search(key, val, hint.at(leaves[i].off))) return true;
     }
     return false;
   }
@@ -87,24 +204,36 @@ public:
     std::vector<leaf_addr_t> leaves;
     models[model_for_key(key)].get_leaf_addr(key, leaves);
     // read remote leaves
-    auto leaf_buf = LC->get_leaf_buf();
     
     
     return false;
   }
 
   auto search_asyn(const K &key, V &val, R2_ASYNC) -> bool {
-    // get addr
+    ReqGuard req(this, acquire_req_buf(R2_ASYNC_WAIT));
     auto model_idx = model_for_key(key);
-    std::vector<leaf_addr_t> leaves;
-    models[model_idx].get_leaf_addr(key, leaves);
+    if(!models[model_idx].filter_may_contain(key)) {
+      // the submodels are not refreshed during the read
+      model_reads++;
+      LC->read_asyn(model_offs[model_idx] - sizeof(u64), req.buf->val, sizeof(u64), R2_ASYNC_WAIT);
+      model_reads--;
+      if(filter_current(models[model_idx], req.buf->val)) {
+        filtered++;
+        return false;
+      }
+    }
+    auto leaf_buf = req.buf->leaves;
+    // get addr, by the submodels of the time the buffers are acquired
+    auto &leaves = req_leaves[req.buf->idx];
+    leaves.clear();
+    auto hint = models[model_idx].get_leaf_addr(key, leaves);
+    ASSERT(leaves.size() <= max_window());
     // read remote leaves
-    auto leaf_buf = LC->get_leaf_buf();
     LC->read_leaves_asyn(leaves, leaf_buf, sizeof(leaf_t), R2_ASYNC_WAIT);
     // search the leaves
     for(int i=0; i<leaves.size(); i++) {
       leaf_t* leaf = reinterpret_cast<leaf_t*>(leaf_buf+i*sizeof(leaf_t));
-      if(leaf->search(key, val)) return true;
+      if(leaf->search(key, val, hint.at(leaves[i].off))) return true;
     }
     return false;
   }
@@ -119,7 +248,7 @@ public:
     // 2. read leaves from memory node
     Op<> leaf_op;
     for(int i=leaves.size()-1; i>=0; i--) {
-      leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num), data_rc->remote_mr.value())
+      leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num), leaf_mr(leaves[i].addr, data_rc))
              .set_read()
              .set_payload(local_data_buf, sizeof(leaf_t), data_rc->local_mr.value().lkey);
       RDMA_ASSERT(leaf_op.execute(data_rc, IBV_SEND_SIGNALED) == IOCode::Ok);
@@ -130,14 +259,17 @@ public:
       if(leaf->insertHere(key)) {
         // 3.1 lock, fixme: use remote lock
         
-        // insert and write back
-        if(!leaf->isfull()) {
-          leaf->insert_not_full(key, val);
-          leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num), data_rc->remote_mr.value())
-                 .set_write()
-                 .set_payload(local_data_buf, sizeof(leaf_t), data_rc->local_mr.value().lkey);
-          RDMA_ASSERT(leaf_op.execute(data_rc, IBV_SEND_SIGNALED) == IOCode::Ok);
-          RDMA_ASSERT(data_rc->wait_one_comp() == IOCode::Ok);
+        if(leaf->contain(key)) return false;
+        // insert and write back the bytes changed by the insertion
+        if(leaf->accepts(key)) {
+          auto pos = leaf->insert_not_full(key, val);
+          for(auto &e : leaf_t::insert_extents(pos)) {
+            leaf_op.set_rdma_addr(remote_leaf_offsets(leaves[i].addr.leaf_num) + e.first, leaf_mr(leaves[i].addr, data_rc))
+                   .set_write()
+                   .set_payload(local_data_buf + e.first, e.second, data_rc->local_mr.value().lkey);
+            RDMA_ASSERT(leaf_op.execute(data_rc, IBV_SEND_SIGNALED) == IOCode::Ok);
+            RDMA_ASSERT(data_rc->wait_one_comp() == IOCode::Ok);
+          }
           return true;
         }
         
@@ -160,13 +292,16 @@ public:
   }
 
   auto insert_asyn(const K &key, const V &val, R2_ASYNC) -> bool {
+    ReqGuard req(this, acquire_req_buf(R2_ASYNC_WAIT));
+    auto leaf_buf = req.buf->leaves;
     // 1. obtain remote addresses of leaves
     auto model_idx = model_for_key(key);
-    std::vector<leaf_addr_t> leaves;
+    auto &leaves = req_leaves[req.buf->idx];
+    leaves.clear();
     models[model_idx].get_leaf_addr(key, leaves);
+    ASSERT(leaves.size() <= max_window());
 
     // 2. read leaves from memory node
-    auto leaf_buf = LC->get_leaf_buf();
     LC->read_leaves_asyn(leaves, leaf_buf, sizeof(leaf_t), R2_ASYNC_WAIT);
 
     // 3. lock, insert and write the leaf
@@ -194,18 +329,95 @@ public:
   }
 
 private:
-  auto read_remote_index() {
+  /**
+   * @brief Yield to the other coroutines until one of them releases its buffers
+   */
+  auto acquire_req_buf(R2_ASYNC) -> ReqBuf* {
+    auto buf = LC->acquire_req_buf();
+    while(buf == nullptr) {
+      R2_YIELD;
+      buf = LC->acquire_req_buf();
+    }
+    if(++reqs % kSyncInterval == 0) sync();
+    return buf;
+  }
+
+  /**
+   * @brief A request predicted by the submodels of generation g finishes
+   */
+  void finish(const u64 &g) {
+    if(g == gen) {
+      fresh--;
+    } else if(--stale == 0) {
+      ack();
+    }
+  }
+
+  /**
+   * @brief Claim a free ack word in the model region, before reading the submodels,
+   *          so the memory node keeps the leaves they reference from then on
+   */
+  void register_cache() {
+    for(slot=0; slot<kMaxCaches; slot++) {
+      if(LC->cas_syn(sync_buf, 0, kNoLayout, ack_off(slot))) return;
+    }
+    ASSERT(false) << "more than " << kMaxCaches << " caches on the memory node";
+  }
+
+  auto read_layout() -> u64 {
+    LC->read_syn(kLayoutOff, sync_buf, sizeof(u64));
+    u64 res;
+    memcpy(&res, sync_buf, sizeof(u64));
+    return res;
+  }
+
+  /**
+   * @brief Tell the memory node that no request reads the leaves of the submodels older than layout
+   */
+  void ack() {
+    memcpy(sync_buf, &layout, sizeof(u64));
+    LC->write_syn(ack_off(slot), sync_buf, sizeof(u64));
+  }
+
+  /**
+   * @brief The i-th buffer reading the model region, of at least sz bytes
+   */
+  auto index_buf(const usize &i, const usize &sz) -> char* {
+    auto &b = index_bufs[i];
+    if(b.second < sz) b = {LC->get_buf(sz), sz};
+    return b.first;
+  }
+
+  /**
+   * @brief Read the submodels of one layout version, again if the memory node rewrites them meanwhile
+   */
+  void read_remote_index() {
     ASSERT(LC) << "LocalConnection is nullptr.";
+    while(true) {
+      const u64 v = read_layout();
+      if(v % 2 != 0) continue;
+      model_keys.clear();
+      model_offs.clear();
+      models.clear();
+      read_models();
+      if(read_layout() == v) {
+        layout = v;
+        return;
+      }
+    }
+  }
+
+  void read_models() {
     // read the number of remote models
-    auto model_size_buf = LC->get_buf(sizeof(u64));
+    auto model_size_buf = index_buf(0, kSubmodelHeader + sizeof(i32));
     LC->read_syn(0, model_size_buf, sizeof(u64));
     u64 total_size;
     memcpy(&total_size, model_size_buf, sizeof(u64));
     LOG(4) << "Read the number of remote models: "<<total_size;
 
     // read model keys/offs
-    auto model_keys_buf = LC->get_buf(sizeof(K)*total_size);
-    auto model_offs_buf = LC->get_buf(sizeof(u64)*total_size);
+    auto model_keys_buf = index_buf(1, sizeof(K)*total_size);
+    auto model_offs_buf = index_buf(2, sizeof(u64)*total_size);
     LC->read_syn(sizeof(u64), model_keys_buf, sizeof(K)*total_size);
     LC->read_syn(kUpperModel/2, model_offs_buf, sizeof(u64)*total_size);
     for(int i=0; i<total_size; i++) {
@@ -218,26 +430,34 @@ private:
     }
 
     // read submodels
-    char *model_buf;
-    i32 model_buf_size = 0;
     for(int i=0; i<total_size; i++) {
+      // [synced filter version | live filter version | size], the bits read next have every key added before synced
+      u64 synced;
       i32 cur_ms;
-      LC->read_syn(model_offs[i], model_size_buf, sizeof(i32));
-      memcpy(&cur_ms, model_size_buf, sizeof(i32));
+      LC->read_syn(model_offs[i] - kSubmodelHeader, model_size_buf, kSubmodelHeader + sizeof(i32));
+      memcpy(&synced, model_size_buf, sizeof(u64));
+      memcpy(&cur_ms, model_size_buf + kSubmodelHeader, sizeof(i32));
       // LOG(2)<<"Model "<<i<<" size: "<<cur_ms<<", offset: "<<model_offs[i];
 
-      if(model_buf_size < cur_ms) {
-        model_buf_size = cur_ms;
-        model_buf = LC->get_buf(model_buf_size);
-      }
+      auto model_buf = index_buf(3, cur_ms);
       // read model
       LC->read_syn(model_offs[i]+sizeof(i32), model_buf, cur_ms);
       std::string rSeria(model_buf, cur_ms);
       model_t model(rSeria);
+      model.set_filter_version(nullptr, synced);
       models.emplace_back(model);
     }
   }
 
+  /**
+   * @param live the live version of the filter read from the model region
+   */
+  static auto filter_current(const model_t &model, const char *live) -> bool {
+    u64 v;
+    memcpy(&v, live, sizeof(u64));
+    return v == model.filter_version();
+  }
+
   auto model_for_key(const K &key) -> usize {
     auto idx = binary_search_branchless(&model_keys[0], model_keys.size(), key);
     return idx<models.size()? idx:(models.size()-1);
@@ -245,6 +465,12 @@ private:
 
   inline auto remote_leaf_offsets(u64 num) -> u64 { return sizeof(u64)*2 + num*sizeof(leaf_t); }
 
+  // the leaf regions other than 0 are fetched by the local connection
+  template<typename rc_t>
+  auto leaf_mr(const TE &addr, rc_t& data_rc) -> rmem::RegAttr {
+    return addr.leaf_region == 0 ? data_rc->remote_mr.value() : LC->leaf_mr(addr.leaf_region);
+  }
+
 };
 
 
@@ -1,7 +1,10 @@
 #pragma once 
 
+#include <vector>
+
 #include "rlib/core/rmem/handler.hh"
 #include "rlib/core/common.hh"
+#include "r2/src/common.hh"
 
 
 
@@ -11,6 +14,17 @@ using namespace rdmaio::rmem;
 namespace rolex {
 
 
+/**
+ * @brief The registered buffers of one in-flight request
+ */
+struct ReqBuf {
+  char* leaves = nullptr;   /// the leaves read in one window
+  char* lock = nullptr;     /// the old value returned by the atomics on a lock word
+  char* val = nullptr;      /// the value or the leaf written back
+  u32 idx = 0;              /// the index in the pool, used to attach other per-request states
+};
+
+
 class LocalAllocator {
 
 private:
@@ -21,35 +35,65 @@ private:
 
   usize cur_alloc_off = 0;
 
-  // preserve for leaf reading
-  usize leaf_buf_off = 0;
+  // the request buffers, recycled among the coroutines of the thread
+  std::vector<ReqBuf> req_bufs;
+  std::vector<ReqBuf*> free_req_bufs;
 
 public:
+  static constexpr usize kBufAlign = 64;
+
   LocalAllocator(rdmaio::Arc<RMem> mem, const RegAttr &mr)
-      : buf(mem->raw_ptr), total_mem(mem->sz), mr(mr), key(mr.key), cur_alloc_off(0) {
+      : buf(mem->raw_ptr), total_mem(mem->sz), key(mr.key), mr(mr), cur_alloc_off(0) {
     // RDMA_LOG(4) << "simple allocator use key: " << key;
   }
 
-  void reset_for_leaf(const usize leaf_buf_size) {
-    leaf_buf_off = 0;
-    cur_alloc_off = leaf_buf_size;
+  /**
+   * @brief Carve num request buffers from the registered memory,
+   *          so that acquiring and releasing them never allocates.
+   * 
+   * @param leaf_sz the bytes of the largest read window
+   * @param val_sz the bytes of the value (or leaf) written back
+   */
+  void init_req_bufs(const usize &num, const usize &leaf_sz, const usize &val_sz) {
+    ASSERT(req_bufs.empty()) << "The request buffers are initialized twice.";
+    req_bufs.resize(num);
+    free_req_bufs.reserve(num);
+    for(usize i=0; i<num; i++) {
+      auto &b = req_bufs[i];
+      b.leaves = static_cast<char *>(alloc(leaf_sz, kBufAlign));
+      b.lock = static_cast<char *>(alloc(sizeof(u64), kBufAlign));
+      b.val = static_cast<char *>(alloc(val_sz, kBufAlign));
+      b.idx = i;
+    }
+    // hand out the buffers in order
+    for(usize i=num; i>0; i--) free_req_bufs.push_back(&req_bufs[i-1]);
   }
 
-  auto get_leaf_buf() -> rmem::RMem::raw_ptr_t { 
-    return static_cast<char *>(buf) + leaf_buf_off;
+  /**
+   * @return nullptr if all the buffers are in flight
+   */
+  auto acquire_req_buf() -> ReqBuf* {
+    if(free_req_bufs.empty()) return nullptr;
+    auto b = free_req_bufs.back();
+    free_req_bufs.pop_back();
+    return b;
   }
 
-  auto alloc(const usize &sz) -> rmem::RMem::raw_ptr_t {
-    if(cur_alloc_off+sz > total_mem) {
+  void release_req_buf(ReqBuf* b) { free_req_bufs.push_back(b); }
+
+  auto req_buf_num() const -> usize { return req_bufs.size(); }
+
+  auto alloc(const usize &sz, const usize &align = sizeof(u64)) -> rmem::RMem::raw_ptr_t {
+    auto base = reinterpret_cast<uintptr_t>(buf);
+    auto off = (base + cur_alloc_off + align - 1) / align * align - base;
+    if(off+sz > total_mem) {
       ASSERT(false) << "Local Allocator too small.";
     }
-    auto ret = static_cast<char *>(buf) + cur_alloc_off;
-    cur_alloc_off += sz;
+    auto ret = static_cast<char *>(buf) + off;
+    cur_alloc_off = off + sz;
     return ret;
   }
 
-  
-
 };
 
 
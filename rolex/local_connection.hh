@@ -53,11 +53,17 @@ public:
     return reinterpret_cast<char*>(localAlloc->alloc(sz));
   }
 
-  auto get_leaf_buf() -> char* {
-    return reinterpret_cast<char*>(localAlloc->get_leaf_buf());
+  /**
+   * @brief Each coroutine acquires its own request buffers, and releases them after the request.
+   *          The buffers are carved once, so the hot path never allocates.
+   */
+  void init_req_bufs(const usize &num, const usize &leaf_sz, const usize &val_sz) {
+    localAlloc->init_req_bufs(num, leaf_sz, val_sz);
   }
 
-  void alloc_reset_for_leaf(const usize sz) { localAlloc->reset_for_leaf(sz); }
+  auto acquire_req_buf() -> ReqBuf* { return localAlloc->acquire_req_buf(); }
+
+  void release_req_buf(ReqBuf* b) { localAlloc->release_req_buf(b); }
 
   // ============ functions for remote read ===================
   // using for model_rc
@@ -70,17 +76,82 @@ public:
     ASSERT(model_rc->wait_one_comp() == IOCode::Ok);
   }
 
-  // using for data_rc
-  void read_leaves_asyn(std::vector<leaf_addr_t> leaves, char *local_buf, const u32 &each_len, R2_ASYNC) {
+  /**
+   * @brief Read the model region, yielding to the other coroutines until the read completes.
+   *          A read_syn meanwhile would take its completion, so it waits for the async reads to finish.
+   */
+  void read_asyn(const u64 &remote_off, char *local_buf, const u32 &length, R2_ASYNC) {
     AsyncOp<1> op;
     op.set_read()
-      .set_rdma_addr(sizeof(u64)*2 + leaves[0].addr.leaf_num*each_len, data_rc->remote_mr.value())
-      .set_payload(
-        local_buf, each_len, data_rc->local_mr.value().lkey);
-    auto ret = op.execute_async(data_rc, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
+      .set_rdma_addr(remote_off, model_rc->remote_mr.value())
+      .set_payload(local_buf, length, model_rc->local_mr.value().lkey);
+    auto ret = op.execute_async(model_rc, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
     ASSERT(ret == ::rdmaio::IOCode::Ok);
   }
 
+  void write_syn(const u64 &remote_off, char *local_buf, const u32 &length) {
+    Op<> op;
+    op.set_rdma_addr(remote_off, model_rc->remote_mr.value())
+      .set_write()
+      .set_payload(local_buf, length, model_rc->local_mr.value().lkey);
+    ASSERT(op.execute(model_rc, IBV_SEND_SIGNALED) == IOCode::Ok);
+    ASSERT(model_rc->wait_one_comp() == IOCode::Ok);
+  }
+
+  /**
+   * @brief CAS the word at remote_off of the model region, e.g., to claim an ack word
+   */
+  bool cas_syn(char *local_buf, uint64_t equal, uint64_t val, u64 remote_off) {
+    Op<> atomic_op;
+    auto rbuf = reinterpret_cast<char *>(model_rc->remote_mr.value().buf) + remote_off;
+    atomic_op.set_atomic_rbuf(reinterpret_cast<u64 *>(rbuf), model_rc->remote_mr.value().key)
+             .set_cas(equal, val)
+             .set_payload(local_buf, sizeof(u64), model_rc->local_mr.value().lkey);
+    ASSERT(atomic_op.execute(model_rc, IBV_SEND_SIGNALED) == ::rdmaio::IOCode::Ok);
+    ASSERT(model_rc->wait_one_comp() == IOCode::Ok);
+    return equal == ::xstore::util::Marshal<u64>::deserialize(local_buf, sizeof(u64));
+  }
+
+  /**
+   * @brief The descriptor of leaf region i, which is registered as reg_leaf_region + i at the memory node.
+   *          The regions are fetched on first access, since the memory node adds regions on demand.
+   */
+  auto leaf_mr(const u64 &region) -> rmem::RegAttr {
+    if(region == 0) return data_rc->remote_mr.value();
+    if(leaf_mrs.size() <= region) leaf_mrs.resize(region + 1);
+    if(!leaf_mrs[region]) {
+      auto fetch_res = _cm->fetch_remote_mr(conf.reg_leaf_region + region);
+      RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+      leaf_mrs[region] = std::get<1>(fetch_res.desc);
+    }
+    return leaf_mrs[region].value();
+  }
+
+  /**
+   * @brief Read the leaves into the consecutive slots of local_buf.
+   *          The leaves with consecutive numbers in a region, e.g., of a defragmented submodel,
+   *          are read with one RDMA read into their consecutive slots.
+   *          Only the last read is signaled: an RC completes the reads in order,
+   *          so the coroutine yields once for all the leaves.
+   */
+  void read_leaves_asyn(const std::vector<leaf_addr_t> &leaves, char *local_buf, const u32 &each_len, R2_ASYNC) {
+    ASSERT(!leaves.empty());
+    AsyncOp<1> op;
+    for(usize i=0; i<leaves.size();) {
+      usize n = 1;
+      while(i+n < leaves.size() && leaves[i+n].addr.leaf_region == leaves[i].addr.leaf_region
+            && leaves[i+n].addr.leaf_num == leaves[i].addr.leaf_num + n) n++;
+      op.set_read()
+        .set_rdma_addr(sizeof(u64)*2 + leaves[i].addr.leaf_num*each_len, leaf_mr(leaves[i].addr.leaf_region))
+        .set_payload(
+          local_buf + i*each_len, n*each_len, data_rc->local_mr.value().lkey);
+      i += n;
+      auto flags = i == leaves.size()? IBV_SEND_SIGNALED : 0;
+      auto ret = op.execute_async(data_rc, flags, R2_ASYNC_WAIT);
+      ASSERT(ret == ::rdmaio::IOCode::Ok);
+    }
+  }
+
   void read_leaves_syn(std::vector<leaf_addr_t> leaves, char *local_buf, const u32 &each_len) {
     
   }
@@ -109,6 +180,7 @@ private:
   ConnectManager* _cm;
   std::shared_ptr<RC> model_rc;
   std::shared_ptr<RC> data_rc;
+  std::vector<::rdmaio::Option<rmem::RegAttr>> leaf_mrs;
 
   void local_memory_allocator() {
     auto mem_region1 = rolex::HugeRegion::create(conf.alloc_mem_size).value();
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <iostream>
+#include <limits>
 #include <optional>
 
 #include "r2/src/common.hh"
+#include "xutils/spin_lock.hh"
 #include "rolex_util.hh"
 
 using namespace r2;
@@ -19,6 +21,7 @@ class ModelAllocator{
   u64 cur_alloc_sz = kUpperModel;          /// the size that has been allocated
   u64 upper_alloc_num = 0;                 /// the number of upper models
   u64 max_upper_num = 0;
+  ::xstore::util::SpinLock update_lock;    /// serialize the writers of the layout version
 public:
 
   /**
@@ -28,12 +31,15 @@ public:
    * @param t the total size of the pool
    */
   explicit ModelAllocator(char *m, const u64 &t) : mem_pool(m), total_sz(t) {
-    ASSERT(total_sz > kUpperModel) << "Too small size to store models!";
-    cur_alloc_sz = kUpperModel;
+    ASSERT(total_sz > kUpperModel + kLayoutSz) << "Too small size to store models!";
+    cur_alloc_sz = kUpperModel + kLayoutSz;
     // preserve the first 8byte to indicate how many models are stored
     u64 cur_num = 0;
     memcpy(mem_pool, &cur_num, sizeof(u64));
     upper_alloc_num = 0;
+    // no compute node is registered
+    memset(mem_pool + kLayoutOff, 0, kLayoutSz);
+    *layout_ptr() = kFirstLayout;
 
     max_upper_num = std::min((kUpperModel/2-sizeof(u64))/sizeof(K), kUpperModel/2/sizeof(u64));
   }
@@ -55,22 +61,32 @@ public:
   }
 
   /**
-   * @brief provide an offset for the submodel
+   * @brief provide an offset for the submodel, after its filter versions which start at 0
    * 
    * @return <ptr, offset> of submodel
    */
   auto alloc_submodel(usize alloc_size) -> std::pair<char*, u64> {
-    if (cur_alloc_sz + alloc_size > total_sz) {
+    const u64 sz = kSubmodelHeader + (alloc_size + sizeof(u64) - 1) / sizeof(u64) * sizeof(u64);
+    if (cur_alloc_sz + sz > total_sz) {
       ASSERT(false) << "Too small size to store submodels!";
     }
-    auto res = cur_alloc_sz;
-    cur_alloc_sz += alloc_size;
+    auto res = cur_alloc_sz + kSubmodelHeader;
+    memset(mem_pool+cur_alloc_sz, 0, kSubmodelHeader);
+    cur_alloc_sz += sz;
     return std::make_pair(mem_pool+res, res);
   }
 
   // =============== functions to access upper/sub models ==============
   auto get_total_ptr() -> char* { return mem_pool; }
 
+  /**
+   * @brief The bytes of the upper and sub models, which the compute nodes fetch,
+   *          not counting the unused part of the upper model area
+   */
+  auto used_sz() const -> u64 {
+    return sizeof(u64) + upper_alloc_num*(sizeof(K)+sizeof(u64)) + cur_alloc_sz - kUpperModel - kLayoutSz;
+  }
+
   /**
    * @return <key, off> ptrs of the upper model
    */
@@ -83,6 +99,61 @@ public:
     return mem_pool+off;
   }
 
+  /**
+   * @return <synced, live> ptrs of the filter versions of the submodel at off
+   */
+  auto get_filter_versions(u64 off) -> std::pair<u64 *, u64 *> {
+    return std::make_pair(reinterpret_cast<u64 *>(mem_pool+off-kSubmodelHeader),
+                          reinterpret_cast<u64 *>(mem_pool+off-sizeof(u64)));
+  }
+
+  // =============== functions for the layout version ==============
+  /**
+   * @brief Start rewriting the submodels in the model region, e.g., their leaf addresses.
+   *          The version is odd until end_update(), so a compute node reading the model region meanwhile
+   *          reads it again; the writers are serialized.
+   */
+  void begin_update() {
+    update_lock.lock();
+    __atomic_store_n(layout_ptr(), layout() + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+
+  /**
+   * @return u64 the new layout version, which a compute node acks once it reads the submodels written
+   */
+  auto end_update() -> u64 {
+    const u64 res = layout() + 1;
+    __atomic_store_n(layout_ptr(), res, __ATOMIC_RELEASE);
+    update_lock.unlock();
+    return res;
+  }
+
+  auto layout() -> u64 { return __atomic_load_n(layout_ptr(), __ATOMIC_ACQUIRE); }
+
+  /**
+   * @brief The layout version acked by every registered compute node, i.e., none of them reads an older one;
+   *          the maximum if no compute node is registered
+   */
+  auto acked_layout() -> u64 {
+    u64 res = std::numeric_limits<u64>::max();
+    for(u64 i=0; i<kMaxCaches; i++) {
+      const u64 ack = __atomic_load_n(get_ack_ptr(i), __ATOMIC_ACQUIRE);
+      if(ack != 0) res = std::min(res, ack);
+    }
+    return res;
+  }
+
+  /**
+   * @brief The ack word of the i-th compute node, which it writes with one-sided RDMA
+   */
+  auto get_ack_ptr(const u64 &i) -> u64 * {
+    return reinterpret_cast<u64 *>(mem_pool + ack_off(i));
+  }
+
+private:
+  inline auto layout_ptr() -> u64 * { return reinterpret_cast<u64 *>(mem_pool + kLayoutOff); }
+
 };
 
 
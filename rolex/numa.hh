@@ -0,0 +1,193 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "r2/src/common.hh"
+
+using namespace r2;
+
+
+namespace rolex {
+
+namespace numa {
+
+/*!
+  NUMA helpers for the memory nodes, via the raw syscalls so that no libnuma is needed.
+  - Placement: where the pages of a region live, applied before the pages are faulted in
+  - Pinning: bind a thread to the cores of a node
+  - Stats: sample the node of the accessed leaves (compiled with ROLEX_NUMA_STATS)
+ */
+enum Placement : u8 {
+  Default = 0,    /// the first-touch policy of the kernel
+  Interleave = 1, /// interleave the pages over all nodes
+  Partition = 2,  /// split the region into contiguous ranges, one per node
+  Local = 3,      /// bind the region to one node, e.g., the node of the NIC
+};
+
+// from <numaif.h>
+constexpr int kMpolBind = 2;
+constexpr int kMpolInterleave = 3;
+constexpr int kMpolFNode = 1 << 0;
+constexpr int kMpolFAddr = 1 << 1;
+constexpr usize kMaxNodes = 64;
+
+/*!
+  Parse a sysfs list, e.g., "0-3,8-11"
+ */
+inline auto parse_list(const std::string &s) -> std::vector<int> {
+  std::vector<int> res;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty() || item == "\n")
+      continue;
+    auto dash = item.find('-');
+    int lo = std::stoi(item.substr(0, dash));
+    int hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+    for (int i = lo; i <= hi; ++i)
+      res.push_back(i);
+  }
+  return res;
+}
+
+inline auto read_sysfs(const std::string &path) -> std::string {
+  std::ifstream f(path);
+  std::string s;
+  std::getline(f, s);
+  return s;
+}
+
+inline auto num_nodes() -> usize {
+  auto nodes = parse_list(read_sysfs("/sys/devices/system/node/online"));
+  return nodes.empty() ? 1 : nodes.back() + 1;
+}
+
+inline auto cpus_of_node(const int &node) -> std::vector<int> {
+  return parse_list(
+      read_sysfs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+/*!
+  \ret the node of the NIC, or 0 if unknown
+ */
+inline auto node_of_nic(const std::string &dev_name) -> int {
+  auto s = read_sysfs("/sys/class/infiniband/" + dev_name + "/device/numa_node");
+  if (s.empty())
+    return 0;
+  auto node = std::stoi(s);
+  return node < 0 ? 0 : node;
+}
+
+inline auto mbind_nodes(void *addr, const u64 &sz, const int &mode,
+                        const std::vector<int> &nodes) -> bool {
+  u64 mask = 0;
+  for (auto n : nodes) {
+    ASSERT(static_cast<usize>(n) < kMaxNodes);
+    mask |= 1UL << n;
+  }
+  return syscall(SYS_mbind, addr, sz, mode, &mask, kMaxNodes, 0) == 0;
+}
+
+/*!
+  Set the policy of [addr, addr + sz), which should be aligned to the page size.
+  The policy only applies to the pages not faulted in yet.
+ */
+inline auto place(char *addr, const u64 &sz, const Placement &p,
+                  const int &local_node = 0, const u64 &align = 4096) -> bool {
+  const int n = num_nodes();
+  switch (p) {
+  case Interleave: {
+    std::vector<int> nodes;
+    for (int i = 0; i < n; ++i)
+      nodes.push_back(i);
+    return mbind_nodes(addr, sz, kMpolInterleave, nodes);
+  }
+  case Partition: {
+    auto part = (sz / n + align - 1) / align * align;
+    for (int i = 0; i < n && i * part < sz; ++i) {
+      if (!mbind_nodes(addr + i * part, std::min(part, sz - i * part), kMpolBind, {i}))
+        return false;
+    }
+    return true;
+  }
+  case Local:
+    return mbind_nodes(addr, sz, kMpolBind, {local_node});
+  default:
+    return true;
+  }
+}
+
+/*!
+  \ret the node of the page at addr (the page is faulted in if needed), or -1 on errors
+ */
+inline auto node_of_addr(void *addr) -> int {
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, kMpolFNode | kMpolFAddr) != 0)
+    return -1;
+  return node;
+}
+
+inline auto cur_node() -> int {
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return 0;
+  return node;
+}
+
+/*!
+  Pin the calling thread to the idx-th core (round-robin) of the node
+ */
+inline auto pin_to_node(const int &node, const usize &idx) -> bool {
+  auto cpus = cpus_of_node(node);
+  if (cpus.empty())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[idx % cpus.size()], &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/*!
+  The sampled accesses of the leaves, and the ones that cross the interconnect
+ */
+struct AccessStats {
+  static constexpr u64 kSampleMask = 1023;
+
+  std::atomic<u64> sampled{0};
+  std::atomic<u64> remote{0};
+
+  static auto global() -> AccessStats & {
+    static AccessStats stats;
+    return stats;
+  }
+
+  inline void record(void *addr) {
+    static thread_local u64 counter = 0;
+    if ((++counter & kSampleMask) != 0)
+      return;
+    auto node = node_of_addr(addr);
+    if (node < 0)
+      return;
+    sampled.fetch_add(1, std::memory_order_relaxed);
+    if (node != cur_node())
+      remote.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  auto remote_ratio() const -> double {
+    auto s = sampled.load();
+    return s == 0 ? 0 : static_cast<double>(remote.load()) / s;
+  }
+};
+
+} // namespace numa
+
+} // namespace rolex
@@ -18,23 +18,34 @@ using LargeSigned = typename std::conditional_t<std::is_floating_point_v<T>,
                                                 long double,
                                                 std::conditional_t<(sizeof(T) < 8), int64_t, __int128>>;
 
-template<typename X, typename Y>
+/**
+ * @tparam kFast for 64-bit integral X and Y, compute the hull of a segment in 64 bits
+ *                  while its products provably fit, and in LargeSigned (__int128) afterwards
+ */
+template<typename X, typename Y, bool kFast = true>
 class PLR{
 private:
   using SX = LargeSigned<X>;
   using SY = LargeSigned<Y>;
 
-  struct Slope {
-    SX dx{};
-    SY dy{};
+  static constexpr bool kNarrow = kFast && std::is_integral_v<X> && std::is_integral_v<Y>
+                                  && sizeof(X) == 8 && sizeof(Y) == 8;
 
-    bool operator<(const Slope &p) const { return dy * p.dx < dx * p.dy; }
-    bool operator>(const Slope &p) const { return dy * p.dx > dx * p.dy; }
-    bool operator==(const Slope &p) const { return dy * p.dx == dx * p.dy; }
-    bool operator!=(const Slope &p) const { return dy * p.dx != dx * p.dy; }
+  template<typename DX, typename DY>
+  struct SlopeT {
+    DX dx{};
+    DY dy{};
+
+    bool operator<(const SlopeT &p) const { return dy * p.dx < dx * p.dy; }
+    bool operator>(const SlopeT &p) const { return dy * p.dx > dx * p.dy; }
+    bool operator==(const SlopeT &p) const { return dy * p.dx == dx * p.dy; }
+    bool operator!=(const SlopeT &p) const { return dy * p.dx != dx * p.dy; }
     explicit operator long double() const { return dy / (long double) dx; }
   };
 
+  using Slope = SlopeT<SX, SY>;
+  using NarrowSlope = SlopeT<int64_t, int64_t>;
+
   struct Point {
     X x{};
     Y y{};
@@ -42,32 +53,83 @@ private:
     Slope operator-(const Point &p) const { return {SX(x) - p.x, SY(y) - p.y}; }
   };
 
+public:
+  /**
+   * @brief The storage of the hulls, which keeps its capacity across segments,
+   *          so it grows to the largest hull seen instead of being reserved for the worst case.
+   *          An arena can be shared by the PLRs used one after another, e.g., of a training thread.
+   */
+  class Arena {
+    friend class PLR;
+    std::vector<Point> lower;
+    std::vector<Point> upper;
+
+  public:
+    auto capacity() const -> size_t { return lower.capacity() + upper.capacity(); }
+
+    void release() {
+      std::vector<Point>().swap(lower);
+      std::vector<Point>().swap(upper);
+    }
+  };
+
+private:
   const Y epsilon;
-  std::vector<Point> lower;
-  std::vector<Point> upper;
+  Arena own;
+  std::vector<Point> &lower;
+  std::vector<Point> &upper;
   X first_x = 0;
   X last_x = 0;
+  Y lo_y = 0;
+  Y hi_y = 0;
+  bool narrow = kNarrow;
   size_t lower_start = 0;
   size_t upper_start = 0;
   size_t points_in_hull = 0;
   Point rectangle[4];
 
+  template<typename S>
+  static auto delta(const Point &a, const Point &b) -> S {
+    if constexpr (std::is_same_v<S, NarrowSlope>)
+      return {int64_t(uint64_t(a.x) - uint64_t(b.x)), int64_t(uint64_t(a.y) - uint64_t(b.y))};
+    else
+      return a - b;
+  }
+
+  template<typename S>
   auto cross(const Point &O, const Point &A, const Point &B) const {
-    auto OA = A - O;
-    auto OB = B - O;
+    auto OA = delta<S>(A, O);
+    auto OB = delta<S>(B, O);
     return OA.dx * OB.dy - OA.dy * OB.dx;
   }
 
+  /**
+   * Any delta of the segment is bounded by (last_x - first_x, hi_y - lo_y),
+   * so the slope comparisons and the cross products (a difference of two products)
+   * fit in 64 bits if twice the product of the two ranges does.
+   */
+  auto fits_narrow() const -> bool {
+    auto rx = uint64_t(last_x) - uint64_t(first_x);
+    auto ry = uint64_t(hi_y) - uint64_t(lo_y);
+    uint64_t prod;
+    return !__builtin_mul_overflow(rx, ry, &prod) && prod <= uint64_t(std::numeric_limits<int64_t>::max()) / 2;
+  }
+
 public:
   class CanonicalSegment;
 
-  explicit PLR(Y epsilon) : epsilon(epsilon), lower(), upper() {
+  /**
+   * @param arena the hull storage, or nullptr to use the PLR's own
+   */
+  explicit PLR(Y epsilon, Arena* arena = nullptr)
+      : epsilon(epsilon), own(), lower(arena ? arena->lower : own.lower), upper(arena ? arena->upper : own.upper) {
     if (epsilon < 0)
       throw std::invalid_argument("epsilon cannot be negative");
-    upper.reserve(1u << 16);
-    lower.reserve(1u << 16);
   }
 
+  PLR(const PLR&) = delete;
+  PLR& operator=(const PLR&) = delete;
+
   bool add_point(const X &x, const Y &y) {
     if (points_in_hull > 0 && x <= last_x)
       throw std::logic_error("Points must be increasing by x.");
@@ -87,10 +149,20 @@ public:
       upper.push_back(p1);
       lower.push_back(p2);
       upper_start = lower_start = 0;
+      lo_y = p2.y;
+      hi_y = p1.y;
+      narrow = kNarrow;
       ++points_in_hull;
       return true;
     }
 
+    if constexpr (kNarrow) {
+      // once a segment needs the wide type, it keeps using it
+      lo_y = std::min(lo_y, p2.y);
+      hi_y = std::max(hi_y, p1.y);
+      narrow = narrow && fits_narrow();
+    }
+
     if (points_in_hull == 1) {
       rectangle[2] = p2;
       rectangle[3] = p1;
@@ -100,22 +172,47 @@ public:
       return true;
     }
 
-    auto slope1 = rectangle[2] - rectangle[0];
-    auto slope2 = rectangle[3] - rectangle[1];
-    bool outside_line1 = p1 - rectangle[2] < slope1;
-    bool outside_line2 = p2 - rectangle[3] > slope2;
+    if constexpr (kNarrow) {
+      if (narrow)
+        return extend<NarrowSlope>(p1, p2);
+    }
+    return extend<Slope>(p1, p2);
+  }
+
+  CanonicalSegment get_segment() {
+    if (points_in_hull == 1)
+      return CanonicalSegment(rectangle[0], rectangle[1], first_x);
+    return CanonicalSegment(rectangle, first_x);
+  }
+
+  void reset() {
+    points_in_hull = 0;
+    lower.clear();
+    upper.clear();
+  }
+
+private:
+  /**
+   * @brief Add the point (p1, p2) to a hull of at least two points, the slopes are computed in S
+   */
+  template<typename S>
+  bool extend(const Point &p1, const Point &p2) {
+    auto slope1 = delta<S>(rectangle[2], rectangle[0]);
+    auto slope2 = delta<S>(rectangle[3], rectangle[1]);
+    bool outside_line1 = delta<S>(p1, rectangle[2]) < slope1;
+    bool outside_line2 = delta<S>(p2, rectangle[3]) > slope2;
 
     if (outside_line1 || outside_line2) {
       points_in_hull = 0;
       return false;
     }
 
-    if (p1 - rectangle[1] < slope2) {
+    if (delta<S>(p1, rectangle[1]) < slope2) {
       // Find extreme slope
-      auto min = lower[lower_start] - p1;
+      auto min = delta<S>(lower[lower_start], p1);
       auto min_i = lower_start;
       for (auto i = lower_start + 1; i < lower.size(); i++) {
-        auto val = lower[i] - p1;
+        auto val = delta<S>(lower[i], p1);
         if (val > min)
           break;
         min = val;
@@ -128,18 +225,18 @@ public:
 
       // Hull update
       auto end = upper.size();
-      for (; end >= upper_start + 2 && cross(upper[end - 2], upper[end - 1], p1) <= 0; --end)
+      for (; end >= upper_start + 2 && cross<S>(upper[end - 2], upper[end - 1], p1) <= 0; --end)
           continue;
       upper.resize(end);
       upper.push_back(p1);
     }
 
-    if (p2 - rectangle[0] > slope1) {
+    if (delta<S>(p2, rectangle[0]) > slope1) {
       // Find extreme slope
-      auto max = upper[upper_start] - p2;
+      auto max = delta<S>(upper[upper_start], p2);
       auto max_i = upper_start;
       for (auto i = upper_start + 1; i < upper.size(); i++) {
-          auto val = upper[i] - p2;
+          auto val = delta<S>(upper[i], p2);
           if (val < max)
               break;
           max = val;
@@ -152,7 +249,7 @@ public:
 
       // Hull update
       auto end = lower.size();
-      for (; end >= lower_start + 2 && cross(lower[end - 2], lower[end - 1], p2) >= 0; --end)
+      for (; end >= lower_start + 2 && cross<S>(lower[end - 2], lower[end - 1], p2) >= 0; --end)
           continue;
       lower.resize(end);
       lower.push_back(p2);
@@ -162,22 +259,10 @@ public:
     return true;
   }
 
-  CanonicalSegment get_segment() {
-    if (points_in_hull == 1)
-      return CanonicalSegment(rectangle[0], rectangle[1], first_x);
-    return CanonicalSegment(rectangle, first_x);
-  }
-
-  void reset() {
-    points_in_hull = 0;
-    lower.clear();
-    upper.clear();
-  }
-
 };
 
-template<typename X, typename Y>
-class PLR<X, Y>::CanonicalSegment {
+template<typename X, typename Y, bool kFast>
+class PLR<X, Y, kFast>::CanonicalSegment {
   friend class PLR;
 
   Point rectangle[4];
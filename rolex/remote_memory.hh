@@ -20,6 +20,10 @@ public:
   uint64_t reg_leaf_region;
   uint64_t leaf_num;
 
+  // NUMA placement of the model/leaf regions, and the huge page size (2M or 1G)
+  numa::Placement placement = numa::Default;
+  usize page_sz = 2 << 20;
+
   explicit RM_config(rdmaio::RCtrl* ctrl, uint64_t ms, uint64_t ls, uint64_t rlr, uint64_t ln) 
     : ctrl(ctrl), model_region_size(ms), leaf_region_size(ls), reg_leaf_region(rlr), leaf_num(ln) {}
 };
@@ -51,6 +55,7 @@ private:
   std::vector<DevIdx> all_nics;
   std::shared_ptr<rolex::HugeRegion> model_region;
   std::shared_ptr<rolex::HugeRegion> leaf_region;
+  std::vector<std::shared_ptr<rolex::HugeRegion>> grown_leaf_regions;
   leaf_alloc_t* leafAlloc;
   model_alloc_t* modelAlloc;
 
@@ -64,15 +69,25 @@ private:
     }
   }
 
+public:
+  /**
+   * @brief The NUMA node of the NIC which serves the leaf regions, the server threads should run there
+   */
+  auto nic_node() -> int {
+    auto nic = ctrl->opened_nics.query(0).value();
+    return numa::node_of_nic(ibv_get_device_name(nic->get_ctx()->device));
+  }
+
+private:
   void create_regions() {
     // [RCtrl] create model regions
-    model_region = HugeRegion::create(conf.model_region_size).value();
+    model_region = HugeRegion::create(conf.model_region_size, conf.page_sz, true, conf.placement, nic_node()).value();
     for (uint i = 0; i < all_nics.size(); ++i) {
       ctrl->registered_mrs.create_then_reg(
         i, model_region->convert_to_rmem().value(), ctrl->opened_nics.query(i).value());
     }
-    // [RCtrl] create leaf regions
-    leaf_region = HugeRegion::create(conf.leaf_region_size).value();
+    // [RCtrl] create leaf regions, the leaves are formatted lazily so we do not populate the region
+    leaf_region = HugeRegion::create(conf.leaf_region_size, conf.page_sz, false, conf.placement, nic_node()).value();
     ctrl->registered_mrs.create_then_reg(
       conf.reg_leaf_region, leaf_region->convert_to_rmem().value(), ctrl->opened_nics.query(0).value());
   }
@@ -81,8 +96,20 @@ private:
     ASSERT(leaf_region) << "Leaf region not exist";
     leafAlloc = new leaf_alloc_t(static_cast<char *>(leaf_region->start_ptr()), leaf_region->size(), conf.leaf_num);
     // leafAlloc = new leaf_alloc_t(static_cast<char *>(leaf_region->start_ptr()), leaf_region->size());
+    // the leaf region i is registered as reg_leaf_region + i, which the compute nodes fetch on demand
+    leafAlloc->set_grow([this](const u64 &region, const u64 &sz) -> char * {
+      auto r = HugeRegion::create(sz, conf.page_sz, false, conf.placement, nic_node());
+      if(!r) return nullptr;
+      auto res = ctrl->registered_mrs.create_then_reg(
+        conf.reg_leaf_region + region, r.value()->convert_to_rmem().value(), ctrl->opened_nics.query(0).value());
+      if(!res) return nullptr;
+      grown_leaf_regions.push_back(r.value());
+      return static_cast<char *>(r.value()->start_ptr());
+    });
     ASSERT(model_region) << "Model region not exist";
     modelAlloc = new model_alloc_t(static_cast<char *>(model_region->start_ptr()), model_region->size());
+    // the relocated leaves wait for the acks of the compute nodes in the model region
+    leafAlloc->set_acked([this]() -> u64 { return modelAlloc->acked_layout(); });
   }
 };
 
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
 #include "plr.hpp"
 #include "submodel.hpp"
+#include "bulk_loader.hpp"
 #include "remote_memory.hh"
 #include "rolex_util.hh"
 
@@ -12,22 +18,45 @@ template<typename K, typename V, typename leaf_t, typename alloc_t, typename rem
 class Rolex {
   using model_t = SubModel<K, V, leaf_t, alloc_t, Epsilon>;
   using OptimalPLR = PLR<K, size_t>;
+  using leaf_table_t = LeafTable<K, V, leaf_t, alloc_t>;
 
 private:
   remote_memory_t* RM;
   std::vector<K> model_keys;
   std::vector<model_t> models;
+  std::atomic<usize> published{0};  /// the submodels routed to, each one built and written before it counts
+  double fill = 1.0;       /// the fraction of the slots of a leaf filled at bulk loading
+  usize delta_cap = 0;     /// the KVs in the delta buffer of a submodel, 0 if disabled
+  double filter_bits = 0;  /// the bits per key of the filter of a submodel, 0 if disabled
+  std::atomic<bool> compacting{false};
+  std::thread compactor;
+  std::atomic<bool> defragging{false};
+  std::thread defragmenter;
+  std::atomic<bool> syncing{false};
+  std::thread filter_syncer;
 
 public:
-  explicit Rolex(remote_memory_t *RM)
-      : RM(RM), model_keys(), models() { assert(RM->leaf_allocator() && RM->model_allocator()); }
+  /**
+   * @param fill the fill factor of the leaves at bulk loading, in (0, 1]
+   */
+  explicit Rolex(remote_memory_t *RM, const double &fill = 1.0)
+      : RM(RM), model_keys(), models(), fill(fill) { 
+    assert(RM->leaf_allocator() && RM->model_allocator()); 
+    ASSERT(fill > 0 && fill <= 1) << "invalid fill factor: " << fill;
+  }
 
-  explicit Rolex(remote_memory_t *RM, const std::vector<K> &keys, const std::vector<V> &vals)
-      : RM(RM), model_keys(), models() {
-    assert(RM->leaf_allocator() && RM->model_allocator());
+  explicit Rolex(remote_memory_t *RM, const std::vector<K> &keys, const std::vector<V> &vals,
+                 const double &fill = 1.0)
+      : Rolex(RM, fill) {
     train(keys, vals);
   }
 
+  ~Rolex() {
+    stop_compaction();
+    stop_defrag();
+    stop_filter_sync();
+  }
+
   // ====================== functions for serialization and deserialization =================
   // Alloc will not used on compute nodes
   explicit Rolex(const std::string_view& seria) : model_keys(), models() {
@@ -48,6 +77,7 @@ public:
       this->models.emplace_back(mSeria);
       cur_ptr += mSeria_size;
     }
+    published.store(models.size(), std::memory_order_release);
   }
 
   /**
@@ -56,7 +86,7 @@ public:
    */
   auto serialize() -> std::string {
     std::string ans;
-    for(int i=0; i<models.size(); i++){
+    for(usize i=0; i<model_num(); i++){
       std::string res;
       res += ::xstore::util::Marshal<K>::serialize_to(model_keys[i]);
       auto mSeria = models[i].serialize();
@@ -83,7 +113,8 @@ public:
       memcpy(&off, upper_res.second, sizeof(u64));
       model_keys.emplace_back(key);
 
-      // read submodel
+      // read submodel, after the version of its filter bits
+      const u64 synced = __atomic_load_n(RM->model_allocator()->get_filter_versions(off).first, __ATOMIC_ACQUIRE);
       auto sub_res = RM->model_allocator()->get_submodel(off);
       i32 cur_ms;
       memcpy(&cur_ms, sub_res, sizeof(i32));
@@ -93,8 +124,10 @@ public:
       memcpy(read_model_buf, sub_res+sizeof(i32), cur_ms);
       std::string rSeria(read_model_buf, cur_ms);
       model_t model(rSeria);
+      model.set_filter_version(RM->model_allocator()->get_filter_versions(off).second, synced);
       models.emplace_back(model);
     }
+    published.store(models.size(), std::memory_order_release);
   }
 
   /**
@@ -104,85 +137,362 @@ public:
   void train(const std::vector<K> &keys, const std::vector<V> &vals)
   {
     assert(keys.size() == vals.size());
-    if(keys.size()==0) return;
-    LOG(2) << "Training data: "<<keys.size()<<", Epsilon: "<<Epsilon;
-
-    OptimalPLR* opt = new OptimalPLR(Epsilon-1);
-    K p = keys[0];
-    size_t pos=0;
-    opt->add_point(p, pos);
-    auto k_iter = keys.begin();
-    auto v_iter = vals.begin();
-    for(int i=1; i<keys.size(); i++) {
-      K next_p = keys[i];
-      if (next_p == p){
-        LOG(5)<<"DUPLICATE keys";
-        exit(0);
-      }
-      p = next_p;
-      pos++;
-      if(!opt->add_point(p, pos)) {
-        auto cs = opt->get_segment();
-        auto[cs_slope, cs_intercept] = cs.get_slope_intercept();
-        append_model(cs_slope, cs_intercept, k_iter, v_iter, pos);
-        k_iter += pos;
-        v_iter += pos;
-        pos=0;
-        opt = new OptimalPLR(Epsilon-1);
-        opt->add_point(p, pos);
-      }
-    }
-    auto cs = opt->get_segment();
-    auto[cs_slope, cs_intercept] = cs.get_slope_intercept();
-    append_model(cs_slope, cs_intercept, k_iter, v_iter, ++pos);
+    VectorStream<K, V> stream(keys, vals);
+    bulk_load(stream);
+  }
 
-    u64 total_size = models.size();
-    LOG(4) << "Training models: "<<total_size<<" used leaves: "<<this->RM->leaf_allocator()->used_num();
-    assert(model_keys.size() == total_size);
-    // write total_num into model_region
-    memcpy(RM->model_allocator()->get_total_ptr(), &total_size, sizeof(u64));
+  /**
+   * @brief Train the models from a sorted KV stream in one pass.
+   *          The KVs are put into the leaves as they arrive, and a submodel is
+   *          written to the model region once its segment closes,
+   *          so the KVs are never materialized besides the leaves.
+   *        Each leaf gets ceil(fill * N) KVs, so the first inserts into a leaf land in place,
+   *          and the models map the position of a KV to the leaf by the same number.
+   * 
+   * @tparam stream_t has next(K&, V&), e.g., VectorStream or MappedStream
+   */
+  template<typename stream_t>
+  void bulk_load(stream_t &stream)
+  {
+    K key;
+    V val;
+    if(!stream.next(key, val)) return;
+    LOG(2) << "Bulk loading, Epsilon: "<<Epsilon;
+
+    auto alloc = this->RM->leaf_allocator();
+    ASSERT(alloc) << "Leaf allocator in the model is nullptr";
+    // a failed add_point starts a new segment, so one PLR (and its hull storage) serves all segments
+    Segment seg(Epsilon-1);
+    u64 loaded = 0;
+    do {
+      if(loaded > 0 && key <= seg.last) {
+        if(key == seg.last) {
+          LOG(5)<<"DUPLICATE keys";
+          exit(0);
+        }
+        ASSERT(false) << "The keys are not sorted: " << key << " after " << seg.last;
+      }
+      const bool ok = append_sorted(seg, key, val);
+      ASSERT(ok) << "The leaf cannot take key " << key << ", e.g., the keys are too sparse for leaf_t";
+      loaded++;
+    } while(stream.next(key, val));
+    seal(seg);
+
+    LOG(4) << "Training data: "<<loaded<<", models: "<<models.size()<<" used leaves: "<<alloc->used_num();
+    assert(model_keys.size() == models.size());
   }
 
   // ========= API functions for memory nodes {debugging} : search, update, insert, remove ===========
+  // Each function pins the epoch of the leaf allocator, so the leaves it reads are not reused under it
   auto search(const K &key, V &val) -> bool {
+    auto guard = this->RM->leaf_allocator()->pin();
+    if(lock_tail(key)) {
+      auto res = tail_search(key, val);
+      tail->lock.unlock();
+      return res;
+    }
     return models[model_for_key(key)].search(key, val, this->RM->leaf_allocator());
   }
 
   auto update(const K &key, const V &val) -> bool {
+    auto guard = this->RM->leaf_allocator()->pin();
+    if(lock_tail(key)) {
+      auto res = tail->ltable.update(key, val, this->RM->leaf_allocator(), tail_leaf(key), tail_leaf(key));
+      tail->lock.unlock();
+      return res;
+    }
     return models[model_for_key(key)].update(key, val, this->RM->leaf_allocator());
   }
 
   auto insert(const K &key, const V &val) -> bool {
+    auto guard = this->RM->leaf_allocator()->pin();
+    if(lock_tail(key)) {
+      auto res = tail_insert(key, val);
+      tail->lock.unlock();
+      return res;
+    }
     auto model_n = model_for_key(key);
     // LOG(2) <<"Key: "<<key<<", Insert into model: "<< model_n;
     return models[model_n].insert(key, val, this->RM->leaf_allocator());
   }
 
   auto remove(const K &key) -> bool {
+    auto guard = this->RM->leaf_allocator()->pin();
+    if(lock_tail(key)) {
+      auto res = tail->ltable.remove(key, this->RM->leaf_allocator(), tail_leaf(key), tail_leaf(key));
+      tail->lock.unlock();
+      return res;
+    }
     return models[model_for_key(key)].remove(key, this->RM->leaf_allocator());
   }
 
   void range(const K& key, const int n, std::vector<V> &vals) {
-    auto model_n = model_for_key(key);
-    models[model_n].range(key, n, vals, this->RM->leaf_allocator());
-    model_n++;
-    while(vals.size()<n && model_n<models.size()) {
+    auto guard = this->RM->leaf_allocator()->pin();
+    if(!beyond_models(key)) {
+      auto model_n = model_for_key(key);
       models[model_n].range(key, n, vals, this->RM->leaf_allocator());
       model_n++;
+      while(vals.size()<n && model_n<model_num()) {
+        models[model_n].range(key, n, vals, this->RM->leaf_allocator());
+        model_n++;
+      }
+    }
+    if(vals.size()<n && tail) {
+      tail->lock.lock();
+      if(tail->pos > 0) tail->ltable.range(key, n, vals, this->RM->leaf_allocator(), tail_leaf(key), tail_leaf(key));
+      tail->lock.unlock();
     }
   } 
 
+  /**
+   * @brief The KVs put in a leaf at bulk loading
+   */
+  auto leaf_slots() const -> size_t {
+    return std::max<size_t>(1, static_cast<size_t>(std::ceil(fill * leaf_t::max_slot())));
+  }
+
+  /**
+   * @brief The submodels published to the lookups and the background threads, see append_model
+   */
+  auto model_num() const -> usize { return published.load(std::memory_order_acquire); }
+
+  // ============== functions for the delta buffers ================
+  /**
+   * @brief Give each submodel a delta buffer of cap KVs, which absorbs its inserts.
+   *          Called after training; the compute nodes reading the leaves see a KV once it is compacted.
+   */
+  void enable_delta_buffers(const usize &cap) {
+    delta_cap = cap;
+    for(usize i=0; i<model_num(); i++) models[i].enable_delta(cap);
+  }
+
+  /**
+   * @brief Merge the delta buffers into the leaves
+   *
+   * @param min_kvs merge a buffer only if at least min_kvs KVs are added since its last merge,
+   *          so the KVs failing to move are not retried in a loop
+   * @return usize the number of the merged KVs
+   */
+  auto compact(const usize &min_kvs = 0) -> usize {
+    usize res = 0;
+    const usize n = model_num();
+    for(usize i=0; i<n; i++) {
+      auto &m = models[i];
+      if(m.delta_size() == 0 || m.delta_pending() < min_kvs) continue;
+      auto guard = this->RM->leaf_allocator()->pin();
+      res += m.compact(this->RM->leaf_allocator());
+    }
+    return res;
+  }
+
+  /**
+   * @brief Start the background thread merging the buffers half full, it sleeps for interval_us if none is
+   */
+  void start_compaction(const u64 &interval_us = 100) {
+    ASSERT(delta_cap > 0) << "the delta buffers are not enabled";
+    if(compacting.exchange(true)) return;
+    compactor = std::thread([this, interval_us]() {
+      while(compacting.load()) {
+        if(compact(delta_cap / 2) == 0) std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+      }
+    });
+  }
+
+  void stop_compaction() {
+    if(!compacting.exchange(false)) return;
+    compactor.join();
+  }
+
+  auto delta_size() const -> usize {
+    usize res = 0;
+    for(usize i=0; i<model_num(); i++) res += models[i].delta_size();
+    return res;
+  }
+
+  /**
+   * @brief The leaves a compute node reads to find the key, i.e., the read amplification
+   */
+  auto read_leaves(const K &key) -> usize {
+    if(lock_tail(key)) {
+      auto res = tail->pos > 0 ? tail->ltable.window_leaves(tail_leaf(key), tail_leaf(key)) : 0;
+      tail->lock.unlock();
+      return res;
+    }
+    return models[model_for_key(key)].read_leaves(key);
+  }
+
+  // ============== functions for the filters ================
+  /**
+   * @brief Give each submodel a Bloom filter of bits_per_key bits per trained key, which answers most lookups
+   *          of the absent keys without reading a leaf, on the memory node and on the compute nodes.
+   *          Called before training, as the filter is written into the model region next to the leaf table.
+   *          A larger bits_per_key lowers the false-positive rate, at the cost of the model region
+   *          and of a u8 counter per bit on the memory node.
+   */
+  void enable_filters(const double &bits_per_key) {
+    ASSERT(models.empty() && !tail) << "the filters are enabled before training";
+    ASSERT(bits_per_key > 0) << "invalid bits per key: " << bits_per_key;
+    filter_bits = bits_per_key;
+  }
+
+  /**
+   * @return false if the key is absent by the filter of its submodel,
+   *          which a copy read from the model region answers only if no key is added since it was written
+   */
+  auto may_contain(const K &key) -> bool {
+    if(tail && beyond_models(key)) return true;
+    return models[model_for_key(key)].may_contain(key);
+  }
+
+  /**
+   * @brief Write the filters with keys added since their last sync into the model region,
+   *          which the compute nodes read once they see the new layout version, see LearnedCache::sync().
+   *          The keys removed stay in the copies as false positives until the filter is written for an added key.
+   *          The submodels with unlinked synonym leaves are written as well, and the leaves are reused
+   *          once every compute node has acked the new version.
+   *
+   * @return usize the submodels written
+   */
+  auto sync_filters() -> usize {
+    const usize n = model_num();
+    usize res = 0;
+    std::vector<u64> unlinked;
+    for(usize i=0; i<n; i++) {
+      auto versions = RM->model_allocator()->get_filter_versions(model_off(i));
+      if(__atomic_load_n(versions.first, __ATOMIC_ACQUIRE) == __atomic_load_n(versions.second, __ATOMIC_ACQUIRE)
+         && !models[i].has_unlinked()) continue;
+      if(res++ == 0) RM->model_allocator()->begin_update();
+      rewrite_model(i, unlinked);
+    }
+    if(res > 0) RM->leaf_allocator()->retire_runs(unlinked, RM->model_allocator()->end_update());
+    return res;
+  }
+
+  /**
+   * @brief Start the background thread syncing the filters and retiring the unlinked leaves every interval_ms.
+   *          Each sync makes the compute nodes read the whole model region again, so the interval trades
+   *          the filtered lookups of the submodels with new keys for the reads of the model region.
+   */
+  void start_filter_sync(const u64 &interval_ms = 1000) {
+    if(syncing.exchange(true)) return;
+    filter_syncer = std::thread([this, interval_ms]() {
+      while(syncing.load()) {
+        sync_filters();
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+      }
+    });
+  }
+
+  void stop_filter_sync() {
+    if(!syncing.exchange(false)) return;
+    filter_syncer.join();
+  }
+
+  /**
+   * @brief The bytes of the filters in the model region
+   */
+  auto filter_bytes() const -> usize {
+    usize res = 0;
+    for(usize i=0; i<model_num(); i++) res += models[i].filter_bytes();
+    return res;
+  }
+
+  // ============== functions for the defragmentation ================
+  /**
+   * @brief Relocate the leaves of each submodel in at least min_runs runs into one run of consecutive leaves,
+   *          and write the submodel with the new leaf addresses into the model region under a new layout version.
+   *          The old leaves are reused after the local readers, the remote grace period,
+   *          and once every compute node has acked the new version, i.e., it reads the new leaf addresses;
+   *          until then, a compute node reads the KVs of the old leaves as of the relocation.
+   *
+   * @return usize the number of the relocated primary leaves
+   */
+  auto defrag(const usize &min_runs = 2) -> usize {
+    usize res = 0;
+    const usize n = model_num();
+    std::vector<u64> old;
+    for(usize i=0; i<n; i++) {
+      if(models[i].leaf_runs() < min_runs) continue;
+      auto guard = this->RM->leaf_allocator()->pin();
+      old.clear();
+      auto moved = models[i].defrag(this->RM->leaf_allocator(), old);
+      if(moved > 0) {
+        RM->model_allocator()->begin_update();
+        rewrite_model(i, old);
+        this->RM->leaf_allocator()->retire_runs(old, RM->model_allocator()->end_update());
+      }
+      res += moved;
+    }
+    return res;
+  }
+
+  /**
+   * @brief Start the background thread defragmenting the submodels in at least min_runs runs,
+   *          it sleeps for interval_ms if none is
+   */
+  void start_defrag(const usize &min_runs = 16, const u64 &interval_ms = 10) {
+    if(defragging.exchange(true)) return;
+    defragmenter = std::thread([this, min_runs, interval_ms]() {
+      while(defragging.load()) {
+        if(defrag(min_runs) == 0) std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+      }
+    });
+  }
+
+  void stop_defrag() {
+    if(!defragging.exchange(false)) return;
+    defragmenter.join();
+  }
+
+  /**
+   * @brief The runs of consecutive leaves of all submodels
+   */
+  auto leaf_runs() -> usize {
+    usize res = 0;
+    for(usize i=0; i<model_num(); i++) res += models[i].leaf_runs();
+    return res;
+  }
+
+  // ============== functions for the append mode ================
+  /**
+   * @brief Route the keys beyond the last submodel to a tail segment, instead of the synonym leaves of the last submodel.
+   *          The tail appends the keys into new leaves and extends its own PLR,
+   *          and is sealed into a new submodel once its segment closes, as in bulk loading.
+   *          A key smaller than the last one of the tail is inserted into its leaf.
+   *          Called after training; the compute nodes see the sealed submodels once they read the model region again.
+   *
+   * @param max_models the submodels reserved, so the lookups of the other submodels never see them move
+   */
+  void enable_append(const usize &max_models = 1 << 16) {
+    ASSERT(max_models >= models.size()) << "reserve " << max_models << " submodels, but there are " << models.size();
+    models.reserve(max_models);
+    model_keys.reserve(max_models);
+    tail = std::make_unique<Segment>(Epsilon-1);
+  }
+
+  /**
+   * @brief Seal the tail into a submodel, e.g., before a compute node reads the model region
+   */
+  void seal_tail() {
+    if(!tail) return;
+    tail->lock.lock();
+    seal(*tail);
+    tail->lock.unlock();
+  }
+
+  auto tail_size() -> usize { return tail ? tail->pos : 0; }
+
   // ============== functions for debugging ================
   void print_data() {
     ASSERT(this->RM->leaf_allocator()) << "Leaf allocator in the model is nullptr";
-    for(int i=0; i<models.size(); i++){
+    for(usize i=0; i<model_num(); i++){
       LOG(3)<<"Submodel " << i <<", model_key: "<<model_keys[i];
       models[i].print_data(this->RM->leaf_allocator());
     }
   }
 
   void print() {
-    for(int i=0; i<models.size(); i++){
+    for(usize i=0; i<model_num(); i++){
       LOG(3)<<"Submodel " << i <<", model_key: "<<model_keys[i];
       models[i].print();
     }
@@ -190,24 +500,146 @@ public:
 
 private:
   /**
-   * @brief construct submodels with parameters and KVs
-   *      
+   * @brief The open segment of the bulk loading or the tail: the keys appended into its leaves
+   *          and the PLR extended with their positions
+   */
+  struct Segment {
+    OptimalPLR opt;
+    leaf_table_t ltable;
+    std::vector<K> firsts;      /// the first key appended into each leaf
+    std::vector<u64> hashes;    /// the hashes of the keys for the filter, if enabled
+    leaf_t* cur_leaf = nullptr;
+    size_t pos = 0;             /// the appended keys
+    K last = 0;                 /// the last appended key
+    ::xstore::util::SpinLock lock;
+
+    explicit Segment(size_t epsilon) : opt(epsilon) {}
+  };
+
+  std::unique_ptr<Segment> tail;  /// the keys beyond the last submodel in the append mode
+
+  /**
+   * @brief Append a key larger than the ones of the segment,
+   *          the segment is sealed into a submodel first if the key closes it
+   *
+   * @return false if the leaf cannot take the key, e.g., the synonym table is full
+   */
+  auto append_sorted(Segment &seg, const K &key, const V &val) -> bool {
+    if(!seg.opt.add_point(key, seg.pos)) {
+      seal(seg);
+      seg.opt.add_point(key, seg.pos);
+    }
+    auto alloc = this->RM->leaf_allocator();
+    const size_t slots = leaf_slots();
+    // each submodel starts with a new leaf
+    if(seg.pos % slots == 0) {
+      auto res = alloc->fetch_new_leaf();
+      seg.ltable.train_emplace_back(res.second);
+      seg.firsts.push_back(key);
+      seg.cur_leaf = reinterpret_cast<leaf_t*>(res.first);
+    }
+    const usize l = seg.pos / slots;
+    // the leaf may be split by the smaller keys of the tail
+    bool res = seg.ltable.table[l].synonym_leaf == 0 && seg.cur_leaf->accepts(key);
+    if(res) seg.cur_leaf->insert_not_full(key, val);
+    else res = seg.ltable.insert(key, val, alloc, l, l);
+    if(!res) return false;
+    if(filter_bits > 0) seg.hashes.push_back(BloomFilter<K>::hash(key));
+    seg.last = key;
+    seg.pos++;
+    return true;
+  }
+
+  /**
+   * @brief Write the segment as a submodel, and start a new one
+   */
+  void seal(Segment &seg) {
+    if(seg.pos == 0) return;
+    auto cs = seg.opt.get_segment();
+    auto[cs_slope, cs_intercept] = cs.get_slope_intercept();
+    append_model(cs_slope, cs_intercept, seg.last, seg.pos, std::move(seg.ltable), leaf_slots(), seg.hashes);
+    seg.ltable = leaf_table_t();
+    seg.firsts.clear();
+    seg.hashes.clear();
+    seg.cur_leaf = nullptr;
+    seg.pos = 0;
+    seg.opt.reset();
+  }
+
+  auto beyond_models(const K &key) -> bool {
+    const usize n = model_num();
+    return n == 0 || key > model_keys[n-1];
+  }
+
+  /**
+   * @brief Lock the tail if it takes the key, checked again with the lock held as the tail may be sealed
+   */
+  auto lock_tail(const K &key) -> bool {
+    if(!tail || !beyond_models(key)) return false;
+    tail->lock.lock();
+    if(beyond_models(key)) return true;
+    tail->lock.unlock();
+    return false;
+  }
+
+  /**
+   * @brief The leaf of the tail taking the key, by the first keys of the leaves
    */
-  void append_model(double slope, double intercept,
-                     const typename std::vector<K>::const_iterator &keys_begin,
-                     const typename std::vector<V>::const_iterator &vals_begin, 
-                     size_t size) 
+  auto tail_leaf(const K &key) -> int {
+    auto it = std::upper_bound(tail->firsts.begin(), tail->firsts.end(), key);
+    return it == tail->firsts.begin() ? 0 : (it - tail->firsts.begin() - 1);
+  }
+
+  auto tail_search(const K &key, V &val) -> bool {
+    if(tail->pos == 0) return false;
+    auto l = tail_leaf(key);
+    return tail->ltable.search(key, val, this->RM->leaf_allocator(), l, l);
+  }
+
+  /**
+   * @brief Insert into the tail with its lock held.
+   *          If the leaf cannot take the key, the tail is sealed and the key goes to the new segment,
+   *          or to the new submodel if it is smaller than the last appended key.
+   */
+  auto tail_insert(const K &key, const V &val) -> bool {
+    V dummy;
+    if(tail_search(key, dummy)) return false;
+    if(tail->pos == 0 || key > tail->last) {
+      if(append_sorted(*tail, key, val)) return true;
+      seal(*tail);
+      return append_sorted(*tail, key, val);
+    }
+    auto l = tail_leaf(key);
+    if(tail->ltable.insert(key, val, this->RM->leaf_allocator(), l, l)) {
+      if(filter_bits > 0) tail->hashes.push_back(BloomFilter<K>::hash(key));
+      return true;
+    }
+    seal(*tail);
+    return models[model_num()-1].insert(key, val, this->RM->leaf_allocator());
+  }
+
+  /**
+   * @brief construct a submodel with the filled leaves, and write it into the model region
+   * 
+   * @param key the last key of the submodel
+   * @param hashes the hashes of its keys for the filter, if enabled
+   */
+  void append_model(double slope, double intercept, const K &key, size_t size, leaf_table_t &&ltable,
+                    size_t slots, const std::vector<u64> &hashes) 
   {
-    ASSERT(this->RM->leaf_allocator()) << "Leaf allocator in the model is nullptr";
-    auto key = *(keys_begin+size-1);
+    ASSERT(!tail || models.size() < models.capacity()) << "more submodels than reserved by enable_append";
+    // the submodel, its delta buffer and filter, and its entries in the model region are in place
+    // before it is published, the reserved vectors do not move the published submodels
+    models.emplace_back(slope, intercept, size, std::move(ltable), slots);
+    auto &model = models.back();
+    if(delta_cap > 0) model.enable_delta(delta_cap);
+    if(filter_bits > 0) model.enable_filter(filter_bits, hashes);
     model_keys.push_back(key);
-    model_t model(slope, intercept, keys_begin, vals_begin, size, this->RM->leaf_allocator());
-    //models.emplace_back(slope, intercept, keys_begin, vals_begin, size, this->RM->leaf_allocator());
-    models.emplace_back(model);
 
-    // write model into model_region
+    // write model into model_region, the inserts bump the version of its filter from then on
     auto mSeria = model.serialize();
     auto subReg = RM->model_allocator()->alloc_submodel(mSeria.size()+sizeof(i32));
+    model.set_filter_version(RM->model_allocator()->get_filter_versions(subReg.second).second);
     i32 m_size = mSeria.size();
     memcpy(subReg.first, &m_size, sizeof(i32));
     memcpy(subReg.first+sizeof(i32), mSeria.data(), mSeria.size());
@@ -222,11 +654,49 @@ private:
     auto upper_off = RM->model_allocator()->alloc_upper();
     memcpy(upper_off.first, &key, sizeof(key));
     memcpy(upper_off.second, &(subReg.second), sizeof(u64));
+
+    // route the lookups and the background threads to it
+    published.store(models.size(), std::memory_order_release);
+
+    // write total_num into model_region, the compute nodes see the new layout version
+    u64 total_size = models.size();
+    RM->model_allocator()->begin_update();
+    memcpy(RM->model_allocator()->get_total_ptr(), &total_size, sizeof(u64));
+    RM->model_allocator()->end_update();
+  }
+
+  /**
+   * @brief Overwrite the i-th submodel in the model region, whose size does not change with its leaves,
+   *          between begin_update() and end_update() of the model allocator
+   *
+   * @param unlinked the synonym leaves unlinked before the write are appended,
+   *          the caller retires them with the version returned by end_update()
+   */
+  void rewrite_model(const usize &i, std::vector<u64> &unlinked) {
+    const u64 off = model_off(i);
+    // the bits serialized have every key added before the version
+    auto versions = RM->model_allocator()->get_filter_versions(off);
+    const u64 live = __atomic_load_n(versions.second, __ATOMIC_ACQUIRE);
+    models[i].take_unlinked(unlinked);
+    auto mSeria = models[i].serialize();
+    auto sub_res = RM->model_allocator()->get_submodel(off);
+    i32 cur_ms;
+    memcpy(&cur_ms, sub_res, sizeof(i32));
+    ASSERT(cur_ms == mSeria.size()) << "submodel " << i << " size: " << cur_ms << " -> " << mSeria.size();
+    memcpy(sub_res+sizeof(i32), mSeria.data(), mSeria.size());
+    __atomic_store_n(versions.first, live, __ATOMIC_RELEASE);
+  }
+
+  auto model_off(const usize &i) -> u64 {
+    u64 off;
+    memcpy(&off, RM->model_allocator()->get_upper(i).second, sizeof(u64));
+    return off;
   }
 
   auto model_for_key(const K &key) -> usize {
-    auto idx = binary_search_branchless(&model_keys[0], model_keys.size(), key);
-    return idx<models.size()? idx:(models.size()-1);
+    const usize n = model_num();
+    auto idx = binary_search_branchless(&model_keys[0], n, key);
+    return idx<n? idx:(n-1);
   }
 
 };
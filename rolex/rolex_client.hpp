@@ -8,9 +8,13 @@
 #include "rlib/core/nicinfo.hh"               /// RNicInfo
 #include "xcomm/tests/transport_util.hh"      /// SimpleAllocator
 #include "xcomm/src/transport/rdma_ud_t.hh"   /// UDTranstrant, UDRecvTransport, UDSessionManager
+#include "xcomm/src/transport/rdma_ring_t.hh" /// RRingTransport, RRingRecvTransport, RRingSessionManager
+#include "xcomm/src/transport/shm_t.hh"       /// ShmTransport, ShmRecvTransport, ShmSessionManager
 #include "xcomm/src/rpc/mod.hh"               /// RPCCore
 #include "xutils/local_barrier.hh"            /// PBarrier
 
+#include "../benchs/rolex_util_back.hh"
+
 
 extern volatile bool running;
 extern ::xstore::util::PBarrier* bar;
@@ -25,18 +29,29 @@ using namespace xstore::rpc;
 using namespace xstore::transport;
 
 using XThread = ::r2::Thread<usize>;   // <usize> represents the return type of a function
+#ifdef ROLEX_RING_RPC
+using SendTrait = RRingTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using RecvTrait = RRingRecvTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using SManager = RRingSessionManager<kRingEntry, kRingSz, kRingMaxMsg>;
+#elif defined(ROLEX_SHM_RPC)
+using SendTrait = ShmTransport<kShmSlots>;
+using RecvTrait = ShmRecvTransport<kShmSlots>;
+using SManager = ShmSessionManager<kShmSlots>;
+#else
 using SendTrait = UDTransport;
 using RecvTrait = UDRecvTransport<2048>;
 using SManager = UDSessionManager<2048>;
+#endif
 
 using RPC = RPCCore<SendTrait, RecvTrait, SManager>;
 
 
-auto remote_search(const KeyType& key, RPC& rpc, UDTransport& sender, R2_ASYNC) -> ::r2::Option<ValType>;
-void remote_put(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& sender, R2_ASYNC);
-void remote_update(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& sender, R2_ASYNC);
-void remote_remove(const KeyType& key, RPC& rpc, UDTransport& sender, R2_ASYNC);
-void remote_scan(const KeyType& key, const u64& n, RPC& rpc, UDTransport& sender, R2_ASYNC);
+auto remote_search(const KeyType& key, RPC& rpc, SendTrait& sender, R2_ASYNC) -> ::r2::Option<ValType>;
+auto remote_search_async(const KeyType& key, RPC& rpc, SendTrait& sender, R2_ASYNC) -> RPCFuture;
+void remote_put(const KeyType& key, const ValType& val, RPC& rpc, SendTrait& sender, R2_ASYNC);
+void remote_update(const KeyType& key, const ValType& val, RPC& rpc, SendTrait& sender, R2_ASYNC);
+void remote_remove(const KeyType& key, RPC& rpc, SendTrait& sender, R2_ASYNC);
+void remote_scan(const KeyType& key, const u64& n, RPC& rpc, SendTrait& sender, R2_ASYNC);
 
 
 auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<XThread>> {
@@ -49,30 +64,53 @@ auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<X
       // create NIC and qps
       usize nic_idx = 0;
       auto nic_for_sender = RNic::create(RNicInfo::query_dev_names().at(nic_idx)).value();
-      auto ud_qp = UD::create(nic_for_sender, QPConfig()).value();
       // Register the memory
       auto mem_region1 = HugeRegion::create(16 * 1024 * 1024).value();
       auto mem1 = mem_region1->convert_to_rmem().value();
       auto handler1 = RegHandler::create(mem1, nic_for_sender).value();
-      SimpleAllocator alloc1(mem1, handler1->get_reg_attr().value());
-      auto recv_rs_at_send = RecvEntriesFactory<SimpleAllocator, 2048, 1024>::create(alloc1);
+      auto alloc1 = Arc<SimpleAllocator>(new SimpleAllocator(mem1, handler1->get_reg_attr().value()));
+#ifdef ROLEX_RING_RPC
+      // the replies of all the in-flight requests should fit in the ring
+      ASSERT(BenConfig.coros * BenConfig.pipeline <= kRingSlots)
+        << "too many in-flight requests for the ring: " << BenConfig.coros * BenConfig.pipeline;
+      auto recv_cq = std::get<0>(::rdmaio::qp::Impl::create_cq(nic_for_sender, 2048).desc);
+#elif defined(ROLEX_SHM_RPC)
+      // the inbox should exist before the server connects back on the Connect msg
+      auto my_inbox = "/rolex-c" + std::to_string(thread_id);
+      auto inbox = ShmInbox<kShmSlots>::create(my_inbox, 1).value();
+#else
+      auto ud_qp = UD::create(nic_for_sender, QPConfig()).value();
+      auto recv_rs_at_send = RecvEntriesFactory<SimpleAllocator, 2048, 4096>::create(*alloc1);
       {
         auto res = ud_qp->post_recvs(*recv_rs_at_send, 2048);
         RDMA_ASSERT(res == IOCode::Ok);
       }
+#endif
       /**
-       * @brief connect with the remote machine with UD
+       * @brief connect with the remote machine with UD (or the RC ring)
        * 
        */
       //std::string server_addr = "192.168.3.101:8888";
       std::string server_addr = "10.0.0.1:8899";
       int ud_id = thread_id;
-      UDTransport sender;
+#ifdef ROLEX_RING_RPC
+      // the session id identifies the client thread at the server
+      SendTrait sender(thread_id, nic_for_sender, QPConfig(), recv_cq, alloc1);
+#else
+      SendTrait sender;
+#endif
       {
         r2::Timer t;
         do {
+#ifdef ROLEX_RING_RPC
+          auto res = sender.connect(
+            server_addr, "b" + std::to_string(ud_id), nic_idx, QPConfig());
+#elif defined(ROLEX_SHM_RPC)
+          auto res = sender.connect("/rolex-b" + std::to_string(ud_id), my_inbox);
+#else
           auto res = sender.connect(
             server_addr, "b" + std::to_string(ud_id), thread_id, ud_qp);
+#endif
           if (res == IOCode::Ok) {
             LOG(2) << "Thread " << thread_id << " connect to remote server";
             break;
@@ -86,8 +124,9 @@ auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<X
        * @brief Construct rpc for communication
        * 
        */
-      RPCCore<SendTrait, RecvTrait, SManager> rpc(12);
-      auto send_buf = std::get<0>(alloc1.alloc_one(4096).value());
+      // coroutine ids start from 1
+      RPCCore<SendTrait, RecvTrait, SManager> rpc(BenConfig.coros + 1);
+      auto send_buf = std::get<0>(alloc1->alloc_one(4096).value());
       ASSERT(send_buf != nullptr);
       auto lkey = handler1->get_reg_attr().value().key;
       memset(send_buf, 0, 4096);
@@ -96,7 +135,15 @@ auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<X
       auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 2048),
                                            sender.get_connect_data().value());
       ASSERT(conn_op.execute_w_key(&sender, lkey) == IOCode::Ok);
-      UDRecvTransport<2048> recv_s(ud_qp, recv_rs_at_send);
+#ifdef ROLEX_RING_RPC
+      auto receiver = RecvTrait::create_receiver("c" + std::to_string(thread_id), recv_cq);
+      ASSERT(sender.reg_to(receiver));
+      RecvTrait recv_s(receiver);
+#elif defined(ROLEX_SHM_RPC)
+      RecvTrait recv_s(inbox);
+#else
+      RecvTrait recv_s(ud_qp, recv_rs_at_send);
+#endif
       /**
        * @brief Generate test data
        *        Send RPC requests
@@ -131,6 +178,25 @@ auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<X
             char reply_buf[1024];
             RPCOp op;
 
+            // pipelined reads: issue a batch of GETs, then wait for all of them
+            if(BenConfig.pipeline > 1 && BenConfig.read_ratio >= 1) {
+              std::vector<RPCFuture> inflight(BenConfig.pipeline);
+              while(running) {
+                for(auto &f : inflight) {
+                  KeyType dummy_key = exist_keys[query_i % exist_keys.size()];
+                  f = remote_search_async(dummy_key, rpc, sender, R2_ASYNC_WAIT);
+                  query_i++;
+                  if (unlikely(query_i == exist_keys.size())) {
+                    query_i = 0;
+                  }
+                }
+                for(auto &f : inflight) {
+                  f.wait(R2_ASYNC_WAIT);
+                  f.release();
+                }
+              }
+            }
+
             while(running) {
               double d = ratio_dis(gen);
               if(d <= BenConfig.read_ratio) {    // search
@@ -181,7 +247,7 @@ auto rolex_client_worker(const usize& nthreads) -> std::vector<std::unique_ptr<X
 
 auto remote_search(const KeyType& key,
           RPC& rpc,
-          UDTransport& sender,
+          SendTrait& sender,
           R2_ASYNC) -> ::r2::Option<ValType>
 {
 
@@ -194,7 +260,7 @@ auto remote_search(const KeyType& key,
     .set_rpc_id(GET)
     .set_corid(R2_COR_ID())
     .add_one_reply(rpc.reply_station,
-                   { .mem_ptr = reply_buf, .sz = sizeof(ReplyValue) })
+                   MemBlock(reply_buf, sizeof(ReplyValue)))
     .add_arg<KeyType>(key);
   ASSERT(rpc.reply_station.cor_ready(R2_COR_ID()) == false);
   auto ret = op.execute_w_key(&sender, 0);
@@ -213,12 +279,34 @@ auto remote_search(const KeyType& key,
 
 
 
-void remote_put(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& sender, R2_ASYNC)
+/**
+ * @brief Send a GET without waiting for its reply, the reply is stored in the
+ *        inline buffer of the reply station.
+ *        Callers wait on the returned future and release it after use.
+ */
+auto remote_search_async(const KeyType& key,
+          RPC& rpc,
+          SendTrait& sender,
+          R2_ASYNC) -> RPCFuture
 {
-  std::string data;
-  data += ::xstore::util::Marshal<KeyType>::serialize_to(key);
-  data += ::xstore::util::Marshal<ValType>::serialize_to(val);
+  char send_buf[64];
+  RPCFuture f;
 
+  RPCOp op;
+  op.set_msg(MemBlock(send_buf, 64))
+    .set_req()
+    .set_rpc_id(GET)
+    .set_corid(R2_COR_ID())
+    .add_future_reply(rpc.reply_station, f)
+    .add_arg<KeyType>(key);
+  auto ret = op.execute_w_key(&sender, 0);
+  ASSERT(ret == IOCode::Ok);
+  return f;
+}
+
+
+void remote_put(const KeyType& key, const ValType& val, RPC& rpc, SendTrait& sender, R2_ASYNC)
+{
   char send_buf[64];
   char reply_buf[sizeof(ReplyValue)];
   RPCOp op;
@@ -227,8 +315,10 @@ void remote_put(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& s
     .set_rpc_id(PUT)
     .set_corid(R2_COR_ID())
     .add_one_reply(rpc.reply_station,
-                   { .mem_ptr = reply_buf, .sz = sizeof(ReplyValue) })
-    .add_opaque(data);
+                   MemBlock(reply_buf, sizeof(ReplyValue)));
+  auto args = op.emplace_arg<KVArgs>();
+  args->key = key;
+  args->val = val;
   ASSERT(op.execute_w_key(&sender, 0) == IOCode::Ok);
 
   // yield to the next coroutine
@@ -236,12 +326,8 @@ void remote_put(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& s
 }
 
 
-void remote_update(const KeyType& key, const ValType& val, RPC& rpc, UDTransport& sender, R2_ASYNC)
+void remote_update(const KeyType& key, const ValType& val, RPC& rpc, SendTrait& sender, R2_ASYNC)
 {
-  std::string data;
-  data += ::xstore::util::Marshal<KeyType>::serialize_to(key);
-  data += ::xstore::util::Marshal<ValType>::serialize_to(val);
-
   char send_buf[64];
   char reply_buf[sizeof(ReplyValue)];
   RPCOp op;
@@ -250,8 +336,10 @@ void remote_update(const KeyType& key, const ValType& val, RPC& rpc, UDTransport
     .set_rpc_id(UPDATE)
     .set_corid(R2_COR_ID())
     .add_one_reply(rpc.reply_station,
-                   { .mem_ptr = reply_buf, .sz = sizeof(ReplyValue) })
-    .add_opaque(data);
+                   MemBlock(reply_buf, sizeof(ReplyValue)));
+  auto args = op.emplace_arg<KVArgs>();
+  args->key = key;
+  args->val = val;
   ASSERT(op.execute_w_key(&sender, 0) == IOCode::Ok);
 
   // yield to the next coroutine
@@ -259,11 +347,8 @@ void remote_update(const KeyType& key, const ValType& val, RPC& rpc, UDTransport
 }
 
 
-void remote_remove(const KeyType& key, RPC& rpc, UDTransport& sender, R2_ASYNC)
+void remote_remove(const KeyType& key, RPC& rpc, SendTrait& sender, R2_ASYNC)
 {
-  std::string data;
-  data += ::xstore::util::Marshal<KeyType>::serialize_to(key);
-
   char send_buf[64];
   char reply_buf[sizeof(ReplyValue)];
   RPCOp op;
@@ -272,34 +357,40 @@ void remote_remove(const KeyType& key, RPC& rpc, UDTransport& sender, R2_ASYNC)
     .set_rpc_id(DELETE)
     .set_corid(R2_COR_ID())
     .add_one_reply(rpc.reply_station,
-                   { .mem_ptr = reply_buf, .sz = sizeof(ReplyValue) })
-    .add_opaque(data);
+                   MemBlock(reply_buf, sizeof(ReplyValue)))
+    .add_arg<KeyType>(key);
   ASSERT(op.execute_w_key(&sender, 0) == IOCode::Ok);
 
   // yield to the next coroutine
   R2_PAUSE_AND_YIELD;
 }
 
-void remote_scan(const KeyType& key, const u64& n, RPC& rpc, UDTransport& sender, R2_ASYNC)
+/**
+ * @brief The scanned values are read in place in the receive buffer,
+ *        which is re-posted after the future is released.
+ *        The RC ring transport can not hold the buffer, so it delivers a copy
+ * 
+ */
+void remote_scan(const KeyType& key, const u64& n, RPC& rpc, SendTrait& sender, R2_ASYNC)
 {
-  std::string data;
-  data += ::xstore::util::Marshal<KeyType>::serialize_to(key);
-  data += ::xstore::util::Marshal<u64>::serialize_to(n);
-
   char send_buf[64];
-  char reply_buf[sizeof(ReplyValue)];
+  RPCFuture f;
   RPCOp op;
   op.set_msg(MemBlock(send_buf, 64))
     .set_req()
     .set_rpc_id(SCAN)
     .set_corid(R2_COR_ID())
-    .add_one_reply(rpc.reply_station,
-                   { .mem_ptr = reply_buf, .sz = sizeof(ReplyValue) })
-    .add_opaque(data);
+    .add_borrowed_reply(rpc.reply_station, f);
+  auto args = op.emplace_arg<ScanArgs>();
+  args->key = key;
+  args->n = n;
   ASSERT(op.execute_w_key(&sender, 0) == IOCode::Ok);
 
-  // yield to the next coroutine
-  R2_PAUSE_AND_YIELD;
+  f.wait(R2_ASYNC_WAIT);
+  auto reply = f.reply_as<ReplyValue>();
+  ASSERT(reply->status && reply->val <= kMaxScanVals);
+  // the values follow the ReplyValue, consume them before releasing
+  f.release();
 }
 
 
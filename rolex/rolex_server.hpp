@@ -5,6 +5,8 @@
 #include "r2/src/thread.hh"                   /// Thread
 #include "xcomm/tests/transport_util.hh"      /// SimpleAllocator
 #include "xcomm/src/transport/rdma_ud_t.hh"   /// UDTransport, UDRecvTransport, UDSessionManager
+#include "xcomm/src/transport/rdma_ring_t.hh" /// RRingTransport, RRingRecvTransport, RRingSessionManager
+#include "xcomm/src/transport/shm_t.hh"       /// ShmTransport, ShmRecvTransport, ShmSessionManager
 #include "xcomm/src/rpc/mod.hh"               /// RPCCore
 #include "xutils/local_barrier.hh"            /// PBarrier
 
@@ -29,13 +31,35 @@ namespace rolex {
 
 #define RECV_NUM 2048
 
+#ifdef ROLEX_RING_RPC
+using SendTrait = RRingTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using RecvTrait = RRingRecvTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using SManager = RRingSessionManager<kRingEntry, kRingSz, kRingMaxMsg>;
+
+// the ring connections are handled by the RCtrl, so a manager is shared by all the threads
+inline auto rolex_ring_manager() -> RingManager<kRingEntry>& {
+  static RingManager<kRingEntry> rm(*ctrl);
+  return rm;
+}
+#elif defined(ROLEX_SHM_RPC)
+using SendTrait = ShmTransport<kShmSlots>;
+using RecvTrait = ShmRecvTransport<kShmSlots>;
+using SManager = ShmSessionManager<kShmSlots>;
+#else
 using SendTrait = UDTransport;
 using RecvTrait = UDRecvTransport<RECV_NUM>;
 using SManager = UDSessionManager<RECV_NUM>;
+#endif
 using XThread = ::r2::Thread<usize>;   // <usize> represents the return type of a function
 
-thread_local char* rpc_large_reply_buf = nullptr;
-thread_local u32 rpc_large_reply_key;
+// replies are built in place in registered buffers, a slot is reused after RECV_NUM replies
+using ReplyBufs = SendBufRing<RECV_NUM, 64>;
+thread_local ReplyBufs rpc_reply_bufs;
+// scan replies carry the values, so they use larger slots.
+// A UD session signals once per max_send_sz()/2 sends, so up to max_send_sz() sends are in flight
+// and a slot is reused only after twice that many replies.
+using ScanReplyBufs = SendBufRing<2 * ::rdmaio::qp::kRcMaxSendSz, 4096>;
+thread_local ScanReplyBufs rpc_scan_reply_bufs;
 
 void rolex_get_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc);
 void rolex_put_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc);
@@ -43,6 +67,14 @@ void rolex_update_callback(const Header& rpc_header, const MemBlock& args, SendT
 void rolex_remove_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc);
 void rolex_scan_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc);
 
+// the callbacks are dispatched statically with the RPCId
+using RolexRPCTable = StaticRPCTable<SendTrait,
+                                     RPCHandler<GET, rolex_get_callback>,
+                                     RPCHandler<PUT, rolex_put_callback>,
+                                     RPCHandler<UPDATE, rolex_update_callback>,
+                                     RPCHandler<DELETE, rolex_remove_callback>,
+                                     RPCHandler<SCAN, rolex_scan_callback>>;
+
 
 auto rolex_server_workers(const usize& nthreads) -> std::vector<std::unique_ptr<XThread>>{
   std::vector<std::unique_ptr<XThread>> res;
@@ -54,41 +86,61 @@ auto rolex_server_workers(const usize& nthreads) -> std::vector<std::unique_ptr<
        */
       // create NIC and QP
       auto thread_id = i;
+      // run next to the NIC, which serves the leaves with one-sided RDMA
+      {
+        auto nic = ctrl->opened_nics.query(0).value();
+        numa::pin_to_node(numa::node_of_nic(ibv_get_device_name(nic->get_ctx()->device)), thread_id);
+      }
+#ifdef ROLEX_RING_RPC
+      // the ring QPs are created by the RCtrl with its NIC, so the rings must be registered with it
+      auto nic_for_recv = ctrl->opened_nics.query(0).value();
+#else
       auto nic_for_recv = RNic::create(RNicInfo::query_dev_names().at(0)).value();
-      auto qp_recv = UD::create(nic_for_recv, QPConfig()).value();
-      // prepare UD recv buffer
+#endif
       auto mem_region = HugeRegion::create(64 * 1024 * 1024).value();
       auto mem = mem_region->convert_to_rmem().value();
       auto handler = RegHandler::create(mem, nic_for_recv).value();
+      auto alloc = Arc<SimpleAllocator>(new SimpleAllocator(mem, handler->get_reg_attr().value()));
+#ifdef ROLEX_RING_RPC
+      // the clients connect to the receiver by its name, the sessions are created on the connection
+      auto recv_cq = std::get<0>(::rdmaio::qp::Impl::create_cq(nic_for_recv, RECV_NUM).desc);
+      auto receiver = RecvFactory<kRingEntry, kRingSz, kRingMaxMsg>::create(
+        rolex_ring_manager(), "b" + std::to_string(thread_id), recv_cq, alloc).value();
+#elif defined(ROLEX_SHM_RPC)
+      // the co-located clients connect to the inbox by its name
+      auto inbox = ShmInbox<kShmSlots>::create("/rolex-b" + std::to_string(thread_id), kShmRings).value();
+#else
+      auto qp_recv = UD::create(nic_for_recv, QPConfig()).value();
       // Post receive buffers to QP and transition QP to RTR state
-      SimpleAllocator alloc(mem, handler->get_reg_attr().value());
       auto recv_rs_at_recv =
-        RecvEntriesFactory<SimpleAllocator, RECV_NUM, 4096>::create(alloc);
+        RecvEntriesFactory<SimpleAllocator, RECV_NUM, 4096>::create(*alloc);
       {
         auto res = qp_recv->post_recvs(*recv_rs_at_recv, RECV_NUM);
         RDMA_ASSERT(res == IOCode::Ok);
       }
       // register the UD for connection
       ctrl->registered_qps.reg("b" + std::to_string(thread_id), qp_recv);
+#endif
       // LOG(4) << "server thread #" << thread_id << " started!";
 
       /**
        * @brief Construct RPC
        * 
        */
-      RPCCore<SendTrait, RecvTrait, SManager> rpc(12);
+      RPCCore<SendTrait, RecvTrait, SManager, RolexRPCTable> rpc(1);
       {
-        auto large_buf = alloc.alloc_one(1024).value();
-        rpc_large_reply_buf = static_cast<char*>(std::get<0>(large_buf));
-        rpc_large_reply_key = std::get<1>(large_buf);
+        auto reply_buf = alloc->alloc_one(ReplyBufs::total_sz()).value();
+        rpc_reply_bufs = ReplyBufs(static_cast<char*>(std::get<0>(reply_buf)), std::get<1>(reply_buf));
+        auto scan_buf = alloc->alloc_one(ScanReplyBufs::total_sz()).value();
+        rpc_scan_reply_bufs = ScanReplyBufs(static_cast<char*>(std::get<0>(scan_buf)), std::get<1>(scan_buf));
       }
-      UDRecvTransport<RECV_NUM> recv(qp_recv, recv_rs_at_recv);
-      // register the callbacks before enter the main loop
-      ASSERT(rpc.reg_callback(rolex_get_callback) == GET);
-      ASSERT(rpc.reg_callback(rolex_put_callback) == PUT);
-      ASSERT(rpc.reg_callback(rolex_update_callback) == UPDATE);
-      ASSERT(rpc.reg_callback(rolex_remove_callback) == DELETE);
-      ASSERT(rpc.reg_callback(rolex_scan_callback) == SCAN);
+#ifdef ROLEX_RING_RPC
+      RecvTrait recv(receiver);
+#elif defined(ROLEX_SHM_RPC)
+      RecvTrait recv(inbox);
+#else
+      RecvTrait recv(qp_recv, recv_rs_at_recv);
+#endif
       r2::compile_fence();
 
       bar->wait();
@@ -99,6 +151,14 @@ auto rolex_server_workers(const usize& nthreads) -> std::vector<std::unique_ptr<
         r2::compile_fence();
         rpc.recv_event_loop(&recv);
       }
+#ifdef ROLEX_RTM
+      RTMStats::local().flush();
+      if (thread_id == 0) {
+        auto &rtm = RTMStats::global();
+        LOG(2) << "[server] RTM leaf writes committed: " << rtm.commits << ", locked: " << rtm.fallbacks
+               << ", abort ratio: " << rtm.abort_ratio();
+      }
+#endif
 
       return 0;
     })));
@@ -108,105 +168,78 @@ auto rolex_server_workers(const usize& nthreads) -> std::vector<std::unique_ptr<
 
 
 
+/**
+ * @brief Build the reply in place in the registered reply ring and send it
+ * 
+ */
+inline void rolex_send_reply(const Header& rpc_header, const bool& status, const ValType& val, SendTrait* replyc) {
+  RPCOp op;
+  op.set_msg(rpc_reply_bufs.next()).set_reply_to(rpc_header);
+  auto reply = op.emplace_arg<ReplyValue>();
+  reply->status = status;
+  reply->val = val;
+  ASSERT(op.execute_w_key(replyc, rpc_reply_bufs.lkey) == IOCode::Ok);
+}
+
 void rolex_get_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc) {
-	// sanity check the requests
+  // sanity check the requests
   ASSERT(args.sz == sizeof(KeyType));
-  KeyType key = *(reinterpret_cast<KeyType*>(args.mem_ptr));
-	// GET
-	ValType dummy_value = 1234;    //store  the obtained value
-	bool res = rolex_index->search(key, dummy_value);
-	ReplyValue reply;
-  if(res) {
-    reply = { .status = true, .val = dummy_value };
-  } else {
-    reply = { .status = false, .val = dummy_value };
-  }
-  // send
-  char reply_buf[64];
-  RPCOp op;
-  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply().add_arg(reply));
-  op.set_corid(rpc_header.cor_id);
-  // LOG(3)<<"GET: " << *(args.interpret_as<u64>());
-  ASSERT(op.execute(replyc) == IOCode::Ok);
+  const KeyType& key = args_as<KeyType>(args);
+  // GET
+  ValType dummy_value = 1234;    //store  the obtained value
+  bool res = rolex_index->search(key, dummy_value);
+  rolex_send_reply(rpc_header, res, dummy_value, replyc);
 }
 
 void rolex_put_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc) {
-	// sanity check the requests
-  ASSERT(args.sz == sizeof(KeyType)+sizeof(ValType));
-	KeyType key = *args.interpret_as<KeyType>();
-  ValType val = *args.interpret_as<ValType>(sizeof(KeyType));
-	// insert
-	rolex_index->insert(key, val);
-	ReplyValue reply;
-	// send
-  char reply_buf[64];
-  RPCOp op;
-  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply().add_arg(reply));
-  op.set_corid(rpc_header.cor_id);
-  //LOG(3) << "Put key:" << key;
-  ASSERT(op.execute(replyc) == IOCode::Ok);
+  // sanity check the requests
+  ASSERT(args.sz == sizeof(KVArgs));
+  const KVArgs& kv = args_as<KVArgs>(args);
+  // insert
+  bool res = rolex_index->insert(kv.key, kv.val);
+  rolex_send_reply(rpc_header, res, kv.val, replyc);
 }
 
 
 void rolex_update_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc){
-	// sanity check the requests
-  ASSERT(args.sz == sizeof(KeyType)+sizeof(ValType));
-	KeyType key = *args.interpret_as<KeyType>();
-  ValType val = *args.interpret_as<ValType>(sizeof(KeyType));
-	// UPDATE
-	bool res = rolex_index->update(key, val);
-	ReplyValue reply;
-  if(res) {
-    reply = { .status = true, .val = val };
-  } else {
-    reply = { .status = false, .val = val };
-  }
-  // send
-  char reply_buf[64];
-  RPCOp op;
-  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply().add_arg(reply));
-  op.set_corid(rpc_header.cor_id);
-  ASSERT(op.execute(replyc) == IOCode::Ok);
+  // sanity check the requests
+  ASSERT(args.sz == sizeof(KVArgs));
+  const KVArgs& kv = args_as<KVArgs>(args);
+  // UPDATE
+  bool res = rolex_index->update(kv.key, kv.val);
+  rolex_send_reply(rpc_header, res, kv.val, replyc);
 }
 
 
 void rolex_remove_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc){
-	// sanity check the requests
+  // sanity check the requests
   ASSERT(args.sz == sizeof(KeyType));
-	KeyType key = *args.interpret_as<KeyType>();
-	// UPDATE
-	bool res = rolex_index->remove(key);
-	ReplyValue reply;
-  if(res) {
-    reply = { .status = true, .val = 0 };
-  } else {
-    reply = { .status = false, .val = 0 };
-  }
-  // send
-  char reply_buf[64];
-  RPCOp op;
-  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply().add_arg(reply));
-  op.set_corid(rpc_header.cor_id);
-  ASSERT(op.execute(replyc) == IOCode::Ok);
+  const KeyType& key = args_as<KeyType>(args);
+  // REMOVE
+  bool res = rolex_index->remove(key);
+  rolex_send_reply(rpc_header, res, 0, replyc);
 }
 
 
 void rolex_scan_callback(const Header& rpc_header, const MemBlock& args, SendTrait* replyc){
-	// sanity check the requests
-  ASSERT(args.sz == sizeof(KeyType)+sizeof(u64));
-	KeyType key = *args.interpret_as<KeyType>();
-  ValType n = *args.interpret_as<ValType>(sizeof(KeyType));
-	// UPDATE
+  // sanity check the requests
+  ASSERT(args.sz == sizeof(ScanArgs));
+  const ScanArgs& scan = args_as<ScanArgs>(args);
+  // SCAN
   std::vector<V> result;
-	rolex_index->range(key, n, result);
-	ReplyValue reply;
-  // send
-  char reply_buf[64];
+  rolex_index->range(scan.key, std::min<u64>(scan.n, kMaxScanVals), result);
+  auto n = std::min<usize>(result.size(), kMaxScanVals);
+  // reply [ReplyValue{true, n} | values]
   RPCOp op;
-  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply().add_arg(reply));
-  op.set_corid(rpc_header.cor_id);
-  ASSERT(op.execute(replyc) == IOCode::Ok);
+  op.set_msg(rpc_scan_reply_bufs.next()).set_reply_to(rpc_header);
+  auto reply = op.emplace_arg<ReplyValue>();
+  reply->status = true;
+  reply->val = n;
+  for (usize i = 0; i < n; ++i) {
+    ASSERT(op.add_arg<ValType>(result[i]));
+  }
+  ASSERT(op.execute_w_key(replyc, rpc_scan_reply_bufs.lkey) == IOCode::Ok);
 }
   
 
-}
\ No newline at end of file
+}
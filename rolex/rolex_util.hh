@@ -11,6 +11,25 @@ namespace rolex {
 // preserve 2M space for upper models, which accommodates 131,072 models
 constexpr uint64_t kUpperModel = 32 * 1024 * 1024;
 
+// the layout version of the model region and the version acked by each compute node, after the upper models:
+// [version | ack of cache 0 | ack of cache 1 | ...], the submodels follow them.
+// The version is odd while the memory node rewrites the model region, and starts at kFirstLayout;
+// an ack of 0 is a free slot, and a cache registers with kNoLayout, below any version.
+constexpr uint64_t kMaxCaches = 1024;
+constexpr uint64_t kLayoutOff = kUpperModel;
+constexpr uint64_t kLayoutSz = (1 + kMaxCaches) * sizeof(uint64_t);
+constexpr uint64_t kFirstLayout = 2;
+constexpr uint64_t kNoLayout = 1;
+
+inline constexpr auto ack_off(const uint64_t &cache) -> uint64_t {
+  return kLayoutOff + (1 + cache) * sizeof(uint64_t);
+}
+
+// each submodel is [synced filter version | live filter version | size | submodel], 8-byte aligned,
+// and its offset in the upper models is the one of the size.
+// The live version is bumped by each key added to the filter, the synced one is the version of the bits written.
+constexpr uint64_t kSubmodelHeader = 2 * sizeof(uint64_t);
+
 
 // ====== for binary search =========
 #define FORCEINLINE __attribute__((always_inline)) inline
@@ -2,9 +2,12 @@
 
 #include <math.h>
 #include <algorithm>
+#include <memory>
 #include "r2/src/common.hh"
 #include "leaf_table.hpp"
 #include "leaf.hpp"
+#include "delta_buffer.hpp"
+#include "bloom_filter.hpp"
 
 
 #define SUB_EPS(x, epsilon) ((x) <= (epsilon) ? 0 : ((x) - (epsilon)))
@@ -50,6 +53,8 @@ public:
     auto lo = SUB_EPS(pos, Epsilon);
     auto hi = ADD_EPS(pos, Epsilon, size);
     lo = lo>hi? hi:lo;
+    // the predicted position is a hint of the in-leaf search, keep it in the window
+    pos = pos<lo? lo:(pos>hi? hi:pos);
     // return {static_cast<size_t>(ceil(pos)), static_cast<size_t>(ceil(lo)), static_cast<size_t>(ceil(hi))};
     return {static_cast<size_t>(pos), static_cast<size_t>(lo), static_cast<size_t>(hi)};
   }
@@ -64,11 +69,19 @@ template<typename K, typename V, typename leaf_t, typename leaf_alloc_t, size_t
 class SubModel {
   using lr_model_t = LinearRegressionModel<K, Epsilon>;
   using leaf_table_t = struct LeafTable<K, V, leaf_t, leaf_alloc_t>;
+  using delta_buffer_t = DeltaBuffer<K, V>;
+  using filter_t = BloomFilter<K>;
+  static constexpr usize kDefragSpare = 4;
 
 private:
   lr_model_t model;
   leaf_table_t ltable;
   size_t capacity;
+  size_t slots;           /// the KVs per leaf at bulk loading, the rest of a leaf is left for inserts
+  std::shared_ptr<delta_buffer_t> delta;    /// absorbs the inserts if enabled, only on the memory node
+  std::shared_ptr<filter_t> filter;         /// the keys of the submodel if enabled, the counters on the memory node
+  u64* filter_live = nullptr;               /// the version in the model region, bumped by each key added to the filter
+  u64 filter_synced = 0;                    /// the version of the bits of a copy of the filter
 
 public:
   /**
@@ -80,7 +93,8 @@ public:
   explicit SubModel(double slope, double intercept,
                     const typename std::vector<K>::const_iterator &keys_begin,
                     const typename std::vector<V>::const_iterator &vals_begin, 
-                    size_t size, leaf_alloc_t* alloc) : model(slope, intercept), capacity(size), ltable()
+                    size_t size, leaf_alloc_t* alloc) : model(slope, intercept), capacity(size), ltable(),
+                                                        slots(leaf_t::max_slot())
   {
     assert(size>0);
     auto res = alloc->fetch_new_leaf();
@@ -96,10 +110,22 @@ public:
     }
   }
 
+  /**
+   * @brief Construct with the leaves already filled, e.g., by the streaming bulk loader
+   * 
+   * @param size the number of KVs in the leaves
+   * @param slots the number of KVs put in each leaf, i.e., the i-th KV is in the (i/slots)-th leaf
+   */
+  explicit SubModel(double slope, double intercept, size_t size, leaf_table_t &&ltable,
+                    size_t slots = leaf_t::max_slot())
+      : model(slope, intercept), ltable(std::move(ltable)), capacity(size), slots(slots) {
+    assert(size>0 && slots>0 && slots<=leaf_t::max_slot());
+  }
+
   // ============== functions for serialization and deserialization ================
   explicit SubModel(const std::string_view& seria) : model(0, 0), ltable() {
     i32 model_size = sizeof(double)*2;
-    ASSERT(seria.size() >= model_size + sizeof(size_t) + sizeof(i32)) << "submodel seria.size(): "<<seria.size();
+    ASSERT(seria.size() >= model_size + sizeof(size_t)*2 + sizeof(i32)) << "submodel seria.size(): "<<seria.size();
     char* cur_ptr = (char *)seria.data();
     // model
     std::string modelSeria(cur_ptr, model_size);
@@ -108,85 +134,266 @@ public:
     // capacity
     this->capacity = ::xstore::util::Marshal<size_t>::deserialize(cur_ptr, seria.size());
     cur_ptr += sizeof(size_t);
+    // slots
+    this->slots = ::xstore::util::Marshal<size_t>::deserialize(cur_ptr, seria.size());
+    cur_ptr += sizeof(size_t);
     // ltable
     i32 ltable_size = ::xstore::util::Marshal<i32>::deserialize(cur_ptr, seria.size());
     cur_ptr += sizeof(i32);
-    ASSERT(seria.size() == model_size + sizeof(size_t) + sizeof(i32) + ltable_size)
+    ASSERT(seria.size() >= model_size + sizeof(size_t)*2 + sizeof(i32)*2 + ltable_size)
       <<"submodel seria.size(): "<<seria.size()<<", ltable_size: "<<ltable_size;
     std::string ltableSeria(cur_ptr, ltable_size);
     this->ltable.deserialize(ltableSeria);
+    cur_ptr += ltable_size;
+    // filter
+    i32 filter_size = ::xstore::util::Marshal<i32>::deserialize(cur_ptr, seria.size());
+    cur_ptr += sizeof(i32);
+    ASSERT(seria.size() == model_size + sizeof(size_t)*2 + sizeof(i32)*2 + ltable_size + filter_size)
+      <<"submodel seria.size(): "<<seria.size()<<", ltable_size: "<<ltable_size<<", filter_size: "<<filter_size;
+    if(filter_size > 0) this->filter = std::make_shared<filter_t>(std::string_view(cur_ptr, filter_size));
   }
 
   /**
    * @brief The sequence of serialization:
-   *             model, capacity, ltable_size, ltable
+   *             model, capacity, slots, ltable_size, ltable, filter_size, filter (the bits, empty if disabled)
    */
   auto serialize() -> std::string {
     std::string res;
     res += this->model.serialize();
     res += ::xstore::util::Marshal<size_t>::serialize_to(this->capacity);
+    res += ::xstore::util::Marshal<size_t>::serialize_to(this->slots);
     auto ltableSeria = this->ltable.serialize();
     res += ::xstore::util::Marshal<i32>::serialize_to(ltableSeria.size());
     res += ltableSeria;
+    auto filterSeria = filter ? filter->serialize() : std::string();
+    res += ::xstore::util::Marshal<i32>::serialize_to(filterSeria.size());
+    res += filterSeria;
     return res;
   }
 
   // ========= API functions for memory nodes {debugging} : search, update, insert, remove ===========
+  // With the delta buffer, a key is in the buffer or in the leaves.
+  // The compaction inserts a KV into the leaves before it leaves the buffer,
+  // so the lookups check the buffer first.
+  // With the filter, a key is added before it is inserted and removed after it is removed,
+  // so a lookup skips the leaves of a key absent from the filter.
+  // The version of the filter is bumped after a key is added, so a copy of the bits written at a version
+  // has every key added before it.
   auto search(const K &key, V &val, leaf_alloc_t* alloc) -> bool {
+    if(!may_contain(key)) return false;
+    if(delta && delta->search(key, val)) return true;
     auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
+    lo /= slots;
+    hi /= slots;
     int l=std::max((int)lo, 0);
     int h=std::max((int)hi, 0);
-    return ltable.search(key, val, alloc, l, h);
+    return ltable.search(key, val, alloc, l, h, slot_hint(pre));
   }
 
   auto update(const K &key, const V &val, leaf_alloc_t* alloc) -> bool {
+    if(!may_contain(key)) return false;
+    if(delta) {
+      delta->lock.lock();
+      bool res = delta->update(key, val);
+      delta->lock.unlock();
+      if(res) return true;
+    }
     auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
+    lo /= slots;
+    hi /= slots;
     int l=std::max((int)lo, 0);
     int h=std::max((int)hi, 0);
     return ltable.update(key, val, alloc, l, h);
   }
 
+  /**
+   * @brief With the delta buffer, the inserts of the submodel are serialized by its lock,
+   *          and go to the leaves only if the buffer is full
+   */
   auto insert(const K &key, const V &val, leaf_alloc_t* alloc) -> bool {
-    auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
-    int l=std::max((int)lo, 0);
-    int h=std::max((int)hi, 0);
-    // LOG(2) << "model predict leaf l: " <<l<<", h: "<<h;
-    return ltable.insert(key, val, alloc, l, h);
+    if(filter) {
+      filter->add(key);
+      if(filter_live) __atomic_add_fetch(filter_live, 1, __ATOMIC_RELEASE);
+    }
+    bool res = false;
+    if(!delta) {
+      res = insert_leaves(key, val, alloc);
+    } else {
+      delta->lock.lock();
+      V dummy;
+      if(!delta->contain(key) && !search(key, dummy, alloc)) {
+        res = delta->insert(key, val) || insert_leaves(key, val, alloc);
+      }
+      delta->lock.unlock();
+    }
+    // e.g., the key exists, which is added once more
+    if(filter && !res) filter->remove(key);
+    return res;
   }
 
   auto remove(const K &key, leaf_alloc_t* alloc) -> bool {
-    auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
-    int l=std::max((int)lo, 0);
-    int h=std::max((int)hi, 0);
-    return ltable.remove(key, alloc, l, h);
+    if(!may_contain(key)) return false;
+    bool res = false;
+    if(delta) {
+      delta->lock.lock();
+      res = delta->remove(key);
+      delta->lock.unlock();
+    }
+    if(!res) {
+      auto[pre, lo, hi] = this->model.predict(key, capacity);
+      lo /= slots;
+      hi /= slots;
+      int l=std::max((int)lo, 0);
+      int h=std::max((int)hi, 0);
+      res = ltable.remove(key, alloc, l, h);
+    }
+    if(filter && res) filter->remove(key);
+    return res;
   }
 
+  /**
+   * @brief The delta buffer is merged first, as the leaves return no keys to merge with
+   */
   void range(const K& key, const int n, std::vector<V> &vals, leaf_alloc_t* alloc) {
+    compact(alloc);
     auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
+    lo /= slots;
+    hi /= slots;
     int l=std::max((int)lo, 0);
     int h=std::max((int)hi, 0);
     ltable.range(key, n, vals, alloc, l, h);
   }
 
+  // ================ functions for the delta buffer =================
+  void enable_delta(const usize &cap) {
+    ASSERT(cap > 0) << "empty delta buffer";
+    delta = std::make_shared<delta_buffer_t>(cap);
+  }
+
+  auto delta_size() const -> usize { return delta ? delta->size() : 0; }
+
+  auto delta_pending() const -> usize { return delta ? delta->pending() : 0; }
+
+  /**
+   * @brief Merge the delta buffer into the leaves
+   *
+   * @return usize the number of the merged KVs, the ones failed to insert are kept in the buffer
+   */
+  auto compact(leaf_alloc_t* alloc) -> usize {
+    if(!delta || delta->isEmpty()) return 0;
+    delta->lock.lock();
+    auto res = delta->drain([&](const K &key, const V &val) { return insert_leaves(key, val, alloc); });
+    delta->lock.unlock();
+    return res;
+  }
+
+  // ================ functions for the filter =================
+  /**
+   * @brief Build the filter over the keys of the submodel, given by their hashes, e.g., collected at bulk loading.
+   *          Called before the submodel is written into the model region, whose size includes the filter.
+   *
+   * @param bits_per_key the bits per key of the filter, for the keys given
+   */
+  void enable_filter(const double &bits_per_key, const std::vector<u64> &hashes) {
+    filter = std::make_shared<filter_t>(hashes.size(), bits_per_key);
+    for(auto h : hashes) filter->add_hash(h);
+  }
+
+  /**
+   * @return false if the key is absent, always true without the filter or with a copy missing the keys added since
+   */
+  auto may_contain(const K &key) const -> bool { return filter_may_contain(key) || !filter_current(); }
+
+  /**
+   * @brief The answer of the filter alone, which a copy gives as of filter_version()
+   */
+  auto filter_may_contain(const K &key) const -> bool { return !filter || filter->may_contain(key); }
+
+  /**
+   * @brief Whether the filter has every key added: it is the one of the memory node,
+   *          or a copy whose version is the one in the model region
+   */
+  auto filter_current() const -> bool {
+    if(!filter || filter->counting()) return true;
+    return filter_live && __atomic_load_n(filter_live, __ATOMIC_ACQUIRE) == filter_synced;
+  }
+
+  /**
+   * @param live the version in the model region
+   * @param synced the version of the bits, for a copy read from the model region
+   */
+  void set_filter_version(u64* live, const u64 &synced = 0) {
+    filter_live = live;
+    filter_synced = synced;
+  }
+
+  auto filter_version() const -> u64 { return filter_synced; }
+
+  auto filter_bytes() const -> usize { return filter ? filter->size() : 0; }
+
+  // ================ functions for the defragmentation =================
+  /**
+   * @brief The runs of consecutive leaves in key order, 1 if a compute node reads any window with one RDMA read
+   */
+  auto leaf_runs() -> usize { return ltable.runs(); }
+
+  /**
+   * @brief Move the synonym leaves unlinked since the last call into out, which the copies serialized later never link
+   */
+  void take_unlinked(std::vector<u64> &out) { ltable.take_unlinked(out); }
+
+  auto has_unlinked() -> bool { return ltable.has_unlinked(); }
+
+  /**
+   * @brief Relocate the leaves and their synonym leaves into one run of consecutive leaves in key order.
+   *          The leaves are moved one primary leaf at a time under its lock, so the writers of the others go on.
+   *
+   * @param old the relocated leaves, which the caller retires once the compute nodes no longer read them
+   * @return usize the number of the relocated primary leaves, 0 if the pool has no run left
+   */
+  auto defrag(leaf_alloc_t* alloc, std::vector<u64> &old) -> usize {
+    // spare leaves for the splits during the relocation
+    const usize n = ltable.window_leaves(0, ltable.table_size() - 1) + kDefragSpare;
+    auto run = alloc->fetch_leaf_run(n);
+    if(!run) return 0;
+    u64 next = run->second;
+    const u64 end = next + n;
+    usize moved = 0;
+    // the leaves of a split after the run is reserved are left in place
+    while(moved < ltable.table_size() && ltable.relocate(moved, next, end, alloc, old)) moved++;
+    // the spare leaves left are never read by the compute nodes
+    alloc->retire_run(next, end - next);
+    return moved;
+  }
+
   // ================ API functions for compute nodes : search, update, insert, remove ===========
-  auto get_leaf_addr(const K &key, std::vector<leaf_addr_t> &leaves) {
+  /**
+   * @return SlotHint where to start the search in each leaf, by the off of its address
+   */
+  auto get_leaf_addr(const K &key, std::vector<leaf_addr_t> &leaves) -> SlotHint {
     auto[pre, lo, hi] = this->model.predict(key, capacity);
-    lo /= leaf_t::max_slot();
-    hi /= leaf_t::max_slot();
+    lo /= slots;
+    hi /= slots;
     this->ltable.get_leaf_addr(lo, hi, leaves);
+    return slot_hint(pre);
   }
 
 
+  auto leaf_slots() const -> size_t { return slots; }
+
+  /**
+   * @brief The i-th KV is in the (i/slots)-th leaf at bulk loading, which the inserts shift by a few slots
+   */
+  inline auto slot_hint(const size_t &pre) const -> SlotHint { return {static_cast<usize>(pre / slots), static_cast<usize>(pre % slots)}; }
+
+  /**
+   * @brief The leaves a compute node reads to find the key: the predicted leaves and their synonym leaves
+   */
+  auto read_leaves(const K &key) -> usize {
+    auto[pre, lo, hi] = this->model.predict(key, capacity);
+    return ltable.window_leaves(lo / slots, hi / slots);
+  }
+
   // ============== functions for debugging =================
   void print_data(leaf_alloc_t* alloc) {
     model.print();
@@ -198,6 +405,17 @@ public:
     ltable.print();
   }
 
+private:
+  auto insert_leaves(const K &key, const V &val, leaf_alloc_t* alloc) -> bool {
+    auto[pre, lo, hi] = this->model.predict(key, capacity);
+    lo /= slots;
+    hi /= slots;
+    int l=std::max((int)lo, 0);
+    int h=std::max((int)hi, 0);
+    // LOG(2) << "model predict leaf l: " <<l<<", h: "<<h;
+    return ltable.insert(key, val, alloc, l, h);
+  }
+
 
 
 };
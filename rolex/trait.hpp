@@ -2,6 +2,8 @@
 
 
 #include "leaf.hpp"
+#include "bitmap_leaf.hpp"
+#include "compressed_leaf.hpp"
 #include "leaf_allocator.hpp"
 #include "model_allocator.hpp"
 #include "leaf_table.hpp"
@@ -13,13 +15,29 @@ namespace rolex {
 
 using K = u64;
 using V = u64;
-using leaf_t = Leaf<64, K, V>;
+// the KVs per leaf and the error bound of the submodels, e.g., as picked by the layout sweep (benchs/Rolex/layout.cc)
+#ifndef ROLEX_LEAF_SLOTS
+#define ROLEX_LEAF_SLOTS 64
+#endif
+#ifndef ROLEX_EPSILON
+#define ROLEX_EPSILON 32
+#endif
+
+// define ROLEX_BITMAP_LEAF to use the unsorted leaves, whose insertions shift no KV,
+// or ROLEX_COMPRESSED_LEAF to use the leaves with delta-encoded keys, which are smaller to read
+#if defined(ROLEX_BITMAP_LEAF)
+using leaf_t = BitmapLeaf<ROLEX_LEAF_SLOTS, K, V>;
+#elif defined(ROLEX_COMPRESSED_LEAF)
+using leaf_t = CompressedLeaf<ROLEX_LEAF_SLOTS, K, V>;
+#else
+using leaf_t = Leaf<ROLEX_LEAF_SLOTS, K, V>;
+#endif
 using leaf_alloc_t = LeafAllocator<leaf_t, sizeof(leaf_t)>;
 using model_alloc_t = ModelAllocator<K>;
 using remote_memory_t = RemoteMemory<leaf_alloc_t, model_alloc_t>;
 using leaf_table_t = LeafTable<K, V, leaf_t, leaf_alloc_t>;
-using rolex_t = Rolex<K, V, leaf_t, leaf_alloc_t, remote_memory_t, 32>;
-using learned_cache_t = LearnedCache<K, V, leaf_t, leaf_alloc_t, 32>;
+using rolex_t = Rolex<K, V, leaf_t, leaf_alloc_t, remote_memory_t, ROLEX_EPSILON>;
+using learned_cache_t = LearnedCache<K, V, leaf_t, leaf_alloc_t, ROLEX_EPSILON>;
 
 
 
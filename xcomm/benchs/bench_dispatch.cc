@@ -0,0 +1,167 @@
+#include <gflags/gflags.h>
+
+#include "../src/rpc/mod.hh"
+
+#include "../../xutils/marshal.hh"
+#include "../../deps/r2/src/timer.hh"
+
+/*!
+  Measure the per-message CPU cost of the RPC path without a NIC:
+  - dynamic: std::function callbacks, arguments marshaled through std::string,
+    replies rebuilt on the stack (the original path)
+  - static: StaticRPCTable, typed in-place arguments and in-place replies
+  Messages are prepared in memory and fed to RPCCore::recv_event_loop by a
+  loopback RecvTrait, and the replies are dropped by a null SendTrait.
+ */
+namespace bench {
+
+using namespace xstore::rpc;
+using namespace xstore::transport;
+
+struct NullTransport : public STrait<NullTransport> {
+  usize sent = 0;
+
+  auto send_impl(const MemBlock &msg, const double &timeout = 1000000)
+      -> Result<std::string> {
+    sent += msg.sz;
+    return ::rdmaio::Ok(std::string(""));
+  }
+
+  auto send_w_key_impl(const MemBlock &msg, const u32 &key,
+                       const double &timeout = 1000000) -> Result<std::string> {
+    return this->send_impl(msg, timeout);
+  }
+};
+
+struct LoopRecv : public RTrait<LoopRecv, NullTransport> {
+  std::vector<MemBlock> msgs;
+  usize idx = 0;
+
+  void begin_impl() { idx = 0; }
+
+  void end_impl() {}
+
+  void next_impl() { idx += 1; }
+
+  auto has_msgs_impl() -> bool { return idx < msgs.size(); }
+
+  auto cur_session_id_impl() -> u32 { return 0; }
+
+  auto cur_msg_impl() -> MemBlock { return msgs[idx]; }
+};
+
+struct NullManager
+    : public SessionManager<NullManager, NullTransport, LoopRecv> {
+  auto add_impl(const u32 &id, const MemBlock &raw_connect_data,
+                LoopRecv &recv_trait) -> Result<> {
+    return ::rdmaio::Ok();
+  }
+};
+
+struct __attribute__((packed)) KV {
+  u64 key;
+  u64 val;
+};
+
+struct __attribute__((packed)) Reply {
+  bool status;
+  u64 val;
+};
+
+u64 sink = 0;
+
+void dynamic_callback(const Header &rpc_header, const MemBlock &args,
+                      NullTransport *replyc) {
+  ASSERT(args.sz == sizeof(u64) * 2);
+  u64 key = *args.interpret_as<u64>();
+  u64 val = *args.interpret_as<u64>(sizeof(u64));
+  sink += key ^ val;
+
+  Reply reply = {.status = true, .val = val};
+  char reply_buf[64];
+  RPCOp op;
+  ASSERT(op.set_msg(MemBlock(reply_buf, 64)).set_reply_to(rpc_header).add_arg(reply));
+  ASSERT(op.execute(replyc) == IOCode::Ok);
+}
+
+thread_local SendBufRing<64, 64> reply_bufs;
+
+void static_callback(const Header &rpc_header, const MemBlock &args,
+                     NullTransport *replyc) {
+  const KV &kv = args_as<KV>(args);
+  sink += kv.key ^ kv.val;
+
+  RPCOp op;
+  op.set_msg(reply_bufs.next()).set_reply_to(rpc_header);
+  auto reply = op.emplace_arg<Reply>();
+  reply->status = true;
+  reply->val = kv.val;
+  ASSERT(op.execute_w_key(replyc, reply_bufs.lkey) == IOCode::Ok);
+}
+
+using StaticTable =
+    StaticRPCTable<NullTransport, RPCHandler<0, static_callback>>;
+
+template <class Table, class F>
+auto run(RPCCore<NullTransport, LoopRecv, NullManager, Table> &rpc,
+         LoopRecv &recv, std::vector<char> &buf, const usize &rounds,
+         F encode) -> double {
+  rpc.session_manager.incoming_sesions.insert(
+      std::make_pair(0, std::make_unique<NullTransport>()));
+
+  r2::Timer t;
+  usize total = 0;
+  for (usize r = 0; r < rounds; ++r) {
+    // encode the requests, as the clients do
+    for (usize i = 0; i < recv.msgs.size(); ++i) {
+      recv.msgs[i] = encode(MemBlock(buf.data() + i * 64, 64), r + i);
+    }
+    total += rpc.recv_event_loop(&recv);
+  }
+  return t.passed_msec() * 1000.0 / total;
+}
+
+} // namespace bench
+
+using namespace bench;
+
+DEFINE_uint64(batch, 64, "num messages handled per event loop");
+DEFINE_uint64(rounds, 1000000, "num event loops");
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::vector<char> buf(FLAGS_batch * 64);
+  std::vector<char> reply_mem(decltype(reply_bufs)::total_sz());
+  reply_bufs = decltype(reply_bufs)(reply_mem.data(), 0);
+
+  LoopRecv recv;
+  recv.msgs.resize(FLAGS_batch);
+
+  RPCCore<NullTransport, LoopRecv, NullManager> dynamic_rpc(1);
+  dynamic_rpc.reg_callback(dynamic_callback);
+  auto dynamic_ns = run(
+      dynamic_rpc, recv, buf, FLAGS_rounds, [](const MemBlock &m, u64 k) {
+        std::string data;
+        data += ::xstore::util::Marshal<u64>::serialize_to(k);
+        data += ::xstore::util::Marshal<u64>::serialize_to(k + 1);
+        RPCOp op;
+        op.set_msg(m).set_req().set_rpc_id(0).add_opaque(data);
+        return op.finalize().msg;
+      });
+
+  RPCCore<NullTransport, LoopRecv, NullManager, StaticTable> static_rpc(1);
+  auto static_ns = run(
+      static_rpc, recv, buf, FLAGS_rounds, [](const MemBlock &m, u64 k) {
+        RPCOp op;
+        op.set_msg(m).set_req().set_rpc_id(0);
+        auto args = op.emplace_arg<KV>();
+        args->key = k;
+        args->val = k + 1;
+        return op.finalize().msg;
+      });
+
+  LOG(4) << "per-message cost, dynamic: " << dynamic_ns
+         << " ns; static: " << static_ns << " ns (sink " << sink << ")";
+  return 0;
+}
@@ -0,0 +1,244 @@
+#include <gflags/gflags.h>
+
+#include "../tests/transport_util.hh"
+
+#include "../src/rpc/mod.hh"
+#include "../src/transport/rdma_ring_t.hh"
+#include "../src/transport/rdma_ud_t.hh"
+#include "../src/transport/shm_t.hh"
+
+#include "../../deps/r2/src/thread.hh"
+#include "../../deps/r2/src/timer.hh"
+
+/*!
+  Compare the UD transport with the RC ring transport,
+  and the shared-memory transport (--transport=shm), which needs no NIC.
+  A server thread echoes each request with a reply of reply_sz bytes, e.g.,
+  - a small GET: --reply_sz=16
+  - a large scan: --reply_sz=3900 (the largest reply fitting in a UD packet)
+  The client thread uses coros coroutines, each has one outstanding request.
+
+  Usage: ./bench_ring --transport=ring --reply_sz=3900 --coros=8
+ */
+namespace bench {
+
+using namespace xstore::rpc;
+using namespace xstore::transport;
+using namespace test;
+
+// ring transport
+constexpr usize kRingEntry = 256;
+constexpr usize kRingMaxMsg = 4096;
+constexpr usize kRingSz = kRingMaxMsg * 128;
+
+using RingST = RRingTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using RingRT = RRingRecvTransport<kRingEntry, kRingSz, kRingMaxMsg>;
+using RingSM = RRingSessionManager<kRingEntry, kRingSz, kRingMaxMsg>;
+
+// UD transport
+using UDST = UDTransport;
+using UDRT = UDRecvTransport<2048>;
+using UDSM = UDSessionManager<2048>;
+
+// shared-memory transport
+using ShmST = ShmTransport<4096>;
+using ShmRT = ShmRecvTransport<4096>;
+using ShmSM = ShmSessionManager<4096>;
+
+volatile bool running = true;
+volatile bool server_ready = false;
+
+/*!
+  The echo server: rpc 0 returns a reply of reply_sz bytes,
+  which is built in the registered reply buffer
+ */
+template <class ST, class RT, class SM>
+void serve(RT &recv, char *reply_buf, const u32 &lkey, const usize &reply_sz) {
+  RPCCore<ST, RT, SM> rpc(1);
+  rpc.reg_callback([reply_buf, lkey, reply_sz](const Header &rpc_header,
+                                               const MemBlock &args,
+                                               ST *replyc) {
+    RPCOp op;
+    op.set_msg(MemBlock(reply_buf, 4096)).set_reply_to(rpc_header);
+    // the content of the reply does not matter
+    op.cur_ptr += reply_sz;
+    auto ret = op.execute_w_key(replyc, lkey);
+    ASSERT(ret == IOCode::Ok);
+  });
+
+  server_ready = true;
+  while (running) {
+    r2::compile_fence();
+    rpc.recv_event_loop(&recv);
+  }
+}
+
+/*!
+  \ret the number of requests completed per second
+ */
+template <class ST, class RT, class SM>
+auto issue(ST &sender, RT &recv, char *send_buf, const u32 &lkey,
+           const usize &coros, const usize &reqs) -> double {
+  // coroutine ids start from 1
+  RPCCore<ST, RT, SM> rpc(coros + 1);
+
+  auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 2048),
+                                       sender.get_connect_data().value());
+  ASSERT(conn_op.execute_w_key(&sender, lkey) == IOCode::Ok);
+
+  SScheduler ssched;
+  rpc.reg_poll_future(ssched, &recv);
+
+  usize total = 0;
+  r2::Timer t;
+  for (usize i = 0; i < coros; ++i) {
+    ssched.spawn([&, send_buf, lkey](R2_ASYNC) {
+      std::vector<char> reply_buf(4096);
+      char req_buf[64];
+      while (total < reqs) {
+        RPCOp op;
+        op.set_msg(MemBlock(req_buf, 64))
+            .set_req()
+            .set_rpc_id(0)
+            .set_corid(R2_COR_ID())
+            .add_one_reply(rpc.reply_station,
+                           MemBlock(reply_buf.data(), reply_buf.size()));
+        op.add_arg<u64>(73);
+        ASSERT(op.execute_w_key(&sender, lkey) == IOCode::Ok);
+        R2_PAUSE_AND_YIELD;
+        total += 1;
+      }
+      if (R2_COR_ID() == coros) {
+        R2_STOP();
+      }
+      R2_RET;
+    });
+  }
+  ssched.run();
+  // passed_msec() returns microseconds
+  return total / (t.passed_msec() / 1000000.0);
+}
+
+} // namespace bench
+
+using namespace bench;
+
+DEFINE_string(transport, "ring", "ud, ring or shm");
+DEFINE_int64(port, 8888, "the RCtrl port");
+DEFINE_uint64(reply_sz, 16, "reply payload in bytes");
+DEFINE_uint64(coros, 8, "num client coroutines");
+DEFINE_uint64(reqs, 1000000, "num requests to issue");
+
+using XThread = ::r2::Thread<usize>;
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ASSERT(FLAGS_reply_sz + sizeof(Header) <= 4000)
+      << "the reply should fit in a UD packet";
+  ASSERT(FLAGS_coros <= 128) << "the replies should fit in the ring";
+
+  if (FLAGS_transport == "shm") {
+    auto server_inbox = ShmInbox<4096>::create("/bench_ring_server", 1).value();
+    auto client_inbox = ShmInbox<4096>::create("/bench_ring_client", 1).value();
+    std::vector<char> server_reply_buf(4096), send_buf(4096);
+
+    XThread server([&]() -> usize {
+      ShmRT recv(server_inbox);
+      serve<ShmST, ShmRT, ShmSM>(recv, server_reply_buf.data(), 0,
+                                 FLAGS_reply_sz);
+      return 0;
+    });
+    server.start();
+    while (!server_ready) {
+      r2::compile_fence();
+    }
+
+    ShmST sender;
+    ASSERT(sender.connect("/bench_ring_server", "/bench_ring_client") ==
+           IOCode::Ok);
+    ShmRT recv(client_inbox);
+    auto thpt = issue<ShmST, ShmRT, ShmSM>(sender, recv, send_buf.data(), 0,
+                                           FLAGS_coros, FLAGS_reqs);
+    running = false;
+    server.join();
+    LOG(4) << "shm with reply sz " << FLAGS_reply_sz << ": " << thpt
+           << " reqs/sec, " << 1000000.0 / thpt * FLAGS_coros
+           << " us per request";
+    return 0;
+  }
+
+  RCtrl ctrl(FLAGS_port);
+  auto nic = RNic::create(RNicInfo::query_dev_names().at(0)).value();
+  RDMA_ASSERT(ctrl.opened_nics.reg(0, nic));
+  RingManager<kRingEntry> rm(ctrl);
+
+  auto mem_region = HugeRegion::create(64 * 1024 * 1024).value();
+  auto mem = mem_region->convert_to_rmem().value();
+  auto handler = RegHandler::create(mem, nic).value();
+  auto alloc =
+      Arc<SimpleAllocator>(new SimpleAllocator(mem, handler->get_reg_attr().value()));
+  auto lkey = handler->get_reg_attr().value().key;
+
+  auto server_reply_buf = (char *)std::get<0>(alloc->alloc_one(4096).value());
+  auto send_buf = (char *)std::get<0>(alloc->alloc_one(4096).value());
+
+  auto server_cq = std::get<0>(::rdmaio::qp::Impl::create_cq(nic, 2048).desc);
+  auto client_cq = std::get<0>(::rdmaio::qp::Impl::create_cq(nic, 2048).desc);
+
+  // prepare the server's receive end before the client connects
+  auto server_ring =
+      RecvFactory<kRingEntry, kRingSz, kRingMaxMsg>::create(rm, "b0", server_cq,
+                                                             alloc)
+          .value();
+  auto server_ud = UD::create(nic, QPConfig()).value();
+  auto server_ud_rs = RecvEntriesFactory<SimpleAllocator, 2048, 4096>::create(*alloc);
+  RDMA_ASSERT(server_ud->post_recvs(*server_ud_rs, 2048) == IOCode::Ok);
+  ctrl.registered_qps.reg("u0", server_ud);
+
+  ctrl.start_daemon();
+
+  XThread server([&]() -> usize {
+    if (FLAGS_transport == "ring") {
+      RingRT recv(server_ring);
+      serve<RingST, RingRT, RingSM>(recv, server_reply_buf, lkey,
+                                    FLAGS_reply_sz);
+    } else {
+      UDRT recv(server_ud, server_ud_rs);
+      serve<UDST, UDRT, UDSM>(recv, server_reply_buf, lkey, FLAGS_reply_sz);
+    }
+    return 0;
+  });
+  server.start();
+  while (!server_ready) {
+    r2::compile_fence();
+  }
+
+  double thpt = 0;
+  std::string addr = "localhost:" + std::to_string(FLAGS_port);
+  if (FLAGS_transport == "ring") {
+    RingST sender(73, nic, QPConfig(), client_cq, alloc);
+    ASSERT(sender.connect(addr, "b0", 0, QPConfig()) == IOCode::Ok);
+    auto receiver = RingRT::create_receiver("c0", client_cq);
+    ASSERT(sender.reg_to(receiver));
+    RingRT recv(receiver);
+    thpt = issue<RingST, RingRT, RingSM>(sender, recv, send_buf, lkey,
+                                         FLAGS_coros, FLAGS_reqs);
+  } else {
+    auto qp = UD::create(nic, QPConfig()).value();
+    auto rs = RecvEntriesFactory<SimpleAllocator, 2048, 4096>::create(*alloc);
+    RDMA_ASSERT(qp->post_recvs(*rs, 2048) == IOCode::Ok);
+    UDST sender;
+    ASSERT(sender.connect(addr, "u0", 73, qp) == IOCode::Ok);
+    UDRT recv(qp, rs);
+    thpt = issue<UDST, UDRT, UDSM>(sender, recv, send_buf, lkey, FLAGS_coros,
+                                   FLAGS_reqs);
+  }
+
+  running = false;
+  server.join();
+
+  LOG(4) << FLAGS_transport << " with reply sz " << FLAGS_reply_sz << ": "
+         << thpt << " reqs/sec, " << 1000000.0 / thpt * FLAGS_coros
+         << " us per request";
+  return 0;
+}
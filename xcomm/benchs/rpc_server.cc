@@ -32,8 +32,7 @@ void bench_callback(const Header &rpc_header, const MemBlock &args,
   RPCOp op;
   char reply_buf[64];
   op.set_msg(MemBlock(reply_buf, 64))
-      .set_reply()
-      .set_corid(rpc_header.cor_id)
+      .set_reply_to(rpc_header)
       .add_arg<u64>(73 + 1);
   auto ret = op.execute(replyc);
   ASSERT(ret == IOCode::Ok);
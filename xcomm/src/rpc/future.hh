@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../../../deps/r2/src/libroutine.hh"
+
+#include "./reply_station.hh"
+
+namespace xstore {
+
+namespace rpc {
+
+/*!
+  A handle to the reply of an in-flight RPC request.
+  Created by RPCOp::add_future_reply(), so a coroutine can issue many requests
+  and then wait for them one by one.
+
+  Usage:
+  `
+    RPCFuture f;
+    op.set_msg(..).set_req().set_corid(R2_COR_ID()).add_future_reply(station, f)...;
+    op.execute(..);
+    f.wait(R2_ASYNC_WAIT);
+    auto r = *f.reply_as<T>();
+    f.release();
+  `
+  \note: the reply entry is kept until release() is called.
+ */
+struct RPCFuture
+{
+  ReplyStation* station = nullptr;
+  u32 req_id = 0;
+
+  RPCFuture() = default;
+
+  RPCFuture(ReplyStation* s, const u32& id)
+    : station(s)
+    , req_id(id)
+  {}
+
+  auto valid() const -> bool { return station != nullptr; }
+
+  auto ready() const -> bool { return station->req_ready(req_id); }
+
+  /*!
+    Pause the current coroutine until the reply has arrived.
+    The poll future (RPCCore::reg_poll_future) wakes the coroutine up
+    whenever any of its requests is replied, so we re-check our own.
+   */
+  auto wait(R2_ASYNC) -> Result<>
+  {
+    while (!this->ready()) {
+      station->wait_any(R2_COR_ID());
+      R2_PAUSE_AND_YIELD;
+    }
+    return ::rdmaio::Ok();
+  }
+
+  auto reply() const -> MemBlock { return station->reply_of(req_id); }
+
+  template<typename T>
+  auto reply_as(const u32& offset = 0) const -> T*
+  {
+    return this->reply().interpret_as<T>(offset);
+  }
+
+  /*!
+    Return the reply entry to the station.
+    Releasing a pending future abandons the request.
+   */
+  void release()
+  {
+    if (station != nullptr) {
+      station->release(req_id);
+      station = nullptr;
+    }
+  }
+};
+
+} // namespace rpc
+
+} // namespace xstore
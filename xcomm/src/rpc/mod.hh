@@ -5,6 +5,7 @@
 #include "../transport/trait.hh"
 
 #include "./op.hh"
+#include "./static_dispatch.hh"
 
 #include "../../../deps/r2/src/sshed.hh"
 
@@ -14,22 +15,25 @@ namespace rpc {
 /*!
   An RPC framework assuming a given SendTrait, and RecvTrait
   for sending and receiving RPC messages.
+  Table dispatches the requests, see static_dispatch.hh.
  */
-template<class SendTrait, class RecvTrait, class Manager>
+template<class SendTrait,
+         class RecvTrait,
+         class Manager,
+         class Table = DynamicRPCTable<SendTrait>>
 struct RPCCore
 {
-  using rpc_func_t = std::function<
-    void(const Header& rpc_header, const MemBlock& args, SendTrait* replyc)>;
+  using rpc_func_t = typename DynamicRPCTable<SendTrait>::rpc_func_t;
 
   using ST = SendTrait;
 
   SessionManager<Manager, SendTrait, RecvTrait> session_manager;
 
   ReplyStation reply_station;
-  std::vector<rpc_func_t> callbacks;
+  Table table;
 
-  explicit RPCCore(int num_cors)
-    : reply_station(num_cors)
+  explicit RPCCore(int num_cors, usize max_inflight = kMaxInflightReqs)
+    : reply_station(num_cors, max_inflight)
   {}
 
   auto execute(const RPCOp& op, SendTrait* sender) -> Result<std::string>
@@ -43,11 +47,10 @@ struct RPCCore
     return sender->send_w_key(op.msg, k);
   }
 
+  // only available with the DynamicRPCTable
   auto reg_callback(rpc_func_t callback) -> usize
   {
-    auto id = callbacks.size();
-    callbacks.push_back(callback);
-    return id;
+    return table.reg(callback);
   }
 
   /*!
@@ -72,18 +75,16 @@ struct RPCCore
       MemBlock payload((char*)cur_msg.mem_ptr + sizeof(Header), h.payload);
       switch (h.type) {
         case Req: {
-          try {
-            auto reply_channel =
-              this->session_manager.incoming_sesions[session_id].get();
-            auto f = callbacks.at(h.rpc_id);
-            f(h, payload, reply_channel);
-          } catch (...) {
-            ASSERT(false) << "rpc called failed with rpc id " << h.rpc_id;
-          }
+          auto reply_channel =
+            this->session_manager.incoming_sesions[session_id].get();
+          table.dispatch(h, payload, reply_channel);
         } break;
         case Reply: {
-          // pass
-          auto ret = this->reply_station.append_reply(h.cor_id, payload);
+          // a late reply of a released or recycled request is dropped
+          if (!this->reply_station.expects_reply(h.req_id)) {
+            break;
+          }
+          auto ret = this->deliver_reply(h, payload, recv);
           ASSERT(ret) << "add reply error: " << h;
         } break;
         case Connect: {
@@ -97,6 +98,29 @@ struct RPCCore
     return num;
   }
 
+  /*!
+    Copy the reply to the reply station,
+    or lend the receive buffer if the request asks for a borrowed reply.
+    \ret false if the reply is not expected (see expects_reply).
+   */
+  auto deliver_reply(const Header& h, const MemBlock& payload, RecvTrait* recv)
+    -> bool
+  {
+    if (this->reply_station.is_borrowed(h.req_id)) {
+      if constexpr (!RecvTrait::kHoldMsgs) {
+        // the receive buffer may be overwritten before the reply is read
+        return this->reply_station.copy_reply(h.req_id, payload);
+      }
+      this->reply_station.release_msg = [](void* r, const u32& token) {
+        reinterpret_cast<RecvTrait*>(r)->release_msg(token);
+      };
+      this->reply_station.release_ctx = recv;
+      return this->reply_station.borrow_reply(
+        h.req_id, payload, recv->hold_cur_msg());
+    }
+    return this->reply_station.append_reply(h.req_id, payload);
+  }
+
   // register a future to poll RPC replies
   auto reg_poll_future(::r2::SScheduler& sshed, RecvTrait* recv)
   {
@@ -117,21 +141,22 @@ struct RPCCore
 
         switch (h.type) {
           case Req: {
-            try {
-              auto reply_channel =
-                this->session_manager.incoming_sesions[session_id].get();
-              callbacks.at(h.rpc_id)(h, payload, reply_channel);
-            } catch (...) {
-              ASSERT(false) << "rpc called failed with rpc id " << h.rpc_id;
-            }
+            auto reply_channel =
+              this->session_manager.incoming_sesions[session_id].get();
+            table.dispatch(h, payload, reply_channel);
           } break;
           case Reply: {
-            // pass
-            auto ret = this->reply_station.append_reply(h.cor_id, payload);
-            ASSERT(ret) << "add reply for: " << h.cor_id << " error";
+            // a late reply of a released or recycled request is dropped,
+            // without waking up the coroutine now owning the slot
+            if (!this->reply_station.expects_reply(h.req_id)) {
+              break;
+            }
+            auto cor_id = this->reply_station.cor_of(h.req_id);
+            auto ret = this->deliver_reply(h, payload, recv);
+            ASSERT(ret) << "add reply for: " << h << " error";
 
-            if (this->reply_station.cor_ready(h.cor_id)) {
-              sshed.addback_coroutine(h.cor_id);
+            if (this->reply_station.take_wakeup(cor_id)) {
+              sshed.addback_coroutine(cor_id);
             }
           } break;
           case Connect: {
@@ -4,6 +4,7 @@
 
 #include "./proto.hh"
 #include "./reply_station.hh"
+#include "./future.hh"
 
 namespace xstore {
 
@@ -16,6 +17,11 @@ using namespace ::xstore::transport;
   RPCOp op;
   op.set_msg(some msg).set_rpc_id(xx).set_corid(xx).set_reply(somerpc_context).add_arg<T>(T ...); auto ret = rpc.execute(op.finalize());
 
+  Pipelined usage (many requests in flight per coroutine):
+  RPCFuture f;
+  op.set_msg(some msg).set_req().set_rpc_id(xx).set_corid(R2_COR_ID()).add_future_reply(station, f).add_arg<T>(...);
+  op.execute(sender); ...; f.wait(R2_ASYNC_WAIT); use f.reply_as<T>(); f.release();
+
   \note: set_msg() must be called first!
  */
 struct RPCOp {
@@ -55,11 +61,27 @@ struct RPCOp {
     return *this;
   }
 
+  auto set_reqid(const u32 &id) -> RPCOp & {
+    this->header.req_id = id;
+    return *this;
+  }
+
+  /*!
+    Set the reply to the request of header req.
+    \note: replies are matched using the req_id, so callbacks should use this
+    (or set_corid + set_reqid) before sending the reply
+   */
+  auto set_reply_to(const Header &req) -> RPCOp & {
+    return this->set_reply().set_corid(req.cor_id).set_reqid(req.req_id);
+  }
+
   /*!
     Note: the corid must be set using set_corid() before using this function
    */
   auto add_reply_entry(ReplyStation &s, const ReplyEntry &reply) -> RPCOp & {
-    s.add_pending_reply(header.cor_id, reply);
+    auto id = s.add_pending_reply(header.cor_id, reply);
+    ASSERT(id) << "too many in-flight requests: " << s.inflight();
+    header.req_id = id.value();
     return *this;
   }
 
@@ -67,6 +89,34 @@ struct RPCOp {
     return this->add_reply_entry(s, ReplyEntry(reply));
   }
 
+  /*!
+    Register the reply as a future, so that the coroutine can issue more
+    requests before waiting for this one.
+    If reply is empty, the reply is stored in the ReplyStation's inline buffer.
+    Note: the corid must be set using set_corid() before using this function
+   */
+  auto add_future_reply(ReplyStation &s, RPCFuture &f,
+                        const MemBlock &reply = MemBlock()) -> RPCOp & {
+    auto id = s.add_detached_reply(header.cor_id, reply);
+    ASSERT(id) << "too many in-flight requests: " << s.inflight();
+    header.req_id = id.value();
+    f = RPCFuture(&s, id.value());
+    return *this;
+  }
+
+  /*!
+    Same as add_future_reply, but the reply is not copied: the future reads
+    it in place in the receive buffer until it is released.
+    If the RecvTrait can not hold a msg (kHoldMsgs), the reply is copied.
+   */
+  auto add_borrowed_reply(ReplyStation &s, RPCFuture &f) -> RPCOp & {
+    auto id = s.add_borrowed_reply(header.cor_id);
+    ASSERT(id) << "too many in-flight requests: " << s.inflight();
+    header.req_id = id.value();
+    f = RPCFuture(&s, id.value());
+    return *this;
+  }
+
   /*!
     \ret: whether add succ
    */
@@ -79,6 +129,20 @@ struct RPCOp {
     return true;
   }
 
+  /*!
+    Reserve space for an argument of type T in the message,
+    so that the caller builds it in place rather than copying it in.
+    \ret: nullptr if the msg is too small
+   */
+  template <typename T> auto emplace_arg() -> T * {
+    if (unlikely(sizeof(T) + this->cur_sz() > this->msg.sz)) {
+      return nullptr;
+    }
+    auto ret = reinterpret_cast<T *>(this->cur_ptr);
+    this->cur_ptr += sizeof(T);
+    return ret;
+  }
+
   auto add_opaque(const std::string &data) -> bool {
     if (unlikely(data.size() + this->cur_sz() > this->msg.sz)) {
       return false;
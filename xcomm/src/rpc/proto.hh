@@ -36,18 +36,27 @@ struct __attribute__((packed)) Meta {
   Addr dest;
 };
 
+/*!
+  The req_id occupies the (previously padded) second word of the header.
+  Replies are matched by req_id, so one coroutine may have many requests
+  in flight; cor_id is kept for the callbacks which only reply to coroutines.
+ */
 struct __attribute__((packed)) Header {
   u32 type : 2;
   u32 rpc_id : 5;
   u32 payload : 18;
   u32 cor_id : 7;
+  u32 req_id;
 
   friend std::ostream &operator<<(std::ostream &os, const Header &h) {
     os << "type:" << h.type << "; rpc_id: " << h.rpc_id << "; payload:"  << h.payload
-       << " cor_id: " << h.cor_id;
+       << " cor_id: " << h.cor_id << " req_id: " << h.req_id;
+    return os;
   }
 } __attribute__((aligned(sizeof(u64))));
 
+static_assert(sizeof(Header) == sizeof(u64), "RPC header should fit in a word");
+
 } // namespace rpc
 
 } // namespace xstore
@@ -14,11 +14,49 @@ namespace rpc {
 
 using namespace r2;
 
+/*!
+  A request id is encoded as [generation | slot].
+  The slot indexes the reply table, while the generation filters out a stale
+  reply which targets a recycled slot.
+ */
+constexpr usize kReqSlotBits = 12;
+constexpr usize kMaxInflightReqs = 1 << kReqSlotBits;
+constexpr u32 kReqSlotMask = (1u << kReqSlotBits) - 1;
+
+// replies of future-style requests are stored inline if no buffer is given
+constexpr usize kInlineReplySz = 64;
+
+/*!
+  How a coroutine wants to be waken up by the poll future
+  - WaitAll: after all its pending requests have been replied (legacy usage)
+  - WaitAny: after any of its pending requests has been replied (futures)
+ */
+enum WaitMode : u8 {
+  NoWait = 0,
+  WaitAll = 1,
+  WaitAny = 2,
+};
+
 struct ReplyEntry
 {
   usize pending_replies = 0;
   MemBlock reply_buf;
-  char* cur_ptr;
+  char* cur_ptr = nullptr;
+
+  // filled by the ReplyStation
+  u32 req_id = 0;
+  int cor_id = 0;
+  bool in_use = false;
+  // a detached entry is kept after completion, until the owner releases it
+  bool detached = false;
+  // a borrowed entry points reply_buf to the receive buffer (no copy),
+  // which is held by the transport until the entry is released
+  bool borrowed = false;
+  u32 borrow_token = 0;
+
+  char inline_buf[kInlineReplySz];
+  // a borrowed reply copied from a transport which can not hold it
+  std::vector<char> copy_buf;
 
   ReplyEntry(const MemBlock& reply_buf)
     : pending_replies(1)
@@ -30,48 +68,156 @@ struct ReplyEntry
 };
 
 /*!
-  Record the reply entries of all coroutines.
-  Currently, we assume fixed coroutines stored using vector.
+  Record the reply entries of all in-flight requests of a thread.
+  Replies are keyed by request ids, which are decoupled from the coroutine ids,
+  so a coroutine can issue many requests before waiting for any of them.
   The number of coroutines must be passed priori to the creation of the station.
  */
 struct ReplyStation
 {
-  // TODO: reply vector with T, which implements a mapping from corid ->
-  // ReplyEntry
-  std::vector<ReplyEntry> cor_replies;
+  std::vector<ReplyEntry> replies;
+  std::vector<u32> free_slots;
 
-  explicit ReplyStation(int num_cors)
-    : cor_replies(num_cors)
-  {}
+  // per-coroutine in-flight requests and wait modes
+  std::vector<usize> cor_pending;
+  std::vector<u8> cor_wait;
+  std::vector<u8> cor_wakeup;
+
+  // return a held receive buffer to the transport, set by RPCCore
+  using release_msg_f = void (*)(void* recv, const u32& token);
+  release_msg_f release_msg = nullptr;
+  void* release_ctx = nullptr;
+
+  explicit ReplyStation(int num_cors, usize max_inflight = kMaxInflightReqs)
+    : replies(max_inflight)
+    , cor_pending(num_cors, 0)
+    , cor_wait(num_cors, NoWait)
+    , cor_wakeup(num_cors, 0)
+  {
+    ASSERT(max_inflight <= kMaxInflightReqs && max_inflight > 0);
+    free_slots.reserve(max_inflight);
+    for (int i = max_inflight - 1; i >= 0; --i) {
+      free_slots.push_back(i);
+    }
+  }
 
   /*!
-    return whether there are pending replies
+    Register a request of cor_id waiting for the reply.
+    The legacy usage pauses the coroutine right after sending,
+    so it waits for all its pending replies.
+    \ret the request id to carry in the RPC header
    */
-  auto add_pending_reply(const int& cor_id, const ReplyEntry& reply) -> bool
+  auto add_pending_reply(const int& cor_id, const ReplyEntry& reply)
+    -> ::r2::Option<u32>
   {
-    ASSERT(cor_id < cor_replies.size());
-    if (cor_replies[cor_id].pending_replies > 0) {
-      return false;
+    auto ret = this->alloc_req(cor_id, reply, false);
+    if (ret) {
+      cor_wait[cor_id] = WaitAll;
     }
-    cor_replies[cor_id] = reply;
-    return true;
+    return ret;
+  }
+
+  /*!
+    Register a request whose reply entry is kept until release(req_id).
+    If the reply buf is empty, the reply is stored in the inline buffer.
+   */
+  auto add_detached_reply(const int& cor_id, const MemBlock& reply)
+    -> ::r2::Option<u32>
+  {
+    ReplyEntry e(reply);
+    auto ret = this->alloc_req(cor_id, e, true);
+    if (ret && reply.mem_ptr == nullptr) {
+      auto& r = this->entry(ret.value());
+      r.reply_buf = MemBlock(r.inline_buf, kInlineReplySz);
+      r.cur_ptr = r.inline_buf;
+    }
+    return ret;
+  }
+
+  /*!
+    Register a request whose reply is delivered as a borrowed view of the
+    receive buffer, instead of being copied.
+    The view is valid until release(req_id), which should be called before
+    the coroutine yields again, because the receive entry is not re-posted
+    until then. A transport which can not hold the buffer delivers a copy.
+   */
+  auto add_borrowed_reply(const int& cor_id) -> ::r2::Option<u32>
+  {
+    ReplyEntry e(MemBlock(nullptr, 0));
+    auto ret = this->alloc_req(cor_id, e, true);
+    if (ret) {
+      this->entry(ret.value()).borrowed = true;
+    }
+    return ret;
+  }
+
+  auto is_borrowed(const u32& req_id) -> bool
+  {
+    auto& r = this->entry(req_id);
+    return r.in_use && r.req_id == req_id && r.borrowed;
   }
 
   auto cor_ready(const int& cor_id) -> bool
   {
-    return cor_replies[cor_id].pending_replies == 0;
+    return cor_pending[cor_id] == 0;
+  }
+
+  /*!
+    \ret: whether a reply of req_id is awaited, i.e., the request is neither
+    replied, released nor recycled
+   */
+  auto expects_reply(const u32& req_id) -> bool
+  {
+    auto& r = this->entry(req_id);
+    return r.in_use && r.req_id == req_id && r.pending_replies > 0;
+  }
+
+  auto req_ready(const u32& req_id) -> bool
+  {
+    auto& r = this->entry(req_id);
+    return !(r.in_use && r.req_id == req_id && r.pending_replies > 0);
+  }
+
+  auto cor_of(const u32& req_id) -> int { return this->entry(req_id).cor_id; }
+
+  auto reply_of(const u32& req_id) -> MemBlock
+  {
+    return this->entry(req_id).reply_buf;
+  }
+
+  auto inflight() const -> usize
+  {
+    return replies.size() - free_slots.size();
+  }
+
+  /*!
+    Mark that cor_id pauses until any of its requests is replied
+   */
+  void wait_any(const int& cor_id) { cor_wait[cor_id] = WaitAny; }
+
+  /*!
+    \ret: whether cor_id should be added back to the scheduler.
+    The flag is cleared after the call.
+   */
+  auto take_wakeup(const int& cor_id) -> bool
+  {
+    if (cor_wakeup[cor_id]) {
+      cor_wakeup[cor_id] = 0;
+      return true;
+    }
+    return false;
   }
 
   /*!
     \ret: whether append reply is ok
    */
-  auto append_reply(const int& cor_id, const MemBlock& payload) -> bool
+  auto append_reply(const u32& req_id, const MemBlock& payload) -> bool
   {
-    if (unlikely(this->cor_ready(cor_id))) {
+    auto& r = this->entry(req_id);
+    if (unlikely(!r.in_use || r.req_id != req_id || r.pending_replies == 0)) {
       return false;
     }
 
-    auto& r = this->cor_replies[cor_id];
     ASSERT(r.cur_ptr + payload.sz <=
            (char*)r.reply_buf.mem_ptr + r.reply_buf.sz)
       << "overflow reply sz: " << payload.sz
@@ -80,8 +226,131 @@ struct ReplyStation
     r.cur_ptr += payload.sz;
 
     r.pending_replies -= 1;
+    if (r.pending_replies == 0) {
+      this->complete(r);
+    }
+    return true;
+  }
+
+  /*!
+    Deliver the reply of a borrowed entry, the token identifies the held
+    receive buffer in the transport.
+    \ret: whether append reply is ok
+   */
+  auto borrow_reply(const u32& req_id, const MemBlock& payload, const u32& token)
+    -> bool
+  {
+    auto& r = this->entry(req_id);
+    if (unlikely(!r.in_use || r.req_id != req_id || r.pending_replies == 0)) {
+      return false;
+    }
+    ASSERT(r.borrowed && r.pending_replies == 1)
+      << "a borrowed reply should have exactly one payload";
+    r.reply_buf = payload;
+    r.borrow_token = token;
+    r.pending_replies = 0;
+    this->complete(r);
+    return true;
+  }
+
+  /*!
+    Deliver the reply of a borrowed entry by a copy, if the transport can not
+    hold the receive buffer. The copy buffer is kept for the later requests
+    of the slot.
+    \ret: whether append reply is ok
+   */
+  auto copy_reply(const u32& req_id, const MemBlock& payload) -> bool
+  {
+    auto& r = this->entry(req_id);
+    if (unlikely(!r.in_use || r.req_id != req_id || r.pending_replies == 0)) {
+      return false;
+    }
+    ASSERT(r.borrowed && r.pending_replies == 1)
+      << "a borrowed reply should have exactly one payload";
+    if (r.copy_buf.size() < payload.sz) {
+      r.copy_buf.resize(payload.sz);
+    }
+    memcpy(r.copy_buf.data(), payload.mem_ptr, payload.sz);
+    r.reply_buf = MemBlock(r.copy_buf.data(), payload.sz);
+    // no receive buffer to return on release
+    r.borrowed = false;
+    r.pending_replies = 0;
+    this->complete(r);
     return true;
   }
+
+  /*!
+    Release a detached entry after its owner has consumed the reply
+   */
+  void release(const u32& req_id)
+  {
+    auto& r = this->entry(req_id);
+    if (r.in_use && r.req_id == req_id) {
+      if (r.pending_replies > 0) {
+        // the request is abandoned, its reply will be dropped by the
+        // receiver as its id is no longer expected (expects_reply)
+        cor_pending[r.cor_id] -= 1;
+      }
+      this->free_entry(r);
+    }
+  }
+
+private:
+  inline auto entry(const u32& req_id) -> ReplyEntry&
+  {
+    return replies[(req_id & kReqSlotMask) % replies.size()];
+  }
+
+  auto alloc_req(const int& cor_id, const ReplyEntry& reply, bool detached)
+    -> ::r2::Option<u32>
+  {
+    ASSERT(cor_id < cor_pending.size());
+    if (unlikely(free_slots.empty())) {
+      return {};
+    }
+    auto slot = free_slots.back();
+    free_slots.pop_back();
+
+    auto& r = replies[slot];
+    auto gen = (r.req_id >> kReqSlotBits) + 1;
+    r.pending_replies = reply.pending_replies;
+    r.reply_buf = reply.reply_buf;
+    r.cur_ptr = reply.cur_ptr;
+    r.req_id = (gen << kReqSlotBits) | slot;
+    r.cor_id = cor_id;
+    r.in_use = true;
+    r.detached = detached;
+    r.borrowed = false;
+
+    cor_pending[cor_id] += 1;
+    return r.req_id;
+  }
+
+  void complete(ReplyEntry& r)
+  {
+    auto cor_id = r.cor_id;
+    cor_pending[cor_id] -= 1;
+    if (!r.detached) {
+      this->free_entry(r);
+    }
+    if (cor_wait[cor_id] == WaitAny ||
+        (cor_wait[cor_id] == WaitAll && cor_pending[cor_id] == 0)) {
+      cor_wait[cor_id] = NoWait;
+      cor_wakeup[cor_id] = 1;
+    }
+  }
+
+  void free_entry(ReplyEntry& r)
+  {
+    if (r.borrowed && r.reply_buf.mem_ptr != nullptr) {
+      ASSERT(release_msg != nullptr) << "no transport to return the buffer";
+      release_msg(release_ctx, r.borrow_token);
+    }
+    r.borrowed = false;
+    r.in_use = false;
+    r.pending_replies = 0;
+    free_slots.push_back(r.req_id & kReqSlotMask);
+  }
 };
 } // namespace rpc
 } // namespace xstore
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "./proto.hh"
+
+#include "../../../deps/r2/src/mem_block.hh"
+
+namespace xstore {
+
+namespace rpc {
+
+/*!
+  RPC tables used by RPCCore to dispatch the incoming requests.
+  - DynamicRPCTable: callbacks are registered at runtime as std::function
+  - StaticRPCTable: handlers are registered at compile time, keyed by the RPC id,
+    so the dispatch is a chain of integer compares with the handlers inlined.
+
+  Usage of the static table:
+  `
+    using Table = StaticRPCTable<SendTrait,
+                                 RPCHandler<GET, get_callback>,
+                                 RPCHandler<PUT, put_callback>>;
+    RPCCore<SendTrait, RecvTrait, Manager, Table> rpc(1);
+  `
+ */
+template <class SendTrait> struct DynamicRPCTable {
+  using rpc_func_t = std::function<void(const Header &rpc_header,
+                                        const MemBlock &args,
+                                        SendTrait *replyc)>;
+
+  std::vector<rpc_func_t> callbacks;
+
+  auto reg(rpc_func_t callback) -> usize {
+    auto id = callbacks.size();
+    callbacks.push_back(callback);
+    return id;
+  }
+
+  inline void dispatch(const Header &h, const MemBlock &payload,
+                       SendTrait *replyc) {
+    try {
+      auto f = callbacks.at(h.rpc_id);
+      f(h, payload, replyc);
+    } catch (...) {
+      ASSERT(false) << "rpc called failed with rpc id " << h.rpc_id;
+    }
+  }
+};
+
+template <usize Id, auto F> struct RPCHandler {
+  static constexpr usize id = Id;
+
+  template <class SendTrait>
+  static inline auto try_call(const Header &h, const MemBlock &payload,
+                              SendTrait *replyc) -> bool {
+    if (h.rpc_id != Id) {
+      return false;
+    }
+    F(h, payload, replyc);
+    return true;
+  }
+};
+
+template <class SendTrait, class... Handlers> struct StaticRPCTable {
+  static constexpr usize kNumHandlers = sizeof...(Handlers);
+  static_assert(kNumHandlers > 0, "the RPC table should not be empty");
+
+  inline void dispatch(const Header &h, const MemBlock &payload,
+                       SendTrait *replyc) {
+    bool called = (Handlers::template try_call<SendTrait>(h, payload, replyc) ||
+                   ...);
+    if (unlikely(!called)) {
+      ASSERT(false) << "rpc called failed with rpc id " << h.rpc_id;
+    }
+  }
+};
+
+/*!
+  A typed, zero-copy view of the RPC arguments in the receive buffer.
+  The view is valid until the receive entry is reposted, i.e., inside the
+  callback.
+ */
+template <typename T> inline auto args_as(const MemBlock &args) -> const T & {
+  ASSERT(args.sz >= sizeof(T))
+      << "args sz: " << args.sz << "; expected: " << sizeof(T);
+  return *reinterpret_cast<const T *>(args.mem_ptr);
+}
+
+/*!
+  A ring of send buffers carved from registered memory, so that replies can be
+  built in place and sent with the buffer's lkey.
+  A slot is reused after kSlots sends, which should be larger than the
+  send queue depth of the transport.
+ */
+template <usize kSlots, usize kSlotSz> struct SendBufRing {
+  char *base = nullptr;
+  u32 lkey = 0;
+  usize cur = 0;
+
+  SendBufRing() = default;
+
+  SendBufRing(char *b, const u32 &k) : base(b), lkey(k) {}
+
+  static constexpr auto total_sz() -> usize { return kSlots * kSlotSz; }
+
+  inline auto next() -> MemBlock {
+    auto ret = MemBlock(base + cur * kSlotSz, kSlotSz);
+    cur = (cur + 1) % kSlots;
+    return ret;
+  }
+};
+
+} // namespace rpc
+
+} // namespace xstore
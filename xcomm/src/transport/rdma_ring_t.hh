@@ -18,6 +18,26 @@ using namespace r2::ring_msg;
 /*!
   This file provides a wrapper of R2::ring_msg, making it implement the trait
   The r2_ring messages implements a simplfied version of FaRM message (FaRM@NSDI'14)
+
+  Compared to UD, messages are delivered reliably and can be up to kMaxMsg
+  (< 64KB) bytes. The receiver polls the completions of all its sessions
+  in a batch from the shared recv_cq.
+  \note: the sender does not track the free space of the remote ring,
+  so kRingSz should be larger than the total size of the in-flight messages
+  of a session, i.e., #outstanding requests * kMaxMsg.
+
+  Usage at client:
+  `
+    RRingTransport<R, kRingSz, kMaxMsg> sender(id, nic, QPConfig(), recv_cq, alloc);
+    sender.connect(server_addr, "server receiver name", nic_id, QPConfig());
+    auto receiver = RRingRecvTransport<R, kRingSz, kMaxMsg>::create_receiver(
+        "my receiver name", recv_cq);
+    sender.reg_to(receiver); // so that the replies are received
+    RRingRecvTransport<R, kRingSz, kMaxMsg> recv(receiver);
+  `
+  The server creates the receiver with RecvFactory, whose sessions are created
+  once the clients connect, and the RPC Connect message registers them to
+  RRingSessionManager as reply channels.
  */
 template <usize R, usize kRingSz, usize kMaxMsg>
 struct RRingTransport : public STrait<RRingTransport<R, kRingSz, kMaxMsg>> {
@@ -53,7 +73,17 @@ struct RRingTransport : public STrait<RRingTransport<R, kRingSz, kMaxMsg>> {
 
   auto send_w_key_impl(const MemBlock &msg, const u32 &key, const double &timeout = 1000000)
       -> Result<std::string> {
-    return ::rdmaio::Err("not implemented!");
+    return core->send_unsignaled(msg, key);
+  }
+
+  // the ring session has been bootstrapped in connect, nothing to carry
+  auto get_connect_data_impl() -> r2::Option<std::string> {
+    return std::string("");
+  }
+
+  // register the session to the local receiver, to receive the replies
+  auto reg_to(Arc<Receiver<R, kRingSz, kMaxMsg>> &receiver) -> bool {
+    return receiver->reg_channel(Arc<RingS>(core, [](RingS *) {}));
   }
 };
 
@@ -67,21 +97,79 @@ struct RRingRecvTransport
   using ST = RRingTransport<R, kRingSz, kMaxMsg>;
   RingRecvIter<R, kRingSz, kMaxMsg> core;
 
+  // the iterator has polled the recv_cq on construction
+  bool polled = true;
+  // reading a msg consumes the ring, so it is cached for the current one
+  MemBlock cached_msg;
+  bool cached = false;
+
   explicit RRingRecvTransport(Arc<Receiver<R, kRingSz, kMaxMsg>> &r)
       : core(r) {}
 
-  void begin_impl() { core.begin(); }
+  /*!
+    Create a receiver which is not registered to a RingManager,
+    i.e., it only receives messages from the sessions registered to it
+   */
+  static auto create_receiver(const std::string &name, ibv_cq *cq)
+      -> Arc<Receiver<R, kRingSz, kMaxMsg>> {
+    return std::make_shared<Receiver<R, kRingSz, kMaxMsg>>(name, cq);
+  }
+
+  void begin_impl() {
+    if (!polled) {
+      core.begin();
+    }
+    polled = false;
+    cached = false;
+  }
+
+  // recv entries are re-posted in batches by the sessions
+  void end_impl() {}
 
-  void next_impl() { return core.next(); }
+  void next_impl() {
+    cached = false;
+    return core.next();
+  }
 
   auto has_msgs_impl() -> bool { return core.has_msgs(); }
 
-  auto cur_msg_impl() -> MemBlock { return core.cur_msg(); }
+  auto cur_session_id_impl() -> u32 { return core.cur_session()->id; }
+
+  auto cur_msg_impl() -> MemBlock {
+    if (!cached) {
+      cached_msg = core.cur_msg();
+      cached = true;
+    }
+    return cached_msg;
+  }
+
+  // the sender may overwrite a msg once it is consumed, so a msg can not
+  // be held (kHoldMsgs is false) and the borrowed replies are copied
 
   auto reply_entry_impl() -> ST {
     return RRingTransport<R, kRingSz, kMaxMsg>(core.cur_session());
   }
 };
 
+/*!
+  The reply channels of the incoming sessions,
+  which are the server-side ring sessions created on the connection
+ */
+template <usize R, usize kRingSz, usize kMaxMsg>
+struct RRingSessionManager
+    : public SessionManager<RRingSessionManager<R, kRingSz, kMaxMsg>,
+                            RRingTransport<R, kRingSz, kMaxMsg>,
+                            RRingRecvTransport<R, kRingSz, kMaxMsg>> {
+  auto add_impl(const u32 &id, const MemBlock &raw_connect_data,
+                RRingRecvTransport<R, kRingSz, kMaxMsg> &recv_trait)
+      -> Result<> {
+    ASSERT(recv_trait.core.cur_session()->id == id);
+    this->incoming_sesions.insert(std::make_pair(
+        id, std::make_unique<RRingTransport<R, kRingSz, kMaxMsg>>(
+                recv_trait.core.cur_session())));
+    return ::rdmaio::Ok();
+  }
+};
+
 } // namespace transport
 } // namespace xstore
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <unordered_map>
+#include <vector>
 
 #include "../../../deps/r2/src/msg/ud_session.hh"
 #include "../../../deps/rlib/core/lib.hh"
@@ -87,10 +89,35 @@ struct UDRecvTransport : public RTrait<UDRecvTransport<es>, UDTransport> {
 
   RecvIter<UD, es> iter;
 
+  /*!
+    Recv entries complete in the order they are posted.
+    posted: the positions of the posted entries in the posting order,
+            i.e., [p_head, p_head + p_num) of the ring of positions
+    held: entries whose buffers are still read in place (see hold_cur_msg),
+          kHeldInBatch if received in the current batch, kHeldOut if kept
+          out of the QP. A held entry is re-posted after its release, so
+          the entries received after it are re-posted without waiting.
+   */
+  static constexpr bool kHoldMsgs = true;
+
+  static constexpr u8 kHeldInBatch = 1;
+  static constexpr u8 kHeldOut = 2;
+
+  std::array<u32, es> posted;
+  usize p_head = 0;
+  usize p_num = es;
+  std::array<u8, es> held = {};
+  std::vector<u32> to_post;
+
+  // all the entries should have been posted (post_recvs(*e, es)) before
   UDRecvTransport(Arc<UD> qp, Arc<RecvEntries<es>> e)
       : qp(qp), recv_entries(e) {
     // manally set the entries
     iter.set_meta(qp, recv_entries);
+    for (usize i = 0; i < es; ++i) {
+      posted[i] = (recv_entries->header + i) % es;
+    }
+    to_post.reserve(es);
   }
 
   void begin_impl() {
@@ -98,8 +125,62 @@ struct UDRecvTransport : public RTrait<UDRecvTransport<es>, UDTransport> {
   }
 
   void end_impl() {
-    // post recvs
-    iter.clear();
+    // post recvs, except the held ones
+    auto n = iter.drain();
+    for (int i = 0; i < n; ++i) {
+      auto pos = posted[(p_head + i) % es];
+      if (held[pos]) {
+        held[pos] = kHeldOut;
+      } else {
+        to_post.push_back(pos);
+      }
+    }
+    p_head = (p_head + n) % es;
+    p_num -= n;
+    this->repost();
+  }
+
+  auto hold_cur_msg_impl() -> u32 {
+    auto pos = posted[(p_head + iter.cur_idx()) % es];
+    ASSERT(recv_entries->rs[pos].wr_id ==
+           (u64)(std::get<1>(iter.cur_msg().value())))
+        << "recv entries are not completed in the posting order";
+    held[pos] = kHeldInBatch;
+    return pos;
+  }
+
+  void release_msg_impl(const u32 &token) {
+    // an entry of the current batch is re-posted by end()
+    if (held[token] == kHeldOut) {
+      to_post.push_back(token);
+    }
+    held[token] = 0;
+  }
+
+  /*!
+    Post the entries of to_post in one batch, which are chained out of the
+    ring order, so the links are restored for post_recvs afterwards.
+   */
+  void repost() {
+    if (to_post.empty()) {
+      return;
+    }
+    auto rs = recv_entries->rs;
+    for (usize i = 0; i + 1 < to_post.size(); ++i) {
+      rs[to_post[i]].next = rs + to_post[i + 1];
+    }
+    rs[to_post.back()].next = nullptr;
+
+    struct ibv_recv_wr *bad_rr;
+    if (unlikely(ibv_post_recv(qp->qp, rs + to_post[0], &bad_rr) != 0))
+      RDMA_LOG(4) << "post recv error: " << strerror(errno);
+
+    for (auto pos : to_post) {
+      rs[pos].next = rs + (pos + 1) % es;
+      posted[(p_head + p_num) % es] = pos;
+      p_num += 1;
+    }
+    to_post.clear();
   }
 
   void next_impl() {
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "../../../xutils/shm_region.hh"
+#include "../../../deps/r2/src/timer.hh"
+
+#include "./trait.hh"
+
+namespace xstore {
+
+namespace transport {
+
+using namespace xstore::util;
+
+/*!
+  A shared-memory transport for processes on the same host, without a NIC.
+
+  Each receiver owns an inbox, i.e., a named shared memory region with
+  kMaxRings SPSC rings. A sender claims one ring of the inbox on connect,
+  and the index of the ring is the session id seen by the receiver.
+  The ring is released when the sender is destroyed.
+  A ring is an array of cache-line sized slots, a message occupies
+  [ShmMsgHeader | msg] in consecutive slots, so a small RPC fits in one line.
+
+  The receiver polls in batches: begin() loads the tail of each ring once,
+  and end() publishes the consumed head of each ring once.
+
+  Usage:
+  `
+    // receiver
+    auto inbox = ShmInbox<kSlots>::create("server_inbox", kMaxRings).value();
+    ShmRecvTransport<kSlots> recv(inbox);
+    // sender
+    ShmTransport<kSlots> sender;
+    sender.connect("server_inbox", "my_inbox"); // my_inbox receives the replies
+  `
+ */
+constexpr usize kShmLine = 64;
+
+struct ShmMsgHeader {
+  u32 sz;
+  u32 num_slots;
+};
+
+// a header with this sz skips to the beginning of the ring
+constexpr u32 kShmSkip = std::numeric_limits<u32>::max();
+
+// the owner of a ring: a released ring is freed by the receiver once it has
+// consumed the msgs of the ring, so a new sender never sees them
+constexpr u32 kShmFree = 0;
+constexpr u32 kShmClaimed = 1;
+constexpr u32 kShmReleased = 2;
+
+template <usize kSlots> struct alignas(kShmLine) ShmRing {
+  static_assert(kSlots > 0 && (kSlots & (kSlots - 1)) == 0,
+                "the number of slots should be a power of 2");
+
+  // written by the sender
+  alignas(kShmLine) std::atomic<u64> tail;
+  // written by the receiver
+  alignas(kShmLine) std::atomic<u64> head;
+  // kShmFree, kShmClaimed or kShmReleased
+  alignas(kShmLine) std::atomic<u32> owner;
+
+  alignas(kShmLine) char slots[kSlots][kShmLine];
+
+  static constexpr auto max_msg_sz() -> usize {
+    return kSlots * kShmLine - sizeof(ShmMsgHeader);
+  }
+
+  static constexpr auto slots_of(const usize &sz) -> usize {
+    return (sz + sizeof(ShmMsgHeader) + kShmLine - 1) / kShmLine;
+  }
+
+  inline auto header_at(const u64 &pos) -> ShmMsgHeader * {
+    return reinterpret_cast<ShmMsgHeader *>(slots[pos % kSlots]);
+  }
+};
+
+struct alignas(kShmLine) ShmInboxMeta {
+  static constexpr u64 kMagic = 0x73686d696e626f78; // "shminbox"
+
+  u64 magic;
+  u64 slots;
+  u64 max_rings;
+  // rings [0, num_rings) may have been claimed
+  std::atomic<u64> num_rings;
+};
+
+template <usize kSlots> struct ShmInbox {
+  using Ring = ShmRing<kSlots>;
+
+  Arc<ShmRegion> region;
+  ShmInboxMeta *meta = nullptr;
+  Ring *rings = nullptr;
+
+  explicit ShmInbox(Arc<ShmRegion> r) : region(r) {
+    meta = reinterpret_cast<ShmInboxMeta *>(region->start_ptr());
+    rings = reinterpret_cast<Ring *>(reinterpret_cast<char *>(meta) +
+                                     sizeof(ShmInboxMeta));
+  }
+
+  static auto total_sz(const usize &max_rings) -> usize {
+    return sizeof(ShmInboxMeta) + sizeof(Ring) * max_rings;
+  }
+
+  static auto create(const std::string &name, const usize &max_rings)
+      -> ::r2::Option<Arc<ShmInbox>> {
+    auto region = ShmRegion::create(name, total_sz(max_rings));
+    if (!region) {
+      return {};
+    }
+    auto inbox = std::make_shared<ShmInbox>(region.value());
+    // the region is zeroed by ftruncate, so all rings are free and empty
+    inbox->meta->slots = kSlots;
+    inbox->meta->max_rings = max_rings;
+    inbox->meta->num_rings.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    inbox->meta->magic = ShmInboxMeta::kMagic;
+    return inbox;
+  }
+
+  static auto open(const std::string &name) -> ::r2::Option<Arc<ShmInbox>> {
+    auto region = ShmRegion::open(name);
+    if (!region || region.value()->size() < sizeof(ShmInboxMeta)) {
+      return {};
+    }
+    auto inbox = std::make_shared<ShmInbox>(region.value());
+    if (inbox->meta->magic != ShmInboxMeta::kMagic ||
+        inbox->meta->slots != kSlots ||
+        region.value()->size() < total_sz(inbox->meta->max_rings)) {
+      return {};
+    }
+    return inbox;
+  }
+
+  /*!
+    Claim a free ring for a sender
+    \ret the id of the ring
+   */
+  auto claim() -> ::r2::Option<u32> {
+    for (u64 i = 0; i < meta->max_rings; ++i) {
+      u32 expected = kShmFree;
+      if (rings[i].owner.compare_exchange_strong(expected, kShmClaimed)) {
+        auto n = meta->num_rings.load();
+        while (n < i + 1 && !meta->num_rings.compare_exchange_weak(n, i + 1)) {
+        }
+        return static_cast<u32>(i);
+      }
+    }
+    return {};
+  }
+
+  auto num_rings() const -> u64 {
+    return meta->num_rings.load(std::memory_order_acquire);
+  }
+};
+
+template <usize kSlots>
+struct ShmTransport : public STrait<ShmTransport<kSlots>> {
+  using Ring = ShmRing<kSlots>;
+
+  Arc<ShmInbox<kSlots>> inbox = nullptr;
+  Ring *ring = nullptr;
+  u32 id = 0;
+
+  // the sender's view of the head, refreshed only if the ring seems full
+  u64 cached_head = 0;
+
+  // the inbox receiving the replies, carried in the connect data
+  std::string reply_inbox;
+
+  ShmTransport() = default;
+
+  ShmTransport(Arc<ShmInbox<kSlots>> inbox, const u32 &id)
+      : inbox(inbox), ring(&inbox->rings[id]), id(id),
+        cached_head(ring->head.load(std::memory_order_acquire)) {}
+
+  // a transport owns its ring, which is released once
+  ShmTransport(const ShmTransport &) = delete;
+  auto operator=(const ShmTransport &) -> ShmTransport & = delete;
+
+  ShmTransport(ShmTransport &&o) { *this = std::move(o); }
+
+  auto operator=(ShmTransport &&o) -> ShmTransport & {
+    if (this != &o) {
+      this->release();
+      inbox = std::move(o.inbox);
+      ring = o.ring;
+      id = o.id;
+      cached_head = o.cached_head;
+      reply_inbox = std::move(o.reply_inbox);
+      o.ring = nullptr;
+    }
+    return *this;
+  }
+
+  ~ShmTransport() { this->release(); }
+
+  /*!
+    Return the ring to the inbox, the receiver frees it for a new sender
+    after consuming the msgs sent
+   */
+  void release() {
+    if (ring != nullptr) {
+      ring->owner.store(kShmReleased, std::memory_order_release);
+      ring = nullptr;
+    }
+  }
+
+  /*!
+    \param host: the name of the receiver's inbox
+    \param my_inbox: the name of my inbox, which receives the replies
+   */
+  auto connect_impl(const std::string &host, const std::string &my_inbox = "")
+      -> Result<> {
+    if (this->ring != nullptr) {
+      return ::rdmaio::Ok();
+    }
+    auto i = ShmInbox<kSlots>::open(host);
+    if (!i) {
+      return ::rdmaio::Err();
+    }
+    auto r = i.value()->claim();
+    if (!r) {
+      return ::rdmaio::Err();
+    }
+    *this = ShmTransport(i.value(), r.value());
+    this->reply_inbox = my_inbox;
+    return ::rdmaio::Ok();
+  }
+
+  auto get_connect_data_impl() -> r2::Option<std::string> {
+    return reply_inbox;
+  }
+
+  auto send_impl(const MemBlock &msg, const double &timeout = 1000000)
+      -> Result<std::string> {
+    ASSERT(msg.sz <= Ring::max_msg_sz()) << "msg too large: " << msg.sz;
+    auto n = Ring::slots_of(msg.sz);
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+
+    // a msg does not wrap around, so we may skip to the beginning
+    auto skip = (tail % kSlots) + n > kSlots ? kSlots - (tail % kSlots) : 0;
+    if (unlikely(tail + skip + n - cached_head > kSlots)) {
+      r2::Timer t;
+      do {
+        cached_head = ring->head.load(std::memory_order_acquire);
+        if (t.passed_msec() > timeout) {
+          return ::rdmaio::Timeout(std::string("shm ring full"));
+        }
+      } while (tail + skip + n - cached_head > kSlots);
+    }
+
+    if (skip > 0) {
+      *ring->header_at(tail) = {.sz = kShmSkip, .num_slots = (u32)skip};
+      tail += skip;
+    }
+    auto h = ring->header_at(tail);
+    *h = {.sz = (u32)msg.sz, .num_slots = (u32)n};
+    memcpy(reinterpret_cast<char *>(h) + sizeof(ShmMsgHeader), msg.mem_ptr,
+           msg.sz);
+    ring->tail.store(tail + n, std::memory_order_release);
+    return ::rdmaio::Ok(std::string(""));
+  }
+
+  // no registration is needed for shared memory
+  auto send_w_key_impl(const MemBlock &msg, const u32 &key,
+                       const double &timeout = 1000000) -> Result<std::string> {
+    return this->send_impl(msg, timeout);
+  }
+};
+
+template <usize kSlots>
+struct ShmRecvTransport
+    : public RTrait<ShmRecvTransport<kSlots>, ShmTransport<kSlots>> {
+  using Ring = ShmRing<kSlots>;
+
+  // a held msg keeps its slots from the sender until it is released
+  static constexpr bool kHoldMsgs = true;
+
+  // the receiver-private view of a ring
+  struct RingCursor {
+    u64 head = 0;      // the next msg to consume
+    u64 published = 0; // the head seen by the sender
+    u64 tail = 0;      // the tail loaded at begin()
+    std::vector<u64> held;
+  };
+
+  Arc<ShmInbox<kSlots>> inbox;
+  std::vector<RingCursor> cursors;
+  usize cur_ring = 0;
+  // the rings polled in the current batch
+  usize active = 0;
+
+  explicit ShmRecvTransport(Arc<ShmInbox<kSlots>> inbox)
+      : inbox(inbox), cursors(inbox->meta->max_rings) {}
+
+  void begin_impl() {
+    active = inbox->num_rings();
+    for (usize i = 0; i < active; ++i) {
+      cursors[i].tail = inbox->rings[i].tail.load(std::memory_order_acquire);
+    }
+    cur_ring = 0;
+    this->fill();
+  }
+
+  void next_impl() {
+    auto &c = cursors[cur_ring];
+    c.head += inbox->rings[cur_ring].header_at(c.head)->num_slots;
+    this->fill();
+  }
+
+  auto has_msgs_impl() -> bool { return cur_ring < active; }
+
+  auto cur_session_id_impl() -> u32 { return cur_ring; }
+
+  auto cur_msg_impl() -> MemBlock {
+    auto h = inbox->rings[cur_ring].header_at(cursors[cur_ring].head);
+    return MemBlock(reinterpret_cast<char *>(h) + sizeof(ShmMsgHeader), h->sz);
+  }
+
+  // publish the consumed slots, except the held ones and the ones after them
+  void end_impl() {
+    for (usize i = 0; i < active; ++i) {
+      this->publish(i);
+    }
+  }
+
+  auto hold_cur_msg_impl() -> u32 {
+    auto &c = cursors[cur_ring];
+    c.held.push_back(c.head);
+    ASSERT(cur_ring < (1 << 16) && (c.head % kSlots) < (1 << 16));
+    return (static_cast<u32>(cur_ring) << 16) | (c.head % kSlots);
+  }
+
+  void release_msg_impl(const u32 &token) {
+    auto &c = cursors[token >> 16];
+    for (auto it = c.held.begin(); it != c.held.end(); ++it) {
+      if ((*it % kSlots) == (token & 0xffff)) {
+        c.held.erase(it);
+        break;
+      }
+    }
+  }
+
+private:
+  // move to the first msg, starting from the current one
+  void fill() {
+    for (; cur_ring < active; ++cur_ring) {
+      auto &c = cursors[cur_ring];
+      auto &r = inbox->rings[cur_ring];
+      while (c.head < c.tail && r.header_at(c.head)->sz == kShmSkip) {
+        c.head += r.header_at(c.head)->num_slots;
+      }
+      if (c.head < c.tail) {
+        return;
+      }
+    }
+  }
+
+  void publish(const usize &i) {
+    auto &c = cursors[i];
+    auto h = c.head;
+    for (auto p : c.held) {
+      h = std::min(h, p);
+    }
+    auto &r = inbox->rings[i];
+    if (h != c.published) {
+      r.head.store(h, std::memory_order_release);
+      c.published = h;
+    }
+    // the sender stores the owner after its last msg
+    if (h == c.tail &&
+        r.owner.load(std::memory_order_acquire) == kShmReleased &&
+        h == r.tail.load(std::memory_order_acquire)) {
+      r.owner.store(kShmFree, std::memory_order_release);
+    }
+  }
+};
+
+/*!
+  The reply channels: on the Connect msg, the receiver connects to the
+  sender's inbox carried in the connect data.
+ */
+template <usize kSlots>
+struct ShmSessionManager
+    : public SessionManager<ShmSessionManager<kSlots>, ShmTransport<kSlots>,
+                            ShmRecvTransport<kSlots>> {
+  auto add_impl(const u32 &id, const MemBlock &raw_connect_data,
+                ShmRecvTransport<kSlots> &recv_trait) -> Result<> {
+    auto transport = std::make_unique<ShmTransport<kSlots>>();
+    auto res = transport->connect(std::string(
+        reinterpret_cast<char *>(raw_connect_data.mem_ptr), raw_connect_data.sz));
+    if (res != IOCode::Ok) {
+      return res;
+    }
+    this->incoming_sesions.insert(std::make_pair(id, std::move(transport)));
+    return ::rdmaio::Ok();
+  }
+};
+
+} // namespace transport
+} // namespace xstore
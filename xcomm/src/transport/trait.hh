@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 
 // Result<> to record whether the op is done
@@ -45,6 +46,12 @@ public:
 // ST state for send_trait, because receive trait will return the current send session
 template <class Derived, class ST> struct RTrait {
 public:
+  /*!
+    Whether a held msg stays intact until its release, see hold_cur_msg().
+    Otherwise the borrowed replies are copied on delivery.
+   */
+  static constexpr bool kHoldMsgs = false;
+
   void begin() { reinterpret_cast<Derived *>(this)->begin_impl(); }
 
   void end() {
@@ -65,10 +72,31 @@ public:
     return reinterpret_cast<Derived *>(this)->cur_session_id_impl();
   }
 
+  /*!
+    Keep the buffer of the current msg after end(), so that it can be read
+    in place. The buffer is re-posted after release_msg(token).
+    \ret the token of the held msg
+   */
+  auto hold_cur_msg() -> u32 {
+    return reinterpret_cast<Derived *>(this)->hold_cur_msg_impl();
+  }
+
+  void release_msg(const u32 &token) {
+    reinterpret_cast<Derived *>(this)->release_msg_impl(token);
+  }
+
   // legacy API
   auto reply_entry() -> ST {
     return reinterpret_cast<Derived *>(this)->reply_entry_impl();
   }
+
+  // default: the transport can not lend its buffers
+  auto hold_cur_msg_impl() -> u32 {
+    ASSERT(false) << "the transport does not support borrowed msgs";
+    return 0;
+  }
+
+  void release_msg_impl(const u32 &token) {}
 };
 
 template <class Derived, class SendTrait, class RecvTrait>
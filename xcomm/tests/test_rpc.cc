@@ -28,8 +28,7 @@ void test_callback(const Header &rpc_header, const MemBlock &args,
   RPCOp op;
   char reply_buf[64];
   op.set_msg(MemBlock(reply_buf, 64))
-      .set_reply()
-      .set_corid(2)
+      .set_reply_to(rpc_header)
       .add_arg<u64>(73 + 1);
   auto ret = op.execute(replyc);
   ASSERT(ret == IOCode::Ok);
@@ -113,7 +112,7 @@ TEST_F(RPC, basic) {
       .set_req()
       .set_rpc_id(rpc_id)
       .set_corid(2)
-      .add_one_reply(rpc.reply_station, {.mem_ptr = reply_buf, .sz = 1024})
+      .add_one_reply(rpc.reply_station, MemBlock(reply_buf, 1024))
       .add_arg<u64>(73);
   ret = op.execute_w_key(&sender,lkey);
   ASSERT(ret == IOCode::Ok);
@@ -141,7 +140,7 @@ TEST_F(RPC, basic) {
           .set_req()
           .set_rpc_id(rpc_id)
           .set_corid(2)
-          .add_one_reply(rpc.reply_station, {.mem_ptr = reply_buf, .sz = 1024})
+          .add_one_reply(rpc.reply_station, MemBlock(reply_buf, 1024))
           .add_arg<u64>(73);
       ret = op.execute_w_key(&sender, lkey);
       ASSERT(ret == IOCode::Ok);
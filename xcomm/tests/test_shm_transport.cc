@@ -0,0 +1,398 @@
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/rpc/mod.hh"
+#include "../src/transport/shm_t.hh"
+
+namespace test {
+
+using namespace xstore::rpc;
+using namespace xstore::transport;
+
+using ST = ShmTransport<64>;
+using RT = ShmRecvTransport<64>;
+using SM = ShmSessionManager<64>;
+
+TEST(ShmTransport, Basic) {
+  auto inbox = ShmInbox<64>::create("/xcomm_test_shm_basic", 4).value();
+  RT recv(inbox);
+
+  ST sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_basic") == IOCode::Ok);
+  ASSERT_EQ(sender.id, 0);
+
+  // messages of various sizes, which wrap around the ring many times
+  u64 sent = 0, received = 0;
+  char buf[1024];
+  while (received < 40960) {
+    for (int i = 0; i < 8 && sent < 40960; ++i) {
+      auto sz = sizeof(u64) + (sent * 73) % (sizeof(buf) - sizeof(u64));
+      *reinterpret_cast<u64 *>(buf) = sent;
+      auto ret = sender.send(MemBlock(buf, sz), 0);
+      if (ret != IOCode::Ok) {
+        // the ring is full
+        ASSERT_TRUE(ret == IOCode::Timeout);
+        break;
+      }
+      sent += 1;
+    }
+
+    for (recv.begin(); recv.has_msgs(); recv.next()) {
+      auto msg = recv.cur_msg();
+      ASSERT_EQ(recv.cur_session_id(), 0);
+      ASSERT_EQ(*msg.interpret_as<u64>(), received);
+      ASSERT_EQ(msg.sz, sizeof(u64) + (received * 73) % (sizeof(buf) - sizeof(u64)));
+      received += 1;
+    }
+    recv.end();
+  }
+}
+
+TEST(ShmTransport, Hold) {
+  auto inbox = ShmInbox<8>::create("/xcomm_test_shm_hold", 1).value();
+  ShmRecvTransport<8> recv(inbox);
+  ShmTransport<8> sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_hold") == IOCode::Ok);
+
+  u64 v = 73;
+  ASSERT_TRUE(sender.send(MemBlock(&v, sizeof(v))) == IOCode::Ok);
+  recv.begin();
+  ASSERT_TRUE(recv.has_msgs());
+  auto held = recv.cur_msg();
+  auto token = recv.hold_cur_msg();
+  recv.next();
+  recv.end();
+
+  // the held slot is not returned to the sender
+  for (int i = 0; i < 7; ++i) {
+    ASSERT_TRUE(sender.send(MemBlock(&v, sizeof(v)), 0) == IOCode::Ok);
+  }
+  for (recv.begin(); recv.has_msgs(); recv.next()) {
+  }
+  recv.end();
+  ASSERT_TRUE(sender.send(MemBlock(&v, sizeof(v)), 0) == IOCode::Timeout);
+  ASSERT_EQ(*held.interpret_as<u64>(), 73);
+
+  recv.release_msg(token);
+  recv.begin();
+  recv.end();
+  ASSERT_TRUE(sender.send(MemBlock(&v, sizeof(v)), 0) == IOCode::Ok);
+}
+
+TEST(ShmTransport, Release) {
+  auto inbox = ShmInbox<8>::create("/xcomm_test_shm_release", 1).value();
+  ShmRecvTransport<8> recv(inbox);
+
+  u64 v = 73;
+  {
+    ShmTransport<8> sender;
+    ASSERT_TRUE(sender.connect("/xcomm_test_shm_release") == IOCode::Ok);
+    ASSERT_TRUE(sender.send(MemBlock(&v, sizeof(v))) == IOCode::Ok);
+  }
+  // the ring is freed once the receiver consumes its msgs
+  ShmTransport<8> next;
+  ASSERT_FALSE(next.connect("/xcomm_test_shm_release") == IOCode::Ok);
+  usize received = 0;
+  for (recv.begin(); recv.has_msgs(); recv.next()) {
+    ASSERT_EQ(*recv.cur_msg().interpret_as<u64>(), 73);
+    received += 1;
+  }
+  recv.end();
+  ASSERT_EQ(received, 1);
+
+  ASSERT_TRUE(next.connect("/xcomm_test_shm_release") == IOCode::Ok);
+  ASSERT_EQ(next.id, 0);
+  v = 74;
+  ASSERT_TRUE(next.send(MemBlock(&v, sizeof(v))) == IOCode::Ok);
+  received = 0;
+  for (recv.begin(); recv.has_msgs(); recv.next()) {
+    ASSERT_EQ(*recv.cur_msg().interpret_as<u64>(), 74);
+    received += 1;
+  }
+  recv.end();
+  ASSERT_EQ(received, 1);
+}
+
+/*!
+  An RPC server and a client in two processes
+ */
+TEST(ShmTransport, RPC) {
+  const usize kReqs = 4000;
+  auto server_inbox = ShmInbox<64>::create("/xcomm_test_shm_server", 4).value();
+  auto client_inbox = ShmInbox<64>::create("/xcomm_test_shm_client", 1).value();
+
+  auto pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // server
+    RPCCore<ST, RT, SM> rpc(1);
+    usize served = 0;
+    rpc.reg_callback([&served](const Header &rpc_header, const MemBlock &args,
+                               ST *replyc) {
+      char reply_buf[64];
+      RPCOp op;
+      op.set_msg(MemBlock(reply_buf, 64))
+          .set_reply_to(rpc_header)
+          .add_arg<u64>(*args.interpret_as<u64>() + 1);
+      ASSERT(op.execute(replyc) == IOCode::Ok);
+      served += 1;
+    });
+    RT recv(server_inbox);
+    while (served < kReqs) {
+      if (rpc.recv_event_loop(&recv) == 0) {
+        // the client may share the core
+        sched_yield();
+      }
+    }
+    _exit(0);
+  }
+
+  ST sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_server",
+                             "/xcomm_test_shm_client") == IOCode::Ok);
+  char send_buf[64];
+  auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 64),
+                                       sender.get_connect_data().value());
+  ASSERT_TRUE(conn_op.execute(&sender) == IOCode::Ok);
+
+  const int kCors = 4;
+  RPCCore<ST, RT, SM> rpc(kCors + 1);
+  RT recv(client_inbox);
+  SScheduler ssched;
+  rpc.reg_poll_future(ssched, &recv);
+
+  usize done = 0;
+  for (int i = 0; i < kCors; ++i) {
+    ssched.spawn([&](R2_ASYNC) {
+      char req_buf[64];
+      u64 reply = 0;
+      for (u64 k = 0; k < kReqs / kCors; ++k) {
+        RPCOp op;
+        op.set_msg(MemBlock(req_buf, 64))
+            .set_req()
+            .set_rpc_id(0)
+            .set_corid(R2_COR_ID())
+            .add_one_reply(rpc.reply_station, MemBlock(&reply, sizeof(reply)))
+            .add_arg<u64>(k);
+        ASSERT(op.execute(&sender) == IOCode::Ok);
+        R2_PAUSE_AND_YIELD;
+        ASSERT(reply == k + 1);
+        done += 1;
+      }
+      if (done == kReqs) {
+        R2_STOP();
+      }
+      R2_RET;
+    });
+  }
+  ssched.run();
+  ASSERT_EQ(done, kReqs);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/*!
+  The reply of a released request is dropped, even if its slot is reused
+ */
+TEST(ShmTransport, StaleReply) {
+  auto server_inbox = ShmInbox<64>::create("/xcomm_test_shm_stale_s", 1).value();
+  auto client_inbox = ShmInbox<64>::create("/xcomm_test_shm_stale_c", 1).value();
+  RT server_recv(server_inbox), client_recv(client_inbox);
+
+  RPCCore<ST, RT, SM> server(1);
+  server.reg_callback([](const Header &rpc_header, const MemBlock &args,
+                         ST *replyc) {
+    char reply_buf[64];
+    RPCOp op;
+    op.set_msg(MemBlock(reply_buf, 64))
+        .set_reply_to(rpc_header)
+        .add_arg<u64>(*args.interpret_as<u64>() + 1);
+    ASSERT(op.execute(replyc) == IOCode::Ok);
+  });
+
+  ST sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_stale_s",
+                             "/xcomm_test_shm_stale_c") == IOCode::Ok);
+  char send_buf[64];
+  auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 64),
+                                       sender.get_connect_data().value());
+  ASSERT_TRUE(conn_op.execute(&sender) == IOCode::Ok);
+  ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+
+  RPCCore<ST, RT, SM> client(1, 1);
+  auto call = [&](RPCFuture &f, const u64 &arg, bool borrowed) {
+    RPCOp op;
+    op.set_msg(MemBlock(send_buf, 64)).set_req().set_rpc_id(0).set_corid(0);
+    if (borrowed) {
+      op.add_borrowed_reply(client.reply_station, f);
+    } else {
+      op.add_future_reply(client.reply_station, f);
+    }
+    op.add_arg<u64>(arg);
+    ASSERT_TRUE(op.execute(&sender) == IOCode::Ok);
+  };
+
+  for (bool borrowed : { false, true }) {
+    // the first request is abandoned, the second one takes its slot
+    RPCFuture abandoned, f;
+    call(abandoned, 1, borrowed);
+    abandoned.release();
+    call(f, 2, borrowed);
+    ASSERT_EQ(f.req_id & kReqSlotMask, abandoned.req_id & kReqSlotMask);
+
+    ASSERT_EQ(server.recv_event_loop(&server_recv), 2);
+    ASSERT_EQ(client.recv_event_loop(&client_recv), 2);
+    ASSERT_TRUE(f.ready());
+    ASSERT_EQ(*f.reply_as<u64>(), 3);
+    f.release();
+    ASSERT_EQ(client.reply_station.inflight(), 0);
+  }
+}
+
+TEST(ShmTransport, BorrowedReply) {
+  auto server_inbox = ShmInbox<64>::create("/xcomm_test_shm_borrow_s", 1).value();
+  auto client_inbox = ShmInbox<64>::create("/xcomm_test_shm_borrow_c", 1).value();
+  RT server_recv(server_inbox);
+  RT client_recv(client_inbox);
+
+  RPCCore<ST, RT, SM> server(1);
+  server.reg_callback([](const Header &rpc_header, const MemBlock &args,
+                         ST *replyc) {
+    char reply_buf[64];
+    RPCOp op;
+    op.set_msg(MemBlock(reply_buf, 64))
+        .set_reply_to(rpc_header)
+        .add_arg<u64>(*args.interpret_as<u64>() + 1);
+    ASSERT(op.execute(replyc) == IOCode::Ok);
+  });
+
+  ST sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_borrow_s",
+                             "/xcomm_test_shm_borrow_c") == IOCode::Ok);
+  char send_buf[64];
+  auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 64),
+                                       sender.get_connect_data().value());
+  ASSERT_TRUE(conn_op.execute(&sender) == IOCode::Ok);
+  ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+
+  RPCCore<ST, RT, SM> client(1);
+  auto call = [&](RPCFuture &f, const u64 &arg, bool borrowed) {
+    RPCOp op;
+    op.set_msg(MemBlock(send_buf, 64)).set_req().set_rpc_id(0).set_corid(0);
+    if (borrowed) {
+      op.add_borrowed_reply(client.reply_station, f);
+    } else {
+      op.add_future_reply(client.reply_station, f);
+    }
+    op.add_arg<u64>(arg);
+    ASSERT_TRUE(op.execute(&sender) == IOCode::Ok);
+    ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+    ASSERT_EQ(client.recv_event_loop(&client_recv), 1);
+    ASSERT_TRUE(f.ready());
+  };
+
+  RPCFuture f;
+  call(f, 72, true);
+  // the reply is read in place in the ring
+  auto &ring = client_inbox->rings[0];
+  auto reply = reinterpret_cast<char *>(f.reply_as<u64>());
+  ASSERT_GE(reply, reinterpret_cast<char *>(ring.slots));
+  ASSERT_LT(reply, reinterpret_cast<char *>(ring.slots) + sizeof(ring.slots));
+  ASSERT_EQ(ring.head.load(), 0);
+
+  // the replies after it are consumed, but its slot is not returned to the sender
+  for (u64 k = 0; k < 4; ++k) {
+    RPCFuture g;
+    call(g, k, false);
+    ASSERT_EQ(*g.reply_as<u64>(), k + 1);
+    g.release();
+  }
+  ASSERT_EQ(ring.head.load(), 0);
+  ASSERT_EQ(*f.reply_as<u64>(), 73);
+
+  f.release();
+  ASSERT_EQ(client.recv_event_loop(&client_recv), 0);
+  ASSERT_EQ(ring.head.load(), ring.tail.load());
+  ASSERT_EQ(client.reply_station.inflight(), 0);
+}
+
+/*!
+  A receiver whose msgs may be overwritten once consumed, as the RC ring
+ */
+struct CopyRT : public RT {
+  static constexpr bool kHoldMsgs = false;
+  using RT::RT;
+};
+
+TEST(ShmTransport, CopiedReply) {
+  auto server_inbox = ShmInbox<64>::create("/xcomm_test_shm_copy_s", 1).value();
+  auto client_inbox = ShmInbox<64>::create("/xcomm_test_shm_copy_c", 1).value();
+  RT server_recv(server_inbox);
+  CopyRT client_recv(client_inbox);
+
+  RPCCore<ST, RT, SM> server(1);
+  server.reg_callback([](const Header &rpc_header, const MemBlock &args,
+                         ST *replyc) {
+    char reply_buf[64];
+    RPCOp op;
+    op.set_msg(MemBlock(reply_buf, 64))
+        .set_reply_to(rpc_header)
+        .add_arg<u64>(*args.interpret_as<u64>() + 1);
+    ASSERT(op.execute(replyc) == IOCode::Ok);
+  });
+
+  ST sender;
+  ASSERT_TRUE(sender.connect("/xcomm_test_shm_copy_s",
+                             "/xcomm_test_shm_copy_c") == IOCode::Ok);
+  char send_buf[64];
+  auto conn_op = RPCOp::get_connect_op(MemBlock(send_buf, 64),
+                                       sender.get_connect_data().value());
+  ASSERT_TRUE(conn_op.execute(&sender) == IOCode::Ok);
+  ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+
+  RPCCore<ST, CopyRT, SM> client(1);
+  RPCFuture f;
+  RPCOp op;
+  op.set_msg(MemBlock(send_buf, 64))
+      .set_req()
+      .set_rpc_id(0)
+      .set_corid(0)
+      .add_borrowed_reply(client.reply_station, f)
+      .add_arg<u64>(72);
+  ASSERT_TRUE(op.execute(&sender) == IOCode::Ok);
+  ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+  ASSERT_EQ(client.recv_event_loop(&client_recv), 1);
+  ASSERT_TRUE(f.ready());
+
+  // the slot of the reply is not held, the replies after it overwrite it
+  const usize kMore = 64;
+  for (u64 k = 0; k < kMore; ++k) {
+    RPCFuture g;
+    RPCOp more;
+    more.set_msg(MemBlock(send_buf, 64))
+        .set_req()
+        .set_rpc_id(0)
+        .set_corid(0)
+        .add_future_reply(client.reply_station, g)
+        .add_arg<u64>(k);
+    ASSERT_TRUE(more.execute(&sender) == IOCode::Ok);
+    ASSERT_EQ(server.recv_event_loop(&server_recv), 1);
+    ASSERT_EQ(client.recv_event_loop(&client_recv), 1);
+    ASSERT_EQ(*g.reply_as<u64>(), k + 1);
+    g.release();
+  }
+  ASSERT_EQ(*f.reply_as<u64>(), 73);
+  f.release();
+  ASSERT_EQ(client.reply_station.inflight(), 0);
+}
+
+} // namespace test
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
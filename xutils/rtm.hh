@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cpuid.h>
 #include <immintrin.h>
 
 #include "./spin_lock.hh"
@@ -17,8 +18,21 @@ const usize max_abort_conflict = 10;
 // magic numbers
 const usize magic_explict_abort_flag = 0x73;
 
-struct RTMScope {
-  SpinLock *fallback_lock = nullptr;
+/*!
+  Whether the CPU runs the RTM instructions, _xbegin faults otherwise.
+ */
+inline auto rtm_supported() -> bool {
+  unsigned a, b, c, d;
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+    return false;
+  return (b & bit_RTM) != 0;
+}
+
+/*!
+  The fallback Lock needs is_locked(), lock() and unlock().
+ */
+template <typename Lock = SpinLock> struct RTMScope {
+  Lock *fallback_lock = nullptr;
 
   // used to record RTM abort data
   int retry = 0;
@@ -27,7 +41,7 @@ struct RTMScope {
   int nested = 0;
   int zero = 0;
 
-  explicit RTMScope(SpinLock *l) : fallback_lock(l) {
+  explicit RTMScope(Lock *l) : fallback_lock(l) {
 
     while (true) {
       unsigned stat;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "./memory_region.hh"
+
+namespace xstore {
+
+namespace util {
+
+using namespace rdmaio;
+
+/*!
+  A named POSIX shared memory region, so that processes on the same host can
+  map the same memory.
+  - create(): create (or truncate) the region, which is unlinked when the
+    creator frees it
+  - open(): map an existing region, its sz is read from the file
+ */
+class ShmRegion : public MemoryRegion {
+  std::string name;
+  bool owner = false;
+
+public:
+  static ::rdmaio::Option<Arc<ShmRegion>> create(const std::string &name,
+                                                 const u64 &sz) {
+    auto region = std::make_shared<ShmRegion>(name, sz, true);
+    if (region->valid())
+      return region;
+    return {};
+  }
+
+  static ::rdmaio::Option<Arc<ShmRegion>> open(const std::string &name) {
+    auto region = std::make_shared<ShmRegion>(name, 0, false);
+    if (region->valid())
+      return region;
+    return {};
+  }
+
+  ShmRegion(const std::string &n, const u64 &sz, bool create) : name(n) {
+    int fd = create ? shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0666)
+                    : shm_open(name.c_str(), O_RDWR, 0666);
+    if (fd < 0) {
+      RDMA_LOG(4) << "open shm " << name << " error: " << strerror(errno);
+      return;
+    }
+
+    this->sz = sz;
+    if (create) {
+      if (ftruncate(fd, sz) != 0) {
+        RDMA_LOG(4) << "truncate shm " << name << " error: " << strerror(errno);
+        close(fd);
+        shm_unlink(name.c_str());
+        return;
+      }
+    } else {
+      this->sz = lseek(fd, 0, SEEK_END);
+    }
+
+    void *ptr =
+        mmap(nullptr, this->sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      RDMA_LOG(4) << "map shm " << name << " error: " << strerror(errno);
+      if (create)
+        shm_unlink(name.c_str());
+      return;
+    }
+    this->addr = ptr;
+    this->owner = create;
+  }
+
+  ~ShmRegion() {
+    if (this->addr != nullptr) {
+      munmap(this->addr, this->sz);
+      if (owner)
+        shm_unlink(name.c_str());
+    }
+  }
+};
+
+} // namespace util
+
+} // namespace xstore